@@ -8,10 +8,12 @@
 
 #include "assert.h"
 #include "game.h"
+#include "gl_state.h"
 #include "platform.h"
 #include "stdarg.h"
 #include "stdbool.h"
 #include "stdio.h"
+#include "string.h"
 #include "types.h"
 #include "util.h"
 
@@ -19,6 +21,8 @@
 #define INITIAL_SCREEN_HEIGHT 640
 
 #define MOUSE_SENSITIVITY 0.001f
+// Distance between the eyes of the side by side stereo view, in meters
+#define EYE_SEPARATION 0.064f
 
 int error(const char *format, ...) {
   va_list args;
@@ -36,7 +40,46 @@ int info(const char *format, ...) {
   return result;
 }
 
-int main(void) {
+struct PlatformThread *create_thread(PlatformThreadFunction function,
+                                     const char *name, void *data) {
+  SDL_Thread *thread = SDL_CreateThread(function, name, data);
+  if (thread == NULL) {
+    error("Could not create thread %s: %s\n", name, SDL_GetError());
+  }
+  return (struct PlatformThread *)thread;
+}
+
+void join_thread(struct PlatformThread *thread) {
+  SDL_WaitThread((SDL_Thread *)thread, NULL);
+}
+
+struct PlatformSemaphore *create_semaphore(uint32_t initial_value) {
+  return (struct PlatformSemaphore *)SDL_CreateSemaphore(initial_value);
+}
+
+void destroy_semaphore(struct PlatformSemaphore *semaphore) {
+  SDL_DestroySemaphore((SDL_sem *)semaphore);
+}
+
+void wait_semaphore(struct PlatformSemaphore *semaphore) {
+  SDL_SemWait((SDL_sem *)semaphore);
+}
+
+bool try_wait_semaphore(struct PlatformSemaphore *semaphore) {
+  return SDL_SemTryWait((SDL_sem *)semaphore) == 0;
+}
+
+void post_semaphore(struct PlatformSemaphore *semaphore) {
+  SDL_SemPost((SDL_sem *)semaphore);
+}
+
+int32_t get_processor_count(void) { return SDL_GetCPUCount(); }
+
+double get_time_seconds(void) {
+  return SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency();
+}
+
+int main(int argc, char *argv[]) {
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     error("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
     return 1;
@@ -99,7 +142,12 @@ int main(void) {
   SDL_GL_SetSwapInterval(1);
   info("PITCH: %i\n", game->frame.pitch);
 
-  bool quit = false;
+  // Times the software raycaster instead of running the game
+  bool quit = argc > 1 && strcmp(argv[1], "--benchmark-raycasting") == 0;
+  if (quit) {
+    benchmark_raycasting(game);
+  }
+
   uint32_t time_last = SDL_GetTicks();
   uint32_t num_frames = 0;
   uint32_t time_begin = SDL_GetTicks();
@@ -111,6 +159,12 @@ int main(void) {
       info("%ix%i, FPS: %f\n", game->camera.viewport_width,
            game->camera.viewport_height,
            num_frames / ((time - time_begin) / (float)1000));
+      struct GLCallCounters calls = get_gl_call_counters();
+      info("GL calls per frame: %u binds, %u skipped, %u enables, "
+           "%u uniforms, %u draws, %u maps\n",
+           calls.binds, calls.skipped_calls, calls.capability_changes,
+           calls.uniform_uploads, calls.draws, calls.buffer_maps);
+      info("Terrain triangles: %u\n", get_terrain_triangle_count(game));
       num_frames = 0;
       time_begin = time;
     }
@@ -175,7 +229,8 @@ int main(void) {
     /* glBindFramebuffer(GL_FRAMEBUFFER, 0); */
 
     struct InputMatrices input_matrices = {0};
-    input_matrices.enable_stereo = false;
+    // Stereo is drawn side by side, one eye in each half of the window
+    input_matrices.enable_stereo = game->options.render_stereo;
     input_matrices.framebuffer = 0;
 
     int32_t window_width, window_height;
@@ -183,11 +238,20 @@ int main(void) {
     input_matrices.framebuffer_width = window_width;
     input_matrices.framebuffer_height = window_height;
 
-    glm_perspective(glm_rad(90), window_width / (float)window_height, 0.01f,
-                    5000.0f, input_matrices.projection_matrices[0]);
+    int32_t eye_count = input_matrices.enable_stereo ? 2 : 1;
+    float eye_width = window_width / (float)eye_count;
+    for (int32_t eye = 0; eye < eye_count; ++eye) {
+      float eye_x = 0.0f;
+      if (input_matrices.enable_stereo) {
+        eye_x = eye == 0 ? -EYE_SEPARATION / 2.0f : EYE_SEPARATION / 2.0f;
+      }
 
-    glm_lookat((vec3){0.0f, 0.0f, 0.0f}, (vec3){0.0f, 0.0f, -1.0f},
-               (vec3){0.0f, 1.0f, 0.0f}, input_matrices.view_matrices[0]);
+      glm_perspective(glm_rad(90), eye_width / (float)window_height, 0.01f,
+                      5000.0f, input_matrices.projection_matrices[eye]);
+
+      glm_lookat((vec3){eye_x, 0.0f, 0.0f}, (vec3){eye_x, 0.0f, -1.0f},
+                 (vec3){0.0f, 1.0f, 0.0f}, input_matrices.view_matrices[eye]);
+    }
     render_game(game, &input_matrices);
 
     SDL_GL_SwapWindow(window);
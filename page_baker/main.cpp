@@ -0,0 +1,126 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "world_pages_format.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// Splits a height map and color map too large to keep resident into the pages
+// of a streamed world. The world wraps around at its edges, so the border
+// heights of the last pages come from the first ones.
+
+static const uint32_t default_page_size = 1024;
+
+struct Image {
+  int32_t width;
+  int32_t height;
+  uint8_t *pixels;
+};
+
+static bool write_file(const std::string &filename, const void *data,
+                       size_t size) {
+  std::ofstream file(filename, std::ios::out | std::ios::binary);
+  if (!file) {
+    printf("ERROR: File open failed '%s'\n", filename.c_str());
+    return false;
+  }
+  file.write((const char *)data, size);
+  return true;
+}
+
+static std::vector<uint8_t> bake_page(const Image &heights,
+                                      const Image &colors, uint32_t page_size,
+                                      uint32_t page_x, uint32_t page_y) {
+  uint32_t grid_size = WORLD_PAGE_GRID_SIZE(page_size);
+  std::vector<uint8_t> page(WORLD_PAGE_FILE_SIZE(page_size));
+  for (uint32_t y = 0; y < grid_size; ++y) {
+    uint32_t world_y = (page_y * page_size + y) % heights.height;
+    for (uint32_t x = 0; x < grid_size; ++x) {
+      uint32_t world_x = (page_x * page_size + x) % heights.width;
+      page[y * grid_size + x] =
+          heights.pixels[world_y * heights.width + world_x];
+    }
+  }
+
+  uint8_t *page_colors = &page[grid_size * grid_size];
+  for (uint32_t y = 0; y < page_size; ++y) {
+    uint32_t world_y = page_y * page_size + y;
+    const uint8_t *row =
+        &colors.pixels[(world_y * colors.width + page_x * page_size) * 3];
+    std::copy(row, row + page_size * 3, &page_colors[y * page_size * 3]);
+  }
+  return page;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    printf("Usage: page_baker <height map> <color map> <output directory> "
+           "[page size]\n");
+    return EXIT_FAILURE;
+  }
+
+  uint32_t page_size = argc > 4 ? (uint32_t)atoi(argv[4]) : default_page_size;
+  if (page_size < 256 || page_size > 1024 ||
+      (page_size & (page_size - 1)) != 0) {
+    printf("ERROR: Page size must be a power of two from 256 to 1024\n");
+    return EXIT_FAILURE;
+  }
+
+  Image heights{};
+  Image colors{};
+  int32_t channels;
+  heights.pixels =
+      stbi_load(argv[1], &heights.width, &heights.height, &channels, 1);
+  if (heights.pixels == nullptr) {
+    printf("ERROR: image %s not found\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  colors.pixels =
+      stbi_load(argv[2], &colors.width, &colors.height, &channels, 3);
+  if (colors.pixels == nullptr) {
+    printf("ERROR: image %s not found\n", argv[2]);
+    return EXIT_FAILURE;
+  }
+
+  if (heights.width != colors.width || heights.height != colors.height ||
+      heights.width % page_size != 0 || heights.height % page_size != 0) {
+    printf("ERROR: Maps must be the same size, a multiple of %u texels\n",
+           page_size);
+    return EXIT_FAILURE;
+  }
+
+  WorldPagesFileHeader header{};
+  header.magic = WORLD_PAGES_MAGIC;
+  header.pages_x = heights.width / page_size;
+  header.pages_y = heights.height / page_size;
+  header.page_size = page_size;
+
+  std::string directory = argv[3];
+  if (!write_file(directory + "/world.pages", &header, sizeof(header))) {
+    return EXIT_FAILURE;
+  }
+
+  for (uint32_t page_y = 0; page_y < header.pages_y; ++page_y) {
+    for (uint32_t page_x = 0; page_x < header.pages_x; ++page_x) {
+      std::vector<uint8_t> page =
+          bake_page(heights, colors, page_size, page_x, page_y);
+      std::string filename = directory + "/" + std::to_string(page_x) + "_" +
+                             std::to_string(page_y) + ".page";
+      if (!write_file(filename, page.data(), page.size())) {
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  printf("%s holds %ux%u pages of %u texels\n", directory.c_str(),
+         header.pages_x, header.pages_y, page_size);
+
+  stbi_image_free(heights.pixels);
+  stbi_image_free(colors.pixels);
+  printf("Done!\n");
+}
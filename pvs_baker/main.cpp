@@ -0,0 +1,258 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pvs_format.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define HEIGHT_MAP_COUNT 22
+static const char *height_maps[HEIGHT_MAP_COUNT] = {
+    "maps/D1.png",  "maps/D2.png",  "maps/D3.png",  "maps/D4.png",
+    "maps/D5.png",  "maps/D6.png",  "maps/D7.png",  "maps/D9.png",
+    "maps/D10.png", "maps/D11.png", "maps/D13.png", "maps/D14.png",
+    "maps/D15.png", "maps/D16.png", "maps/D17.png", "maps/D18.png",
+    "maps/D19.png", "maps/D20.png", "maps/D21.png", "maps/D22.png",
+    "maps/D24.png", "maps/D25.png"};
+
+static const uint32_t cell_count = 16;
+// Eyes are sampled on the corners, edge midpoints and centers of the cells,
+// and of a ring of cells past the map's edges in the neighboring tiles
+static const uint32_t samples_per_cell = 2;
+static const uint32_t sample_margin = samples_per_cell;
+static const uint32_t samples_per_side =
+    cell_count * samples_per_cell + 1 + 2 * sample_margin;
+static const uint32_t band_count = 4;
+static const float band_height = 64.0f;
+static const uint32_t azimuth_count = 1024;
+// Terrain within this many height units of the horizon still counts as
+// visible. Covers the difference between the bilinear samples taken here and
+// the triangles, and the coarser LODs, drawn at runtime.
+static const float height_tolerance = 2.0f;
+
+struct HeightMap {
+  int32_t width;
+  int32_t height;
+  uint8_t *pixels;
+  // Height map texels spanned by one section, matches create_map_gl_data
+  int32_t section_width;
+  int32_t section_height;
+};
+
+typedef std::vector<uint8_t> VisibilityRow;
+
+static float get_height(const HeightMap &map, int32_t x, int32_t y) {
+  x %= map.width;
+  y %= map.height;
+  if (x < 0) {
+    x += map.width;
+  }
+  if (y < 0) {
+    y += map.height;
+  }
+  return map.pixels[y * map.width + x];
+}
+
+static float sample_height(const HeightMap &map, float x, float y) {
+  float x0 = std::floor(x), y0 = std::floor(y);
+  float fx = x - x0, fy = y - y0;
+  int32_t ix = (int32_t)x0, iy = (int32_t)y0;
+  float top = get_height(map, ix, iy) * (1.0f - fx) +
+              get_height(map, ix + 1, iy) * fx;
+  float bottom = get_height(map, ix, iy + 1) * (1.0f - fx) +
+                 get_height(map, ix + 1, iy + 1) * fx;
+  return top * (1.0f - fy) + bottom * fy;
+}
+
+static void mark_visible(const HeightMap &map, VisibilityRow &row, float x,
+                         float y) {
+  int32_t tile_x = (int32_t)std::floor(x / map.width);
+  int32_t tile_y = (int32_t)std::floor(y / map.height);
+  if (tile_x < -PVS_TILE_RADIUS || tile_x > PVS_TILE_RADIUS ||
+      tile_y < -PVS_TILE_RADIUS || tile_y > PVS_TILE_RADIUS) {
+    return;
+  }
+
+  int32_t local_x = (int32_t)(x - tile_x * map.width);
+  int32_t local_y = (int32_t)(y - tile_y * map.height);
+  int32_t section_x =
+      std::min(local_x / map.section_width, PVS_SECTIONS_PER_SIDE - 1);
+  int32_t section_y =
+      std::min(local_y / map.section_height, PVS_SECTIONS_PER_SIDE - 1);
+
+  uint32_t tile = (tile_x + PVS_TILE_RADIUS) * PVS_TILES_PER_SIDE +
+                  (tile_y + PVS_TILE_RADIUS);
+  uint32_t bit = tile * PVS_SECTIONS_PER_TILE +
+                 section_y * PVS_SECTIONS_PER_SIDE + section_x;
+  row[bit / 8] |= 1 << (bit % 8);
+}
+
+/**
+ * @brief Marks every section with terrain visible from the eye.
+ *
+ * Marches outwards along rays spread evenly around the eye, keeping track of
+ * the horizon: the steepest slope seen so far. Samples that look steeper than
+ * the horizon are visible, the rest are hidden behind what came before them.
+ *
+ * Only the samples themselves are tested. Each visible one marks the sections
+ * of the terrain closer to it than to the neighboring rays and samples, so
+ * that a section seen through a gap between them is still marked. Terrain that
+ * is visible while its nearest sample is hidden stays unmarked.
+ */
+static void cast_horizon(const HeightMap &map, float eye_x, float eye_y,
+                         float eye_height, VisibilityRow &row) {
+  float world_min_x = -PVS_TILE_RADIUS * (float)map.width;
+  float world_max_x = (PVS_TILE_RADIUS + 1) * (float)map.width;
+  float world_min_y = -PVS_TILE_RADIUS * (float)map.height;
+  float world_max_y = (PVS_TILE_RADIUS + 1) * (float)map.height;
+  // Distance across the ray to the middle between it and the next one, per
+  // unit of distance along it
+  float half_ray_spacing = std::sin((float)M_PI / azimuth_count);
+
+  for (uint32_t i = 0; i < azimuth_count; ++i) {
+    float angle = (2.0f * (float)M_PI * i) / azimuth_count;
+    float dir_x = std::cos(angle);
+    float dir_y = std::sin(angle);
+
+    float max_slope = -INFINITY;
+    float distance = 0.5f;
+    while (true) {
+      float x = eye_x + dir_x * distance;
+      float y = eye_y + dir_y * distance;
+      if (x < world_min_x || x >= world_max_x || y < world_min_y ||
+          y >= world_max_y) {
+        break;
+      }
+
+      // Far terrain covers less of the view, so the step can grow with it
+      float step = std::max(0.5f, distance / 256.0f);
+      float height = sample_height(map, x, y);
+      if ((height + height_tolerance - eye_height) / distance >= max_slope) {
+        // Sections are larger than the square, so its corners reach them all
+        float spread = step + (distance + step) * half_ray_spacing;
+        assert(spread < map.section_width && spread < map.section_height);
+        for (int32_t corner = 0; corner < 4; ++corner) {
+          mark_visible(map, row, x + (corner & 1 ? spread : -spread),
+                       y + (corner & 2 ? spread : -spread));
+        }
+      }
+      max_slope = std::max(max_slope, (height - eye_height) / distance);
+      distance += step;
+    }
+  }
+}
+
+static void bake_band(const HeightMap &map, uint32_t band,
+                      std::vector<VisibilityRow> &cells) {
+  float eye_height = (band + 1) * band_height;
+  std::vector<VisibilityRow> samples(samples_per_side * samples_per_side,
+                                     VisibilityRow(PVS_ROW_BYTES, 0));
+
+  uint32_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t]() {
+      for (uint32_t sy = t; sy < samples_per_side; sy += thread_count) {
+        for (uint32_t sx = 0; sx < samples_per_side; ++sx) {
+          float eye_x = ((float)sx - sample_margin) * map.width /
+                        (cell_count * samples_per_cell);
+          float eye_y = ((float)sy - sample_margin) * map.height /
+                        (cell_count * samples_per_cell);
+          cast_horizon(map, eye_x, eye_y, eye_height,
+                       samples[sy * samples_per_side + sx]);
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  // Samples only see from where they are, and a camera between them can see
+  // past terrain that hides something from all of them. Each cell ORs the
+  // samples of its neighbors too, the 7x7 on and inside the cells around it,
+  // which makes up for some of that but doesn't guarantee it.
+  for (uint32_t cy = 0; cy < cell_count; ++cy) {
+    for (uint32_t cx = 0; cx < cell_count; ++cx) {
+      VisibilityRow &cell = cells[(band * cell_count + cy) * cell_count + cx];
+      for (uint32_t sy = cy * samples_per_cell;
+           sy <= (cy + 1) * samples_per_cell + 2 * sample_margin; ++sy) {
+        for (uint32_t sx = cx * samples_per_cell;
+             sx <= (cx + 1) * samples_per_cell + 2 * sample_margin; ++sx) {
+          const VisibilityRow &sample = samples[sy * samples_per_side + sx];
+          for (uint32_t i = 0; i < PVS_ROW_BYTES; ++i) {
+            cell[i] |= sample[i];
+          }
+        }
+      }
+    }
+  }
+}
+
+// Bakes every height map, or only the ones given on the command line
+int main(int argc, char **argv) {
+  int32_t count = HEIGHT_MAP_COUNT;
+  const char *const *filenames = height_maps;
+  if (argc > 1) {
+    count = argc - 1;
+    filenames = &argv[1];
+  }
+
+  for (int32_t i = 0; i < count; ++i) {
+    const char *filename = filenames[i];
+    HeightMap map{};
+    int32_t channels;
+    map.pixels = stbi_load(filename, &map.width, &map.height, &channels, 1);
+    if (map.pixels == nullptr) {
+      printf("ERROR: image %s not found\n", filename);
+      return EXIT_FAILURE;
+    }
+    // The runtime mesh has one extra row and column to tile seamlessly
+    map.section_width = (map.width + 1) / PVS_SECTIONS_PER_SIDE;
+    map.section_height = (map.height + 1) / PVS_SECTIONS_PER_SIDE;
+
+    std::vector<VisibilityRow> cells(band_count * cell_count * cell_count,
+                                     VisibilityRow(PVS_ROW_BYTES, 0));
+    for (uint32_t band = 0; band < band_count; ++band) {
+      bake_band(map, band, cells);
+    }
+
+    PvsFileHeader header{};
+    header.magic = PVS_MAGIC;
+    header.cells_x = cell_count;
+    header.cells_y = cell_count;
+    header.num_bands = band_count;
+    header.band_height = band_height;
+    header.tile_radius = PVS_TILE_RADIUS;
+    header.sections_per_tile = PVS_SECTIONS_PER_TILE;
+
+    std::string output = std::string(filename) + ".pvs";
+    std::ofstream file(output, std::ios::out | std::ios::binary);
+    if (!file) {
+      printf("ERROR: File open failed '%s'\n", output.c_str());
+      return EXIT_FAILURE;
+    }
+    file.write((char *)&header, sizeof(header));
+
+    size_t visible_bits = 0;
+    for (const VisibilityRow &cell : cells) {
+      file.write((char *)cell.data(), cell.size());
+      for (uint8_t byte : cell) {
+        visible_bits += __builtin_popcount(byte);
+      }
+    }
+    printf("%s %.1f%% of sections potentially visible\n", output.c_str(),
+           100.0 * visible_bits / (cells.size() * PVS_ROW_BITS));
+
+    stbi_image_free(map.pixels);
+  }
+
+  printf("Done!\n");
+}
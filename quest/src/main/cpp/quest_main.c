@@ -5,6 +5,7 @@
 #include "android_native_app_glue.h"
 #include "cglm/cglm.h"
 #include "game.h"
+#include "platform.h"
 #include "types.h"
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
@@ -13,9 +14,12 @@
 #include <android/log.h>
 #include <android/window.h>
 #include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #define WESSING_DEBUG
@@ -44,6 +48,78 @@ int info(const char *format, ...) {
   return result;
 }
 
+struct PlatformThread {
+  pthread_t thread;
+  PlatformThreadFunction function;
+  void *data;
+};
+
+static void *run_platform_thread(void *data) {
+  struct PlatformThread *thread = data;
+  thread->function(thread->data);
+  return NULL;
+}
+
+struct PlatformThread *create_thread(PlatformThreadFunction function,
+                                     const char *name, void *data) {
+  struct PlatformThread *thread = malloc(sizeof(struct PlatformThread));
+  thread->function = function;
+  thread->data = data;
+  if (pthread_create(&thread->thread, NULL, run_platform_thread, thread) !=
+      0) {
+    error("Could not create thread %s\n", name);
+    free(thread);
+    return NULL;
+  }
+  pthread_setname_np(thread->thread, name);
+  return thread;
+}
+
+void join_thread(struct PlatformThread *thread) {
+  pthread_join(thread->thread, NULL);
+  free(thread);
+}
+
+struct PlatformSemaphore {
+  sem_t semaphore;
+};
+
+struct PlatformSemaphore *create_semaphore(uint32_t initial_value) {
+  struct PlatformSemaphore *semaphore =
+      malloc(sizeof(struct PlatformSemaphore));
+  sem_init(&semaphore->semaphore, 0, initial_value);
+  return semaphore;
+}
+
+void destroy_semaphore(struct PlatformSemaphore *semaphore) {
+  sem_destroy(&semaphore->semaphore);
+  free(semaphore);
+}
+
+void wait_semaphore(struct PlatformSemaphore *semaphore) {
+  while (sem_wait(&semaphore->semaphore) != 0) {
+  }
+}
+
+bool try_wait_semaphore(struct PlatformSemaphore *semaphore) {
+  return sem_trywait(&semaphore->semaphore) == 0;
+}
+
+void post_semaphore(struct PlatformSemaphore *semaphore) {
+  sem_post(&semaphore->semaphore);
+}
+
+int32_t get_processor_count(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int32_t)count : 1;
+}
+
+double get_time_seconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
 static const char *egl_get_error_string(EGLint error) {
   switch (error) {
   case EGL_SUCCESS:
@@ -599,6 +675,13 @@ static void load_gl_extension_functions() {
           "pointer");
     assert(glFramebufferTextureMultisampleMultiviewOVR != NULL);
   }
+
+  // Optional, checked by query_gl_capabilities
+  glMultiDrawElementsIndirectEXT =
+      (PFNGLMULTIDRAWELEMENTSINDIRECTEXTPROC)eglGetProcAddress(
+          "glMultiDrawElementsIndirectEXT");
+  glBufferStorageEXT = (PFNGLBUFFERSTORAGEEXTPROC)eglGetProcAddress(
+      "glBufferStorageEXT");
 }
 
 static void app_destroy(struct App *app) {
@@ -0,0 +1,354 @@
+#include "clipmap.h"
+#include "assert.h"
+#include "file.h"
+#include "gl_state.h"
+#include "image.h"
+#include "platform.h"
+#include "shader.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define CLIPMAP_VERTEX_COUNT (CLIPMAP_GRID_SIZE + 1)
+// Vertices of a level whose heights are used, including those hidden by the
+// finer level inside it
+#define CLIPMAP_WINDOW_SIZE CLIPMAP_VERTEX_COUNT
+
+static int32_t positive_mod(int32_t value, int32_t divisor) {
+  int32_t result = value % divisor;
+  return result < 0 ? result + divisor : result;
+}
+
+/*!
+ * Writes the indices of the grid's quads, leaving out a square hole of half
+ * the grid's size when hole_x is not negative. Triangles are split like the
+ * map sections' so that a level's vertices lie on the next coarser level's
+ * triangles.
+ *
+ * @param[out] indices
+ * @param[in]  hole_x First quad of the hole in x, negative for no hole
+ * @param[in]  hole_z First quad of the hole in z
+ * @return the number of indices written
+ */
+static int32_t generate_grid_indices(uint16_t *indices, int32_t hole_x,
+                                     int32_t hole_z) {
+  const int32_t hole_size = CLIPMAP_GRID_SIZE / 2;
+  int32_t num_indices = 0;
+  for (int32_t z = 0; z < CLIPMAP_GRID_SIZE; ++z) {
+    for (int32_t x = 0; x < CLIPMAP_GRID_SIZE; ++x) {
+      if (hole_x >= 0 && x >= hole_x && x < hole_x + hole_size &&
+          z >= hole_z && z < hole_z + hole_size) {
+        continue;
+      }
+
+      uint16_t v = (uint16_t)(z * CLIPMAP_VERTEX_COUNT + x);
+      indices[num_indices++] = v;
+      indices[num_indices++] = v + CLIPMAP_VERTEX_COUNT;
+      indices[num_indices++] = v + 1;
+
+      indices[num_indices++] = v + CLIPMAP_VERTEX_COUNT;
+      indices[num_indices++] = v + CLIPMAP_VERTEX_COUNT + 1;
+      indices[num_indices++] = v + 1;
+    }
+  }
+
+  return num_indices;
+}
+
+static void create_clipmap_meshes(struct Clipmap *clipmap) {
+  vec2 *vertices =
+      malloc(sizeof(vec2) * CLIPMAP_VERTEX_COUNT * CLIPMAP_VERTEX_COUNT);
+  for (int32_t z = 0; z < CLIPMAP_VERTEX_COUNT; ++z) {
+    for (int32_t x = 0; x < CLIPMAP_VERTEX_COUNT; ++x) {
+      vertices[z * CLIPMAP_VERTEX_COUNT + x][0] = (float)x;
+      vertices[z * CLIPMAP_VERTEX_COUNT + x][1] = (float)z;
+    }
+  }
+
+  int32_t grid_indices = CLIPMAP_GRID_SIZE * CLIPMAP_GRID_SIZE * 6;
+  uint16_t *indices = malloc(sizeof(uint16_t) * grid_indices * 5);
+
+  int32_t num_indices = generate_grid_indices(indices, -1, -1);
+  clipmap->full_grid.offset = 0;
+  clipmap->full_grid.num_indices = num_indices;
+
+  // The finer level is centered to within one of its quads, which is half a
+  // quad of this level, so the hole is at one of four offsets
+  for (int32_t i = 0; i < 4; ++i) {
+    int32_t hole_x = CLIPMAP_GRID_SIZE / 4 + (i & 1);
+    int32_t hole_z = CLIPMAP_GRID_SIZE / 4 + (i >> 1);
+    struct Mesh *ring = &clipmap->rings[i];
+    ring->offset = num_indices;
+    ring->num_indices =
+        generate_grid_indices(&indices[num_indices], hole_x, hole_z);
+    num_indices += ring->num_indices;
+  }
+
+  glGenVertexArrays(1, &clipmap->vao);
+  bind_vertex_array(clipmap->vao);
+
+  glGenBuffers(1, &clipmap->vertex_buffer);
+  bind_buffer(GL_ARRAY_BUFFER, clipmap->vertex_buffer);
+  glBufferData(GL_ARRAY_BUFFER,
+               sizeof(vec2) * CLIPMAP_VERTEX_COUNT * CLIPMAP_VERTEX_COUNT,
+               vertices, GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), (void *)0);
+  glEnableVertexAttribArray(0);
+
+  glGenBuffers(1, &clipmap->index_buffer);
+  bind_buffer(GL_ELEMENT_ARRAY_BUFFER, clipmap->index_buffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * num_indices,
+               indices, GL_STATIC_DRAW);
+
+  bind_vertex_array(0);
+
+  free(vertices);
+  free(indices);
+}
+
+int32_t create_clipmap(struct Clipmap *clipmap, const char *defines) {
+  clipmap->upload_buffer = NULL;
+  clipmap->map_index = -1;
+
+  char *vertex_source = read_file("src/shaders/clipmap.vert");
+  assert(vertex_source != NULL);
+  char *fragment_source = read_file("src/shaders/get_color.frag");
+  assert(fragment_source != NULL);
+  clipmap->shader =
+      create_shader_with_defines(defines, vertex_source, fragment_source);
+  free(vertex_source);
+  free(fragment_source);
+  if (!clipmap->shader) {
+    return GAME_ERROR;
+  }
+
+  GLuint shader = clipmap->shader;
+  clipmap->uniforms.origin = glGetUniformLocation(shader, "origin");
+  clipmap->uniforms.vertex_spacing =
+      glGetUniformLocation(shader, "vertexSpacing");
+  clipmap->uniforms.level = glGetUniformLocation(shader, "level");
+  clipmap->uniforms.map_size = glGetUniformLocation(shader, "mapSize");
+  clipmap->uniforms.color_layer = glGetUniformLocation(shader, "colorLayer");
+  use_program(shader);
+  glUniform1i(glGetUniformLocation(shader, "colorMap"), 0);
+  glUniform1i(glGetUniformLocation(shader, "heights"), 1);
+
+  create_clipmap_meshes(clipmap);
+
+  glGenTextures(1, &clipmap->height_texture);
+  bind_texture_for_update(1, GL_TEXTURE_2D_ARRAY, clipmap->height_texture);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, CLIPMAP_TEXTURE_SIZE,
+               CLIPMAP_TEXTURE_SIZE, CLIPMAP_LEVEL_COUNT, 0, GL_RED,
+               GL_UNSIGNED_BYTE, NULL);
+
+  // The color maps clamp at their edges for the map sections, clipmap levels
+  // cover several tiles of the map and repeat it instead
+  glGenSamplers(1, &clipmap->color_sampler);
+  glSamplerParameteri(clipmap->color_sampler, GL_TEXTURE_MIN_FILTER,
+                      GL_NEAREST_MIPMAP_LINEAR);
+  glSamplerParameteri(clipmap->color_sampler, GL_TEXTURE_MAG_FILTER,
+                      GL_NEAREST);
+  glSamplerParameteri(clipmap->color_sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glSamplerParameteri(clipmap->color_sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+  clipmap->upload_buffer =
+      malloc(CLIPMAP_TEXTURE_SIZE * CLIPMAP_TEXTURE_SIZE);
+  for (int32_t level = 0; level < CLIPMAP_LEVEL_COUNT; ++level) {
+    clipmap->levels[level].is_loaded = false;
+  }
+
+  info("clipmap: %d levels, %d triangles, %d KB of heights\n",
+       CLIPMAP_LEVEL_COUNT,
+       (clipmap->full_grid.num_indices +
+        (CLIPMAP_LEVEL_COUNT - 1) * clipmap->rings[0].num_indices) /
+           3,
+       CLIPMAP_TEXTURE_SIZE * CLIPMAP_TEXTURE_SIZE * CLIPMAP_LEVEL_COUNT /
+           1024);
+  return GAME_SUCCESS;
+}
+
+void free_clipmap(struct Clipmap *clipmap) {
+  if (clipmap->upload_buffer != NULL) {
+    free(clipmap->upload_buffer);
+    clipmap->upload_buffer = NULL;
+  }
+}
+
+/*!
+ * Uploads the heights of a rectangle of level texels. The rectangle must not
+ * cross a multiple of CLIPMAP_TEXTURE_SIZE, where the texture wraps around.
+ */
+static void upload_level_rect(struct Clipmap *clipmap, struct Map *map,
+                              int32_t level, int32_t x, int32_t z,
+                              int32_t width, int32_t height) {
+  struct ImageBuffer *height_map = &map->height_map;
+  uint8_t *texels = clipmap->upload_buffer;
+  for (int32_t row = 0; row < height; ++row) {
+    int32_t map_z =
+        positive_mod((z + row) * (1 << level), height_map->height);
+    for (int32_t column = 0; column < width; ++column) {
+      int32_t map_x =
+          positive_mod((x + column) * (1 << level), height_map->width);
+      texels[row * width + column] = get_image_grey(height_map, map_x, map_z);
+    }
+  }
+
+  glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0,
+                  positive_mod(x, CLIPMAP_TEXTURE_SIZE),
+                  positive_mod(z, CLIPMAP_TEXTURE_SIZE), level, width, height,
+                  1, GL_RED, GL_UNSIGNED_BYTE, texels);
+}
+
+/*!
+ * Uploads the heights of a rectangle of level texels, split where it wraps
+ * around the texture.
+ */
+static void upload_level_region(struct Clipmap *clipmap, struct Map *map,
+                                int32_t level, int32_t x, int32_t z,
+                                int32_t width, int32_t height) {
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+
+  assert(width <= CLIPMAP_TEXTURE_SIZE && height <= CLIPMAP_TEXTURE_SIZE);
+  int32_t widths[2] = {
+      CLIPMAP_TEXTURE_SIZE - positive_mod(x, CLIPMAP_TEXTURE_SIZE), 0};
+  if (widths[0] >= width) {
+    widths[0] = width;
+  }
+  widths[1] = width - widths[0];
+
+  int32_t heights[2] = {
+      CLIPMAP_TEXTURE_SIZE - positive_mod(z, CLIPMAP_TEXTURE_SIZE), 0};
+  if (heights[0] >= height) {
+    heights[0] = height;
+  }
+  heights[1] = height - heights[0];
+
+  for (int32_t j = 0, rect_z = z; j < 2; rect_z += heights[j], ++j) {
+    for (int32_t i = 0, rect_x = x; i < 2; rect_x += widths[i], ++i) {
+      if (widths[i] > 0 && heights[j] > 0) {
+        upload_level_rect(clipmap, map, level, rect_x, rect_z, widths[i],
+                          heights[j]);
+      }
+    }
+  }
+}
+
+/*!
+ * Moves each level to stay centered on the camera. The height texture is
+ * addressed toroidally, so only the rows and columns a level moved onto are
+ * uploaded.
+ *
+ * @param[in]  clipmap
+ * @param[in]  map Whose height map the clipmap samples
+ * @param[in]  map_index Of map, all levels are reloaded when it changes
+ * @param[in]  camera_terrain_position Camera position in terrain units
+ */
+void update_clipmap(struct Clipmap *clipmap, struct Map *map,
+                    int32_t map_index, vec3 camera_terrain_position) {
+  if (clipmap->map_index != map_index) {
+    clipmap->map_index = map_index;
+    for (int32_t level = 0; level < CLIPMAP_LEVEL_COUNT; ++level) {
+      clipmap->levels[level].is_loaded = false;
+    }
+  }
+
+  bind_texture_for_update(1, GL_TEXTURE_2D_ARRAY, clipmap->height_texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  for (int32_t level = 0; level < CLIPMAP_LEVEL_COUNT; ++level) {
+    // Origins are even so that every level's edge lies on vertices of the
+    // next coarser one
+    float texel_size = map->modifier * (float)(1 << (level + 1));
+    int32_t origin_x =
+        2 * (int32_t)floorf(camera_terrain_position[0] / texel_size) -
+        CLIPMAP_GRID_SIZE / 2;
+    int32_t origin_z =
+        2 * (int32_t)floorf(camera_terrain_position[2] / texel_size) -
+        CLIPMAP_GRID_SIZE / 2;
+
+    struct ClipmapLevel *clipmap_level = &clipmap->levels[level];
+    int32_t dx = origin_x - clipmap_level->origin_x;
+    int32_t dz = origin_z - clipmap_level->origin_z;
+    if (!clipmap_level->is_loaded || abs(dx) >= CLIPMAP_WINDOW_SIZE ||
+        abs(dz) >= CLIPMAP_WINDOW_SIZE) {
+      upload_level_region(clipmap, map, level, origin_x, origin_z,
+                          CLIPMAP_WINDOW_SIZE, CLIPMAP_WINDOW_SIZE);
+    } else {
+      // The columns entered in x over the new window's rows, then the rows
+      // entered in z over the columns that were already there
+      int32_t column_x = dx > 0 ? origin_x + CLIPMAP_WINDOW_SIZE - dx
+                                : origin_x;
+      upload_level_region(clipmap, map, level, column_x, origin_z, abs(dx),
+                          CLIPMAP_WINDOW_SIZE);
+
+      int32_t row_z = dz > 0 ? origin_z + CLIPMAP_WINDOW_SIZE - dz
+                             : origin_z;
+      int32_t kept_x = dx > 0 ? origin_x : origin_x - dx;
+      upload_level_region(clipmap, map, level, kept_x, row_z,
+                          CLIPMAP_WINDOW_SIZE - abs(dx), abs(dz));
+    }
+
+    clipmap_level->origin_x = origin_x;
+    clipmap_level->origin_z = origin_z;
+    clipmap_level->is_loaded = true;
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+/*!
+ * Draws every level, the finest as a full grid and the others around the
+ * hole the next finer one fills.
+ *
+ * @param[in]  clipmap
+ * @param[in]  map             The map last passed to update_clipmap
+ * @param[in]  color_map_array Holds map's color map in the layer of its index
+ * @param[in]  view_count      Number of views each level is instanced for
+ */
+void draw_clipmap(struct Clipmap *clipmap, struct Map *map,
+                  GLuint color_map_array, int32_t view_count) {
+  use_program(clipmap->shader);
+  bind_vertex_array(clipmap->vao);
+  bind_texture(0, GL_TEXTURE_2D_ARRAY, color_map_array);
+  bind_texture(1, GL_TEXTURE_2D_ARRAY, clipmap->height_texture);
+  glBindSampler(0, clipmap->color_sampler);
+
+  glUniform2i(clipmap->uniforms.map_size, map->height_map.width,
+              map->height_map.height);
+  glUniform1i(clipmap->uniforms.color_layer, clipmap->map_index);
+  count_uniform_uploads(2);
+
+  for (int32_t level = 0; level < CLIPMAP_LEVEL_COUNT; ++level) {
+    struct ClipmapLevel *clipmap_level = &clipmap->levels[level];
+    struct Mesh *mesh = &clipmap->full_grid;
+    if (level > 0) {
+      struct ClipmapLevel *finer = &clipmap->levels[level - 1];
+      int32_t hole_x = finer->origin_x / 2 - clipmap_level->origin_x -
+                       CLIPMAP_GRID_SIZE / 4;
+      int32_t hole_z = finer->origin_z / 2 - clipmap_level->origin_z -
+                       CLIPMAP_GRID_SIZE / 4;
+      assert(hole_x >= 0 && hole_x <= 1 && hole_z >= 0 && hole_z <= 1);
+      mesh = &clipmap->rings[hole_x + 2 * hole_z];
+    }
+
+    glUniform2i(clipmap->uniforms.origin, clipmap_level->origin_x,
+                clipmap_level->origin_z);
+    glUniform1f(clipmap->uniforms.vertex_spacing,
+                map->modifier * (float)(1 << level));
+    glUniform1i(clipmap->uniforms.level, level);
+    count_uniform_uploads(3);
+
+    glDrawElementsInstanced(GL_TRIANGLES, mesh->num_indices,
+                            GL_UNSIGNED_SHORT,
+                            (void *)(mesh->offset * sizeof(uint16_t)),
+                            view_count);
+    count_draws(1);
+  }
+
+  glBindSampler(0, 0);
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include "types.h"
+
+int32_t create_clipmap(struct Clipmap *clipmap, const char *defines);
+void free_clipmap(struct Clipmap *clipmap);
+void update_clipmap(struct Clipmap *clipmap, struct Map *map,
+                    int32_t map_index, vec3 camera_terrain_position);
+void draw_clipmap(struct Clipmap *clipmap, struct Map *map,
+                  GLuint color_map_array, int32_t view_count);
@@ -20,3 +20,48 @@ bool is_sphere_in_frustum(vec4 planes[6], vec3 center, float radius) {
   }
   return true;
 }
+
+/*!
+ * Tests whether every triangle bounded by a sphere and a normal cone faces
+ * away from the camera.
+ *
+ * @param[in]  center
+ * @param[in]  radius
+ * @param[in]  cone_axis   Normalized
+ * @param[in]  cone_cutoff Sine of the cone's half angle, 1 when the triangles
+ *                         can never all face away
+ * @param[in]  camera_position
+ */
+bool is_cone_backfacing(vec3 center, float radius, vec3 cone_axis,
+                        float cone_cutoff, vec3 camera_position) {
+  vec3 to_center;
+  glm_vec3_sub(center, camera_position, to_center);
+  return glm_vec3_dot(to_center, cone_axis) >=
+         cone_cutoff * glm_vec3_norm(to_center) + radius;
+}
+
+/*!
+ * @return the distance from a point to the nearest point of a box
+ */
+float get_box_distance(vec3 point, vec3 box_min, vec3 box_max) {
+  vec3 nearest;
+  glm_vec3_maxv(point, box_min, nearest);
+  glm_vec3_minv(nearest, box_max, nearest);
+  return glm_vec3_distance(point, nearest);
+}
+
+/*!
+ * Tests whether the nearest point of a box is within distance of a point.
+ *
+ * @param[in]  point
+ * @param[in]  box_min
+ * @param[in]  box_max
+ * @param[in]  distance
+ */
+bool is_box_within_distance(vec3 point, vec3 box_min, vec3 box_max,
+                            float distance) {
+  vec3 nearest;
+  glm_vec3_maxv(point, box_min, nearest);
+  glm_vec3_minv(nearest, box_max, nearest);
+  return glm_vec3_distance2(point, nearest) <= distance * distance;
+}
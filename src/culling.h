@@ -2,3 +2,8 @@
 #include "types.h"
 
 bool is_sphere_in_frustum(vec4 planes[6], vec3 center, float radius);
+bool is_cone_backfacing(vec3 center, float radius, vec3 cone_axis,
+                        float cone_cutoff, vec3 camera_position);
+float get_box_distance(vec3 point, vec3 box_min, vec3 box_max);
+bool is_box_within_distance(vec3 point, vec3 box_min, vec3 box_max,
+                            float distance);
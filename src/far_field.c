@@ -0,0 +1,287 @@
+#include "far_field.h"
+#include "assert.h"
+#include "cglm/affine.h"
+#include "file.h"
+#include "gl_state.h"
+#include "platform.h"
+#include "raycasting.h"
+#include "shader.h"
+#include "string.h"
+#include <math.h>
+#include <stdlib.h>
+
+// The meshes draw the terrain out to DISTANCE_FOG_MAX, and the far field the
+// terrain past it, raycast around the camera into a cylindrical panorama. The
+// panorama is rendered on a worker thread, its columns split over a raycast
+// pool, from wherever the camera was when it was submitted. It is drawn
+// behind the meshes until a newer one is done. Past the meshes the parallax of
+// moving FAR_FIELD_REFRESH_DISTANCE is well under a column.
+
+// Radius of the cylinder the panorama is drawn on, in terrain units. It is
+// drawn at the far plane whatever its size, this only keeps it inside the
+// frustum.
+#define FAR_FIELD_CYLINDER_RADIUS (DISTANCE_FOG_MAX * 0.5f)
+
+static int run_far_field(void *data) {
+  struct FarField *far_field = data;
+  for (;;) {
+    wait_semaphore(far_field->work_ready);
+    if (far_field->quit) {
+      break;
+    }
+
+    struct RaycastJob job = {
+        .frame = &far_field->frame,
+        .color_map = far_field->job_color_map,
+        .height_map = far_field->job_height_map,
+        .camera = NULL,
+        .panorama = &far_field->job,
+    };
+    raycast_in_bands(&far_field->pool, &job);
+    post_semaphore(far_field->work_done);
+  }
+
+  return 0;
+}
+
+/*!
+ * Builds a unit cylinder around the y axis, from y = 0 to 1, as a triangle
+ * strip of 3 floats of position and 2 of uv per vertex. u goes around from +x
+ * towards +z like the panorama's columns, and v down from the top.
+ */
+static void create_far_field_cylinder(struct FarField *far_field) {
+  float vertices[(FAR_FIELD_CYLINDER_SEGMENTS + 1) * 2 * 5];
+  for (int32_t i = 0; i <= FAR_FIELD_CYLINDER_SEGMENTS; ++i) {
+    float u = (float)i / FAR_FIELD_CYLINDER_SEGMENTS;
+    float angle = 2.0f * (float)M_PI * u;
+    float *top = &vertices[i * 10];
+    float *bottom = top + 5;
+    top[0] = bottom[0] = cosf(angle);
+    top[1] = 1.0f;
+    bottom[1] = 0.0f;
+    top[2] = bottom[2] = sinf(angle);
+    top[3] = bottom[3] = u;
+    top[4] = 0.0f;
+    bottom[4] = 1.0f;
+  }
+
+  glGenVertexArrays(1, &far_field->vao);
+  glGenBuffers(1, &far_field->vbo);
+  glBindVertexArray(far_field->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, far_field->vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  GLsizei stride = 5 * sizeof(float);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
+                        (void *)(3 * sizeof(float)));
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/*!
+ * Creates the panorama's texture and shader, and starts the worker that
+ * renders it. The caller binds the shader's FrameUniforms block.
+ *
+ * @param[out] far_field
+ * @param[in]  defines   Prepended to the shaders, as for the terrain shader
+ */
+int32_t create_far_field(struct FarField *far_field, const char *defines) {
+  memset(far_field, 0, sizeof(*far_field));
+
+  char *vertex_source = read_file("src/shaders/far_field.vert");
+  assert(vertex_source != NULL);
+  char *fragment_source = read_file("src/shaders/far_field.frag");
+  assert(fragment_source != NULL);
+  far_field->shader =
+      create_shader_with_defines(defines, vertex_source, fragment_source);
+  free(vertex_source);
+  free(fragment_source);
+  if (!far_field->shader) {
+    return GAME_ERROR;
+  }
+
+  far_field->model_uniform = glGetUniformLocation(far_field->shader, "model");
+  use_program(far_field->shader);
+  glUniform1i(glGetUniformLocation(far_field->shader, "panorama"), 0);
+
+  create_far_field_cylinder(far_field);
+
+  glGenTextures(1, &far_field->texture);
+  bind_texture_for_update(0, GL_TEXTURE_2D, far_field->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, FAR_FIELD_COLUMNS, FAR_FIELD_ROWS,
+               0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+  struct FrameBuffer *frame = &far_field->frame;
+  frame->width = FAR_FIELD_COLUMNS;
+  frame->height = FAR_FIELD_ROWS;
+  frame->clip_left_x = 0;
+  frame->clip_right_x = FAR_FIELD_COLUMNS;
+  frame->pitch = FAR_FIELD_COLUMNS * 4;
+  frame->pixels = malloc(frame->pitch * FAR_FIELD_ROWS);
+  frame->y_buffer = malloc(sizeof(int32_t) * FAR_FIELD_COLUMNS);
+  if (frame->pixels == NULL || frame->y_buffer == NULL) {
+    error("Could not allocate the far field panorama\n");
+    return GAME_ERROR;
+  }
+
+  // Leaves a core to the render thread and one to the frame pipeline
+  if (create_raycast_pool(&far_field->pool, get_processor_count() - 2) ==
+      GAME_ERROR) {
+    return GAME_ERROR;
+  }
+
+  far_field->work_ready = create_semaphore(0);
+  far_field->work_done = create_semaphore(0);
+  if (far_field->work_ready == NULL || far_field->work_done == NULL) {
+    error("Could not create far field semaphores\n");
+    return GAME_ERROR;
+  }
+
+  far_field->thread = create_thread(run_far_field, "far_field", far_field);
+  if (far_field->thread == NULL) {
+    return GAME_ERROR;
+  }
+
+  far_field->is_available = true;
+  return GAME_SUCCESS;
+}
+
+/*!
+ * Stops the worker and frees the panorama's pixels. The GL objects are left to
+ * the context.
+ */
+void free_far_field(struct FarField *far_field) {
+  if (far_field->thread != NULL) {
+    if (far_field->busy) {
+      wait_semaphore(far_field->work_done);
+      far_field->busy = false;
+    }
+    far_field->quit = true;
+    post_semaphore(far_field->work_ready);
+    join_thread(far_field->thread);
+    far_field->thread = NULL;
+  }
+
+  free_raycast_pool(&far_field->pool);
+
+  if (far_field->work_ready != NULL) {
+    destroy_semaphore(far_field->work_ready);
+    far_field->work_ready = NULL;
+  }
+
+  if (far_field->work_done != NULL) {
+    destroy_semaphore(far_field->work_done);
+    far_field->work_done = NULL;
+  }
+
+  free(far_field->frame.pixels);
+  far_field->frame.pixels = NULL;
+  free(far_field->frame.y_buffer);
+  far_field->frame.y_buffer = NULL;
+  far_field->is_available = false;
+}
+
+/*!
+ * Uploads the panorama once the worker is done with it, and submits a new one
+ * when the map changed or the camera moved away from the last one's eye.
+ *
+ * @param[in] far_field
+ * @param[in] color_map               Read by the worker until the panorama is
+ *                                    done, like height_map
+ * @param[in] height_map
+ * @param[in] map_index
+ * @param[in] tile_size               Distance at which the map repeats
+ * @param[in] camera_terrain_position
+ */
+void update_far_field(struct FarField *far_field,
+                      struct ImageBuffer *color_map,
+                      struct ImageBuffer *height_map, int32_t map_index,
+                      float tile_size, vec3 camera_terrain_position) {
+  assert(far_field->is_available);
+  if (far_field->busy) {
+    if (!try_wait_semaphore(far_field->work_done)) {
+      return;
+    }
+
+    far_field->busy = false;
+    bind_texture_for_update(0, GL_TEXTURE_2D, far_field->texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, FAR_FIELD_COLUMNS, FAR_FIELD_ROWS,
+                    GL_RGBA, GL_UNSIGNED_BYTE, far_field->frame.pixels);
+    far_field->shown = far_field->job;
+    far_field->shown_map_index = far_field->job_map_index;
+    far_field->has_panorama = true;
+  }
+
+  if (far_field->has_panorama && far_field->shown_map_index == map_index &&
+      glm_vec3_distance(far_field->shown.eye, camera_terrain_position) <
+          FAR_FIELD_REFRESH_DISTANCE) {
+    return;
+  }
+
+  struct PanoramaCamera *job = &far_field->job;
+  glm_vec3_copy(camera_terrain_position, job->eye);
+  // Starts a little short of the meshes, so that no gap opens between them
+  // before the next panorama
+  job->near = DISTANCE_FOG_MAX - FAR_FIELD_REFRESH_DISTANCE;
+  job->far = FAR_FIELD_DISTANCE;
+  job->tan_top = (255.0f - job->eye[1]) / job->near;
+  job->tan_bottom = -job->eye[1] / job->near;
+  job->fog_min = FAR_FIELD_FOG_MIN;
+  job->fog_max = FAR_FIELD_DISTANCE;
+  job->tile_size = tile_size;
+  far_field->job_color_map = color_map;
+  far_field->job_height_map = height_map;
+  far_field->job_map_index = map_index;
+  far_field->busy = true;
+  post_semaphore(far_field->work_ready);
+}
+
+/*!
+ * @return whether a panorama of the map is ready to draw
+ */
+bool is_far_field_ready(struct FarField *far_field, int32_t map_index) {
+  return far_field->is_available && far_field->has_panorama &&
+         far_field->shown_map_index == map_index;
+}
+
+/*!
+ * Draws the panorama around the camera at the far plane, behind everything
+ * drawn before it. Must be drawn after the frame uniforms are bound.
+ */
+void draw_far_field(struct FarField *far_field, vec3 camera_terrain_position,
+                    float terrain_scale, int32_t view_count) {
+  struct PanoramaCamera *shown = &far_field->shown;
+  float radius = FAR_FIELD_CYLINDER_RADIUS * terrain_scale;
+  vec3 bottom_center;
+  glm_vec3_scale(camera_terrain_position, terrain_scale, bottom_center);
+  bottom_center[1] += shown->tan_bottom * radius;
+
+  mat4 model = GLM_MAT4_IDENTITY_INIT;
+  glm_translate(model, bottom_center);
+  glm_scale(model,
+            (vec3){radius, (shown->tan_top - shown->tan_bottom) * radius,
+                   radius});
+
+  use_program(far_field->shader);
+  bind_vertex_array(far_field->vao);
+  bind_texture(0, GL_TEXTURE_2D, far_field->texture);
+  glUniformMatrix4fv(far_field->model_uniform, 1, GL_FALSE, (float *)model);
+  count_uniform_uploads(1);
+
+  // Seen from inside, at the depth the depth buffer was cleared to
+  set_capability(GL_CULL_FACE, false);
+  glDepthFunc(GL_LEQUAL);
+  glDepthMask(GL_FALSE);
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0,
+                        (FAR_FIELD_CYLINDER_SEGMENTS + 1) * 2, view_count);
+  count_draws(1);
+  glDepthMask(GL_TRUE);
+  glDepthFunc(GL_LESS);
+  set_capability(GL_CULL_FACE, true);
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "types.h"
+
+int32_t create_far_field(struct FarField *far_field, const char *defines);
+void free_far_field(struct FarField *far_field);
+void update_far_field(struct FarField *far_field,
+                      struct ImageBuffer *color_map,
+                      struct ImageBuffer *height_map, int32_t map_index,
+                      float tile_size, vec3 camera_terrain_position);
+bool is_far_field_ready(struct FarField *far_field, int32_t map_index);
+void draw_far_field(struct FarField *far_field, vec3 camera_terrain_position,
+                    float terrain_scale, int32_t view_count);
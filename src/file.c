@@ -1,4 +1,5 @@
 #include "platform.h"
+#include "stdbool.h"
 #include "stdint.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -42,3 +43,13 @@ uint32_t read_binary_file(const char *filename, uint8_t **data) {
 
   return length;
 }
+
+bool file_exists(const char *filename) {
+  FILE *file = fopen(filename, "rb");
+  if (file == NULL) {
+    return false;
+  }
+
+  fclose(file);
+  return true;
+}
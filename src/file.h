@@ -1,5 +1,9 @@
 #pragma once
+#include "stdbool.h"
+#include "stdint.h"
 
 char *read_file(const char *filename);
 
 uint32_t read_binary_file(const char *filename, uint8_t **data);
+
+bool file_exists(const char *filename);
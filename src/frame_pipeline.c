@@ -0,0 +1,108 @@
+#include "frame_pipeline.h"
+#include "assert.h"
+#include "platform.h"
+
+static int run_frame_pipeline(void *data) {
+  struct FramePipeline *pipeline = data;
+  for (;;) {
+    wait_semaphore(pipeline->work_ready);
+    if (pipeline->quit) {
+      break;
+    }
+
+    pipeline->build(pipeline->data, &pipeline->snapshot,
+                    pipeline->render_state);
+    post_semaphore(pipeline->work_done);
+  }
+
+  return 0;
+}
+
+/*!
+ * Starts a worker thread that builds one frame at a time. The semaphores hand
+ * the snapshot and RenderState back and forth, so neither is touched by both
+ * threads at once.
+ *
+ * @param[out] pipeline
+ * @param[in]  build    Called on the worker for every submitted frame
+ * @param[in]  data     Passed to build
+ */
+int32_t create_frame_pipeline(struct FramePipeline *pipeline,
+                              FramePipelineBuildFunction build, void *data) {
+  pipeline->build = build;
+  pipeline->data = data;
+  pipeline->render_state = NULL;
+  pipeline->busy = false;
+  pipeline->quit = false;
+  pipeline->thread = NULL;
+  pipeline->work_ready = create_semaphore(0);
+  pipeline->work_done = create_semaphore(0);
+  if (pipeline->work_ready == NULL || pipeline->work_done == NULL) {
+    error("Could not create frame pipeline semaphores\n");
+    return GAME_ERROR;
+  }
+
+  pipeline->thread =
+      create_thread(run_frame_pipeline, "frame_pipeline", pipeline);
+  if (pipeline->thread == NULL) {
+    return GAME_ERROR;
+  }
+
+  return GAME_SUCCESS;
+}
+
+void free_frame_pipeline(struct FramePipeline *pipeline) {
+  if (pipeline->thread != NULL) {
+    wait_frame_pipeline(pipeline);
+    pipeline->quit = true;
+    post_semaphore(pipeline->work_ready);
+    join_thread(pipeline->thread);
+    pipeline->thread = NULL;
+  }
+
+  if (pipeline->work_ready != NULL) {
+    destroy_semaphore(pipeline->work_ready);
+    pipeline->work_ready = NULL;
+  }
+
+  if (pipeline->work_done != NULL) {
+    destroy_semaphore(pipeline->work_done);
+    pipeline->work_done = NULL;
+  }
+}
+
+/*!
+ * Hands a frame to the worker. Only one frame can be in flight, call
+ * wait_frame_pipeline before submitting the next one.
+ *
+ * @param[in]  pipeline
+ * @param[in]  snapshot
+ * @param[out] render_state Must not be read or written until it is returned by
+ *                          wait_frame_pipeline
+ */
+void submit_frame_pipeline(struct FramePipeline *pipeline,
+                           struct FrameSnapshot *snapshot,
+                           struct RenderState *render_state) {
+  assert(pipeline->thread != NULL);
+  assert(!pipeline->busy && "A frame is already in flight");
+  pipeline->snapshot = *snapshot;
+  pipeline->render_state = render_state;
+  pipeline->busy = true;
+  post_semaphore(pipeline->work_ready);
+}
+
+/*!
+ * Blocks until the frame in flight is built.
+ *
+ * @return the RenderState passed to submit_frame_pipeline, or NULL when no
+ * frame was in flight
+ */
+struct RenderState *wait_frame_pipeline(struct FramePipeline *pipeline) {
+  if (!pipeline->busy) {
+    return NULL;
+  }
+
+  wait_semaphore(pipeline->work_done);
+  pipeline->busy = false;
+  return pipeline->render_state;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "types.h"
+
+int32_t create_frame_pipeline(struct FramePipeline *pipeline,
+                              FramePipelineBuildFunction build, void *data);
+void free_frame_pipeline(struct FramePipeline *pipeline);
+void submit_frame_pipeline(struct FramePipeline *pipeline,
+                           struct FrameSnapshot *snapshot,
+                           struct RenderState *render_state);
+struct RenderState *wait_frame_pipeline(struct FramePipeline *pipeline);
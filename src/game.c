@@ -3,19 +3,48 @@
 #include "cglm/affine.h"
 #include "cglm/mat4.h"
 #include "cglm/vec3.h"
+#include "clipmap.h"
 #include "culling.h"
+#include "far_field.h"
 #include "file.h"
+#include "float.h"
+#include "frame_pipeline.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "gpu_culling.h"
 #include "image.h"
 #include "math.h"
+#include "mesh_generation.h"
+#include "occlusion.h"
 #include "platform.h"
+#include "pvs.h"
 #include "raycasting.h"
+#include "ring_buffer.h"
+#include "rtin.h"
 #include "shader.h"
 #include "string.h"
+#include "tessellation.h"
 #include "types.h"
 #include "util.h"
+#include "vertex_cache.h"
+#include "virtual_texture.h"
+#include "world_streaming.h"
 #include <stdlib.h>
 
+// Map meshes are generated by a compute shader when built with
+// VR_VOX_GPU_MESH_GENERATION and compute shaders are supported. Building with
+// VR_VOX_VALIDATE_MESH_GENERATION also generates them on the CPU and reports
+// where the two differ.
+#ifdef VR_VOX_VALIDATE_MESH_GENERATION
+#define VR_VOX_GPU_MESH_GENERATION
+#endif
+
 static vec3 CAMERA_TO_TERRAIN = {BASE_MAP_SIZE, BASE_MAP_SIZE, BASE_MAP_SIZE};
+// Largest height error, in terrain units, of each LOD's adaptive mesh
+static const float ADAPTIVE_LOD_ERRORS[LOD_COUNT] = {0.5f, 2.0f, 6.0f};
+
+// Baked by page_baker, streamed instead of the maps when the world is toggled
+#define WORLD_PAGES_DIRECTORY "maps/world"
 
 static struct MapEntry maps[MAP_COUNT] = {
     {"maps/C1W.png", "maps/D1.png"},   {"maps/C2W.png", "maps/D2.png"},
@@ -34,11 +63,42 @@ static struct MapEntry maps[MAP_COUNT] = {
     {"maps/C26W.png", "maps/D18.png"}, {"maps/C27W.png", "maps/D15.png"},
     {"maps/C28W.png", "maps/D25.png"}, {"maps/C29W.png", "maps/D16.png"}};
 
-void update_world_section_distances(struct Map *map,
+/*!
+ * A mixed world steps through the maps tile by tile, with the current map on
+ * the tile the camera starts in. Every map is the same size, so the tiles of
+ * different maps line up. A streamed world draws the page on each tile from
+ * its slot.
+ *
+ * @return the map drawn on the world tile at map_x, map_y, or -1 when the
+ *         tile's page is not resident
+ */
+static int32_t get_tile_map_index(struct FrameSnapshot *frame, int32_t map_x,
+                                  int32_t map_y) {
+  if (frame->options.streamed_world) {
+    return frame->tile_slots[(map_x + PVS_TILE_RADIUS) * PVS_TILES_PER_SIDE +
+                             map_y + PVS_TILE_RADIUS];
+  }
+  if (!frame->options.mixed_world) {
+    return frame->map_index;
+  }
+  int32_t tile = map_x * PVS_TILES_PER_SIDE + map_y;
+  return (frame->map_index + tile % MAP_COUNT + MAP_COUNT) % MAP_COUNT;
+}
+
+void update_world_section_distances(struct Map *maps,
+                                    struct FrameSnapshot *frame,
                                     struct RenderState *render_state,
                                     vec3 camera_position) {
   for (int32_t i = 0; i < render_state->num_sections; ++i) {
     struct WorldSection *section = &render_state->sections_by_distance[i];
+    section->map_index =
+        get_tile_map_index(frame, section->map_x, section->map_y);
+    if (section->map_index < 0) {
+      // Sorted behind everything else and skipped
+      section->camera_distance = FLT_MAX;
+      continue;
+    }
+    struct Map *map = &maps[section->map_index];
     vec3 section_center = {0, 0, 0};
     section_center[0] += section->map_x * (float)BASE_MAP_SIZE;
     section_center[2] += section->map_y * (float)BASE_MAP_SIZE;
@@ -121,6 +181,19 @@ static void get_forward_vector(struct Camera *camera, vec3 direction,
   glm_mat4_mulv3(rotate, direction, 1, result);
 }
 
+/*!
+ * Moves the far plane of a perspective projection, keeping its near plane.
+ * Works for infinite projections as well.
+ *
+ * @param[in,out]  projection
+ * @param[in]      far
+ */
+static void set_projection_far_plane(mat4 projection, float far) {
+  float near = projection[3][2] / (projection[2][2] - 1.0f);
+  projection[2][2] = (far + near) / (near - far);
+  projection[3][2] = 2.0f * far * near / (near - far);
+}
+
 /*!
  * Calculates projection and view matrices to be used for rendering based on
  * input matrices.
@@ -153,34 +226,136 @@ static void compute_matrices(struct Game *game, struct InputMatrices *matrices,
 
     glm_mat4_mul(eye_view_matrix, view_matrix, eye_view_matrix);
 
+    // Everything past the fog distance is the same color as the sky, so there
+    // is no need to draw beyond it. The bird's eye view used to visualize the
+    // frustum needs the original far plane.
+    glm_mat4_copy(matrices->projection_matrices[i],
+                  out->projection_matrices[i]);
+    if (!game->options.visualize_frustum) {
+      set_projection_far_plane(out->projection_matrices[i],
+                               DISTANCE_FOG_MAX * camera->terrain_scale);
+    }
+
     mat4 projection_view = GLM_MAT4_IDENTITY_INIT;
-    glm_mat4_mul(matrices->projection_matrices[i], eye_view_matrix,
+    glm_mat4_mul(out->projection_matrices[i], eye_view_matrix,
                  projection_view);
 
-    glm_mat4_copy(matrices->projection_matrices[i],
-                  out->projection_matrices[i]);
     glm_mat4_copy(eye_view_matrix, out->view_matrices[i]);
     glm_mat4_copy(projection_view, out->projection_view_matrices[i]);
   }
 }
 
-static void generate_draw_commands_for_map(struct Game *game, struct Map *map,
+static void get_map_translation(struct Map *map, int32_t x, int32_t z,
+                                vec3 translate) {
+  translate[0] = x * (BASE_MAP_SIZE - map->modifier);
+  translate[1] = 0.0f;
+  translate[2] = z * (BASE_MAP_SIZE - map->modifier);
+}
+
+/*!
+ * Adds each occluder cell of a visible section to the horizon, so that
+ * sections further away can be tested against it.
+ *
+ * @param[in]  horizon
+ * @param[in]  section
+ * @param[in]  translate  Offset of the section's map in the world
+ */
+static void add_section_to_horizon(struct HorizonBuffer *horizon,
+                                   struct MapSection *section,
+                                   vec3 translate) {
+  float cell_width = (section->bounds_max[0] - section->bounds_min[0]) /
+                     SECTION_OCCLUDER_CELLS;
+  float cell_height = (section->bounds_max[2] - section->bounds_min[2]) /
+                      SECTION_OCCLUDER_CELLS;
+  for (int32_t y = 0; y < SECTION_OCCLUDER_CELLS; ++y) {
+    for (int32_t x = 0; x < SECTION_OCCLUDER_CELLS; ++x) {
+      float height = section->occluder_heights[y * SECTION_OCCLUDER_CELLS + x];
+      vec3 cell_min = {section->bounds_min[0] + x * cell_width, height,
+                       section->bounds_min[2] + y * cell_height};
+      vec3 cell_max = {cell_min[0] + cell_width, height,
+                       cell_min[2] + cell_height};
+      glm_vec3_add(cell_min, translate, cell_min);
+      glm_vec3_add(cell_max, translate, cell_max);
+      add_box_to_horizon(horizon, cell_min, cell_max);
+    }
+  }
+}
+
+/*!
+ * Adds the index ranges of a section LOD's clusters that are in the frustum
+ * and face the camera, for the next DrawCommand. Clusters next to each other
+ * in the index buffer are merged into one range.
+ *
+ * @param[in]  render_state
+ * @param[in]  clusters        The LOD's SECTION_CLUSTER_COUNT clusters
+ * @param[in]  frustum_planes  In rendering units
+ * @param[in]  translate       Offset of the section's map
+ * @param[in]  camera_position In terrain units
+ * @param[in]  terrain_scale
+ * @return the number of ranges added
+ */
+static int32_t add_visible_cluster_ranges(struct RenderState *render_state,
+                                          struct MeshCluster *clusters,
+                                          vec4 frustum_planes[6],
+                                          vec3 translate,
+                                          vec3 camera_position,
+                                          float terrain_scale) {
+  int32_t first_range = render_state->num_cluster_ranges;
+  struct DrawRange *range = NULL;
+  for (int32_t i = 0; i < SECTION_CLUSTER_COUNT; ++i) {
+    struct MeshCluster *cluster = &clusters[i];
+    if (cluster->mesh.num_indices == 0) {
+      continue;
+    }
+
+    vec3 center;
+    glm_vec3_add(cluster->center, translate, center);
+    if (is_cone_backfacing(center, cluster->radius, cluster->cone_axis,
+                           cluster->cone_cutoff, camera_position)) {
+      continue;
+    }
+
+    glm_vec3_scale(center, terrain_scale, center);
+    if (!is_sphere_in_frustum(frustum_planes, center,
+                              cluster->radius * terrain_scale)) {
+      continue;
+    }
+
+    if (range != NULL &&
+        range->mesh.offset + range->mesh.num_indices == cluster->mesh.offset &&
+        range->mesh.base_vertex == cluster->mesh.base_vertex) {
+      range->mesh.num_indices += cluster->mesh.num_indices;
+    } else {
+      range = &render_state->cluster_ranges[render_state->num_cluster_ranges];
+      ++render_state->num_cluster_ranges;
+      range->mesh = cluster->mesh;
+      range->command = render_state->num_commands;
+    }
+  }
+
+  return render_state->num_cluster_ranges - first_range;
+}
+
+static void generate_draw_commands_for_map(struct FrameSnapshot *frame,
+                                           struct RenderState *render_state,
+                                           struct Map *map, int32_t map_index,
                                            vec4 frustum_planes[6], int32_t x,
                                            int32_t z, int32_t i_section) {
-  struct Camera *camera = &game->camera;
-  vec3 translate = {x * (BASE_MAP_SIZE - map->modifier), 0.0f,
-                    z * (BASE_MAP_SIZE - map->modifier)};
-  mat4 model = GLM_MAT4_IDENTITY_INIT;
-  vec3 map_scaler = {camera->terrain_scale, camera->terrain_scale,
-                     camera->terrain_scale};
-  glm_scale(model, map_scaler);
-  glm_translate(model, translate);
-
-  if (game->render_state.num_commands == game->render_state.capacity) {
+  struct Camera *camera = &frame->camera;
+  vec3 translate;
+  get_map_translation(map, x, z, translate);
+
+  if (render_state->num_commands == render_state->command_capacity) {
     return;
   }
 
   struct MapSection *section = &map->sections[i_section];
+  struct Mesh(*lods)[SECTION_VERTEX_BLOCKS] = section->lods;
+  struct MeshCluster *clusters = section->clusters;
+  if (frame->options.adaptive_meshes) {
+    lods = section->adaptive_lods;
+    clusters = section->adaptive_clusters;
+  }
 
   vec3 cam_terrain_position;
   glm_vec3_mul(camera->position, CAMERA_TO_TERRAIN, cam_terrain_position);
@@ -188,6 +363,14 @@ static void generate_draw_commands_for_map(struct Game *game, struct Map *map,
   vec3 section_center;
   glm_vec3_add(section->center, translate, section_center);
 
+  vec3 box_min, box_max;
+  glm_vec3_add(section->bounds_min, translate, box_min);
+  glm_vec3_add(section->bounds_max, translate, box_max);
+  if (!is_box_within_distance(cam_terrain_position, box_min, box_max,
+                              DISTANCE_FOG_MAX)) {
+    return;
+  }
+
   {
     vec3 scaled_section_center;
     glm_vec3_scale(section_center, camera->terrain_scale,
@@ -199,38 +382,84 @@ static void generate_draw_commands_for_map(struct Game *game, struct Map *map,
     }
   }
 
-  float distance = glm_vec3_distance(cam_terrain_position, section_center);
+  if (frame->options.occlusion_culling) {
+    if (is_box_below_horizon(render_state->horizon, box_min, box_max)) {
+      ++render_state->num_occluded_sections;
+      return;
+    }
+    add_section_to_horizon(render_state->horizon, section, translate);
+  }
+
+  // Measured to the nearest point so that every vertex of the section is at
+  // least as far, and has finished morphing into the LOD when it is switched
+  float distance = get_box_distance(cam_terrain_position, box_min, box_max);
   int32_t lod_index = 0;
-  if (distance <= 256.0f) {
+  if (distance <= LOD1_DISTANCE) {
     lod_index = 0;
-  } else if (distance < 512.0) {
+  } else if (distance < LOD2_DISTANCE) {
     lod_index = 1;
   } else {
     lod_index = 2;
   }
 
-  struct Mesh *mesh = &section->lods[lod_index];
+  int32_t first_range = render_state->num_cluster_ranges;
+  int32_t range_capacity = render_state->cluster_range_capacity;
+  // Every other cluster could be visible, fall back to drawing the whole LOD
+  // when there may not be enough room left for the ranges
+  if (frame->options.cluster_culling &&
+      first_range + SECTION_CLUSTER_COUNT / 2 <= range_capacity) {
+    int32_t num_ranges = add_visible_cluster_ranges(
+        render_state, &clusters[lod_index * SECTION_CLUSTER_COUNT],
+        frustum_planes, translate, cam_terrain_position,
+        camera->terrain_scale);
+    if (num_ranges == 0) {
+      return;
+    }
+  } else if (first_range + SECTION_VERTEX_BLOCKS <= range_capacity) {
+    for (int32_t i_block = 0; i_block < SECTION_VERTEX_BLOCKS; ++i_block) {
+      struct DrawRange *range =
+          &render_state->cluster_ranges[first_range + i_block];
+      range->mesh = lods[lod_index][i_block];
+      range->command = render_state->num_commands;
+    }
+    render_state->num_cluster_ranges += SECTION_VERTEX_BLOCKS;
+  } else {
+    return;
+  }
+  for (int32_t i = first_range; i < render_state->num_cluster_ranges; ++i) {
+    render_state->cluster_ranges[i].map_index = map_index;
+  }
+
   struct DrawCommand *draw_command =
-      &game->render_state.commands[game->render_state.num_commands];
-  ++game->render_state.num_commands;
-  draw_command->mesh = *mesh;
+      &render_state->commands[render_state->num_commands];
+  ++render_state->num_commands;
+  draw_command->tile_offset[0] = translate[0];
+  draw_command->tile_offset[1] = translate[2];
+  draw_command->section_index = i_section;
   draw_command->lod = lod_index;
-  glm_mat4_copy(model, draw_command->model_matrix);
+  draw_command->map_index = map_index;
 }
 
-/*!
- * Calculates what the game should render. Performs LOD selection and frustum
- * culling
- *
- * @param[in]  game
- * @param[in]  matrices
- */
-static void generate_draw_commands(struct Game *game,
-                                   struct RenderingMatrices *matrices) {
-  struct Map *map = &game->maps[game->map_index];
-  /* struct Camera *camera = &game->camera; */
+// Groups ranges by map, so that each map's buffers are bound once
+static int compare_draw_ranges(const void *a, const void *b) {
+  const struct DrawRange *range_a = a;
+  const struct DrawRange *range_b = b;
+  if (range_a->map_index != range_b->map_index) {
+    return range_a->map_index < range_b->map_index ? -1 : 1;
+  }
+  const struct Mesh *mesh_a = &range_a->mesh;
+  const struct Mesh *mesh_b = &range_b->mesh;
+  if (mesh_a->offset != mesh_b->offset) {
+    return mesh_a->offset < mesh_b->offset ? -1 : 1;
+  }
+  if (mesh_a->num_indices != mesh_b->num_indices) {
+    return mesh_a->num_indices < mesh_b->num_indices ? -1 : 1;
+  }
+  return 0;
+}
 
-  vec4 frustum_planes[6];
+static void get_frustum_planes(struct RenderingMatrices *matrices,
+                               vec4 frustum_planes[6]) {
   if (matrices->enable_stereo) {
     glm_frustum_planes(matrices->projection_view_matrices[0], frustum_planes);
     vec4 right_eye_frustum_planes[6];
@@ -244,37 +473,485 @@ static void generate_draw_commands(struct Game *game,
   } else {
     glm_frustum_planes(matrices->projection_view_matrices[0], frustum_planes);
   }
+}
+
+/*!
+ * Moves the sections in the potentially visible set to the front of the array
+ *
+ * @param[in,out] sections
+ * @param[in]     num_sections
+ * @param[in]     pvs_row      Row returned by get_pvs_row
+ * @return the number of sections in the potentially visible set
+ */
+static int32_t partition_by_pvs(struct WorldSection sections[],
+                                int32_t num_sections,
+                                const uint8_t *pvs_row) {
+  int32_t num_visible = 0;
+  for (int32_t i = 0; i < num_sections; ++i) {
+    if (is_in_pvs(pvs_row, sections[i].map_x, sections[i].map_y,
+                  sections[i].section_index)) {
+      struct WorldSection temp = sections[num_visible];
+      sections[num_visible] = sections[i];
+      sections[i] = temp;
+      ++num_visible;
+    }
+  }
+
+  return num_visible;
+}
+
+/*!
+ * Calculates what the game should render. Performs LOD selection and frustum
+ * culling. Only reads the snapshot and the maps, so it can run on the frame
+ * pipeline's worker thread.
+ *
+ * @param[in]  maps         Indexed by the map index of each tile, see
+ *                          get_frame_maps
+ * @param[in]  frame
+ * @param[out] render_state
+ */
+static void generate_draw_commands(struct Map *maps,
+                                   struct FrameSnapshot *frame,
+                                   struct RenderState *render_state) {
+  render_state->frame = *frame;
+
+  vec4 frustum_planes[6];
+  get_frustum_planes(&frame->matrices, frustum_planes);
+
+  vec3 camera_position;
+  glm_vec3_mul(frame->camera.position, CAMERA_TO_TERRAIN, camera_position);
+
+  update_world_section_distances(maps, frame, render_state, camera_position);
+
+  // Only sections the baked PVS says can be seen from the camera's cell need
+  // to be sorted and tested against the frustum. The PVS was baked for a
+  // map tiled with itself, so it doesn't hold for a mixed or streamed world.
+  int32_t num_candidates = render_state->num_sections;
+  const uint8_t *pvs_row = NULL;
+  if (frame->options.use_pvs && !frame->options.mixed_world &&
+      !frame->options.streamed_world) {
+    struct Map *map = &maps[frame->map_index];
+    pvs_row =
+        get_pvs_row(&map->pvs, camera_position, BASE_MAP_SIZE - map->modifier);
+  }
+  if (pvs_row != NULL) {
+    num_candidates = partition_by_pvs(render_state->sections_by_distance,
+                                      num_candidates, pvs_row);
+  }
+  sort_world_sections(render_state->sections_by_distance, 0,
+                      num_candidates - 1);
+
+  // Sections are visited front to back, so anything hidden behind terrain
+  // drawn earlier in the frame can be skipped
+  clear_horizon(render_state->horizon, camera_position);
+  render_state->num_occluded_sections = 0;
+
+  // Sections past the fog distance are culled in
+  // generate_draw_commands_for_map, so no cap on the number of commands is
+  // needed to hide pop-in
+  render_state->num_commands = 0;
+  render_state->num_cluster_ranges = 0;
+  for (int32_t i = 0; i < num_candidates; ++i) {
+    struct WorldSection *section = &render_state->sections_by_distance[i];
+    if (section->map_index < 0) {
+      // Sorted last, so no resident sections follow
+      break;
+    }
+    generate_draw_commands_for_map(frame, render_state,
+                                   &maps[section->map_index],
+                                   section->map_index, frustum_planes,
+                                   section->map_x, section->map_y,
+                                   section->section_index);
+  }
+
+  // Every tile of a map shares the same mesh, so equal ranges end up next to
+  // each other and are drawn once, instanced for each tile
+  qsort(render_state->cluster_ranges, render_state->num_cluster_ranges,
+        sizeof(render_state->cluster_ranges[0]), compare_draw_ranges);
+}
+
+// Scale of the frustum culled with when late latching, relative to the one
+// drawn with. 0.8 widens it by about 25% to cover a frame of head motion.
+#define PIPELINE_GUARD_BAND_SCALE 0.8f
+
+static bool is_streamed_world(struct Game *game) {
+  return game->options.streamed_world && game->streaming.is_available;
+}
+
+/*!
+ * @return the maps a frame's map indices refer to, the slots of the streamed
+ *         world's pages or the loaded maps
+ */
+static struct Map *get_frame_maps(struct Game *game,
+                                  struct FrameSnapshot *frame) {
+  return frame->options.streamed_world ? game->streaming.maps : game->maps;
+}
+
+static void build_frame_render_state(void *data, struct FrameSnapshot *frame,
+                                     struct RenderState *render_state) {
+  struct Game *game = data;
+  generate_draw_commands(get_frame_maps(game, frame), frame, render_state);
+}
+
+/*!
+ * Copies the state draw commands are built from.
+ *
+ * @param[in]  game
+ * @param[in]  matrices
+ * @param[in]  guard_band  Widen the frustum by PIPELINE_GUARD_BAND_SCALE so the
+ *                         commands still cover the view when they are drawn
+ *                         with a newer pose
+ * @param[out] snapshot
+ */
+static void take_frame_snapshot(struct Game *game,
+                                struct RenderingMatrices *matrices,
+                                bool guard_band,
+                                struct FrameSnapshot *snapshot) {
+  snapshot->camera = game->camera;
+  snapshot->options = game->options;
+  snapshot->options.streamed_world = is_streamed_world(game);
+  snapshot->map_index = game->map_index;
+  snapshot->matrices = *matrices;
+  if (snapshot->options.streamed_world) {
+    for (int32_t map_x = -PVS_TILE_RADIUS; map_x <= PVS_TILE_RADIUS; ++map_x) {
+      for (int32_t map_y = -PVS_TILE_RADIUS; map_y <= PVS_TILE_RADIUS;
+           ++map_y) {
+        snapshot->tile_slots[(map_x + PVS_TILE_RADIUS) * PVS_TILES_PER_SIDE +
+                             map_y + PVS_TILE_RADIUS] =
+            (int8_t)get_world_tile_slot(&game->streaming, map_x, map_y);
+      }
+    }
+  }
+  if (!guard_band) {
+    return;
+  }
+
+  int32_t num_matrices = matrices->enable_stereo ? 2 : 1;
+  for (int32_t i = 0; i < num_matrices; ++i) {
+    mat4 *projection = &snapshot->matrices.projection_matrices[i];
+    // Scaling clip space x and y shrinks the view into a smaller part of the
+    // clip volume, so the frustum planes enclose more of the world
+    for (int32_t column = 0; column < 4; ++column) {
+      (*projection)[column][0] *= PIPELINE_GUARD_BAND_SCALE;
+      (*projection)[column][1] *= PIPELINE_GUARD_BAND_SCALE;
+    }
+    glm_mat4_mul(*projection, snapshot->matrices.view_matrices[i],
+                 snapshot->matrices.projection_view_matrices[i]);
+  }
+}
+
+/*!
+ * Without multiview, both eyes are drawn to the two halves of a side by side
+ * framebuffer in one pass. Each instance is drawn once per eye, and the
+ * vertex shaders pick the eye from the instance ID.
+ *
+ * @return the number of instances to draw of each instance of a draw
+ */
+static int32_t get_view_count(struct Game *game,
+                              struct RenderingMatrices *matrices) {
+  return matrices->enable_stereo && game->gl.caps.instanced_stereo ? 2 : 1;
+}
+
+// Clipmaps, tessellated patches and GPU culled sections are drawn from the
+// heights or buffers of a single map, so mixed and streamed worlds are always
+// drawn from the CPU's draw commands
+static bool is_single_map_world(struct Game *game) {
+  return !game->options.mixed_world && !is_streamed_world(game);
+}
+
+static bool is_tessellation_enabled(struct Game *game) {
+  return game->options.tessellated_terrain && game->gl.tessellation.shader &&
+         is_single_map_world(game);
+}
+
+static bool is_gpu_culling_enabled(struct Game *game) {
+  // Tessellated sections are culled on the CPU, like the section LODs they
+  // are compared against
+  return game->options.gpu_culling && game->gl.caps.compute_shader &&
+         !is_tessellation_enabled(game) && is_single_map_world(game);
+}
+
+static bool is_clipmap_enabled(struct Game *game) {
+  return game->options.clipmap_terrain && game->gl.clipmap.shader &&
+         is_single_map_world(game);
+}
+
+/*!
+ * GPU counterpart of generate_draw_commands. Frustum culling and LOD selection
+ * run in a compute shader, which writes the indirect draw commands directly.
+ *
+ * @param[in]  game
+ * @param[in]  matrices
+ */
+static void generate_gpu_draw_commands(struct Game *game,
+                                       struct RenderingMatrices *matrices) {
+  struct GpuCulling *culling = &game->gl.gpu_culling;
+  struct Map *map = &game->maps[game->map_index];
+  struct RenderState *render_state = game->render_state;
+
+  bool adaptive_meshes = game->options.adaptive_meshes;
+  if (culling->map_index != game->map_index ||
+      culling->adaptive_meshes != adaptive_meshes) {
+    struct GpuSection *sections =
+        calloc(render_state->num_sections, sizeof(struct GpuSection));
+    for (int32_t i = 0; i < render_state->num_sections; ++i) {
+      struct WorldSection *world_section =
+          &render_state->sections_by_distance[i];
+      struct MapSection *map_section =
+          &map->sections[world_section->section_index];
+      struct GpuSection *section = &sections[i];
+
+      vec3 translate;
+      get_map_translation(map, world_section->map_x, world_section->map_y,
+                          translate);
+      glm_vec4(translate, (float)game->map_index, section->translate);
+      glm_vec3_add(map_section->center, translate, section->center_radius);
+      section->center_radius[3] = map_section->bounding_sphere_radius;
+      glm_vec3_add(map_section->bounds_min, translate, section->bounds_min);
+      glm_vec3_add(map_section->bounds_max, translate, section->bounds_max);
+      struct Mesh(*lods)[SECTION_VERTEX_BLOCKS] =
+          adaptive_meshes ? map_section->adaptive_lods : map_section->lods;
+      for (int32_t i_block = 0; i_block < SECTION_VERTEX_BLOCKS; ++i_block) {
+        for (int32_t i_lod = 0; i_lod < LOD_COUNT; ++i_lod) {
+          section->lod_offsets[i_block][i_lod] = lods[i_lod][i_block].offset;
+          section->lod_counts[i_block][i_lod] =
+              lods[i_lod][i_block].num_indices;
+        }
+        section->base_vertices[i_block] = lods[0][i_block].base_vertex;
+      }
+    }
+    upload_gpu_culling_sections(culling, sections, render_state->num_sections,
+                                game->map_index);
+    culling->adaptive_meshes = adaptive_meshes;
+    free(sections);
+  }
+
+  vec4 frustum_planes[6];
+  get_frustum_planes(matrices, frustum_planes);
 
   vec3 camera_position;
   glm_vec3_mul(game->camera.position, CAMERA_TO_TERRAIN, camera_position);
 
-  update_world_section_distances(&game->maps[game->map_index],
-                                 &game->render_state, camera_position);
-  sort_world_sections(game->render_state.sections_by_distance, 0,
-                      game->render_state.num_sections - 1);
+  dispatch_gpu_culling(culling, &game->gl.caps, frustum_planes,
+                       camera_position, game->camera.terrain_scale,
+                       get_view_count(game, matrices));
+}
+
+/*!
+ * Creates a texture array holding every map's color map in the layer of its
+ * index, so that draws of different maps only differ in the layer they read.
+ * Layers must all be the size of the first map's color map, any other map's
+ * layer is left empty.
+ *
+ * @param[in]  gl
+ * @param[in]  maps
+ */
+static void create_color_map_array(struct OpenGLData *gl,
+                                   struct Map maps[MAP_COUNT]) {
+  glGenTextures(1, &gl->color_map_array);
+  bind_texture_for_update(0, GL_TEXTURE_2D_ARRAY, gl->color_map_array);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                  GL_NEAREST_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+#ifdef VR_VOX_USE_ASTC
+  uint32_t num_mip_levels = maps[0].num_mip_levels;
+  for (uint32_t mip = 0; mip < num_mip_levels; ++mip) {
+    struct AstcImageBuffer *color_map = &maps[0].color_map[mip];
+    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, mip,
+                           GL_COMPRESSED_RGBA_ASTC_6x6_KHR, color_map->width,
+                           color_map->height, MAP_COUNT, 0,
+                           color_map->image_data_size * MAP_COUNT, NULL);
+  }
+
+  for (int32_t i = 0; i < MAP_COUNT; ++i) {
+    struct Map *map = &maps[i];
+    if (map->num_mip_levels != num_mip_levels ||
+        map->color_map[0].width != maps[0].color_map[0].width ||
+        map->color_map[0].height != maps[0].color_map[0].height) {
+      error("Color map of map %d does not match the first map's\n", i);
+      continue;
+    }
+    for (uint32_t mip = 0; mip < num_mip_levels; ++mip) {
+      struct AstcImageBuffer *color_map = &map->color_map[mip];
+      glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip, 0, 0, i,
+                                color_map->width, color_map->height, 1,
+                                GL_COMPRESSED_RGBA_ASTC_6x6_KHR,
+                                color_map->image_data_size,
+                                color_map->image_data);
+    }
+  }
+
+#else
+  int32_t width = maps[0].color_map.width;
+  int32_t height = maps[0].color_map.height;
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, width, height, MAP_COUNT, 0,
+               GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  for (int32_t i = 0; i < MAP_COUNT; ++i) {
+    struct ImageBuffer *color_map = &maps[i].color_map;
+    if (color_map->width != width || color_map->height != height) {
+      error("Color map of map %d does not match the first map's\n", i);
+      continue;
+    }
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, GL_RGB,
+                    GL_UNSIGNED_BYTE, color_map->pixels);
+  }
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+#endif
+}
+
+static bool is_virtual_texture_enabled(struct Game *game) {
+  return game->options.virtual_texture && game->virtual_texture.atlas != 0;
+}
+
+/*!
+ * Vertical focal length in pixels, the number of pixels covered by a unit
+ * long edge one unit in front of the camera.
+ */
+static float get_projection_scale(struct RenderingMatrices *matrices,
+                                  int32_t framebuffer_height) {
+  return matrices->projection_matrices[0][1][1] * framebuffer_height / 2.0f;
+}
+
+/*!
+ * Requests the virtual texture tiles the terrain samples this frame, from the
+ * sections of the draw commands. Clipmaps and GPU culled sections have no
+ * commands, so every section within the fog is requested for them instead.
+ */
+static void request_virtual_texture_tiles(struct Game *game,
+                                          float projection_scale) {
+  struct VirtualTexture *virtual_texture = &game->virtual_texture;
+  struct RenderState *render_state = game->render_state;
+  struct FrameSnapshot *frame = &render_state->frame;
+  vec3 camera_position;
+  glm_vec3_mul(frame->camera.position, CAMERA_TO_TERRAIN, camera_position);
+
+  if (is_clipmap_enabled(game) || is_gpu_culling_enabled(game)) {
+    for (int32_t map_x = -PVS_TILE_RADIUS; map_x <= PVS_TILE_RADIUS;
+         ++map_x) {
+      for (int32_t map_y = -PVS_TILE_RADIUS; map_y <= PVS_TILE_RADIUS;
+           ++map_y) {
+        int32_t map_index = get_tile_map_index(frame, map_x, map_y);
+        struct Map *map = &game->maps[map_index];
+        vec3 translate, tile_camera;
+        get_map_translation(map, map_x, map_y, translate);
+        glm_vec3_sub(camera_position, translate, tile_camera);
+        for (int32_t i = 0; i < MAP_SECTION_COUNT; ++i) {
+          struct MapSection *section = &map->sections[i];
+          if (is_box_within_distance(tile_camera, section->bounds_min,
+                                     section->bounds_max, DISTANCE_FOG_MAX)) {
+            request_virtual_tiles(virtual_texture, map_index,
+                                  section->bounds_min, section->bounds_max,
+                                  tile_camera, projection_scale);
+          }
+        }
+      }
+    }
+    return;
+  }
+
+  for (int32_t i = 0; i < render_state->num_commands; ++i) {
+    struct DrawCommand *command = &render_state->commands[i];
+    struct MapSection *section =
+        &game->maps[command->map_index].sections[command->section_index];
+    vec3 translate = {command->tile_offset[0], 0.0f, command->tile_offset[1]};
+    vec3 tile_camera;
+    glm_vec3_sub(camera_position, translate, tile_camera);
+    request_virtual_tiles(virtual_texture, command->map_index,
+                          section->bounds_min, section->bounds_max,
+                          tile_camera, projection_scale);
+  }
+}
+
+/*!
+ * Makes the color maps the frame samples resident. The virtual texture is
+ * created on the first frame that uses it, once the size of the framebuffer
+ * is known, and the color map array only when the virtual texture is turned
+ * off.
+ *
+ * @param[in]  game
+ * @param[in]  matrices
+ * @param[in]  framebuffer_height In pixels
+ */
+static void update_color_maps(struct Game *game,
+                              struct RenderingMatrices *matrices,
+                              int32_t framebuffer_height) {
+  struct OpenGLData *gl = &game->gl;
+  struct VirtualTexture *virtual_texture = &game->virtual_texture;
+  float projection_scale = get_projection_scale(matrices, framebuffer_height);
+  if (game->options.virtual_texture && virtual_texture->atlas == 0) {
+    if (create_virtual_texture(virtual_texture, game->maps,
+                               projection_scale) == GAME_ERROR) {
+      error("Could not create virtual texture, using the color map array\n");
+      free_virtual_texture(virtual_texture);
+      game->options.virtual_texture = false;
+    } else {
+      set_virtual_texture_layout(virtual_texture, gl->terrain_shader);
+      set_virtual_texture_layout(virtual_texture, gl->hand_shader);
+      set_virtual_texture_layout(virtual_texture, gl->clipmap.shader);
+      set_virtual_texture_layout(virtual_texture, gl->tessellation.shader);
+    }
+  }
+
+  if (!is_virtual_texture_enabled(game)) {
+    if (gl->color_map_array == 0) {
+      create_color_map_array(gl, game->maps);
+    }
+    return;
+  }
 
-  // Through manual inspection, 70 sections appears to be the lower bound of
-  // what we can draw at the current fog level to hide all pop-in
-  game->render_state.num_commands = 0;
-  for (int32_t i = 0; i < game->render_state.num_sections &&
-                      game->render_state.num_commands < 70;
-       ++i) {
-    struct WorldSection *section = &game->render_state.sections_by_distance[i];
-    generate_draw_commands_for_map(game, map, frustum_planes, section->map_x,
-                                   section->map_y, section->section_index);
+  if (!game->render_state->frame.options.streamed_world) {
+    request_virtual_texture_tiles(game, projection_scale);
   }
+  update_virtual_texture(virtual_texture);
+  bind_virtual_texture(virtual_texture);
+}
+
+/*!
+ * The far field is raycast from a single map's heights and colors. It isn't
+ * created in ASTC builds, which don't keep the colors uncompressed.
+ */
+static bool is_far_field_enabled(struct Game *game) {
+  return game->options.far_field && game->far_field.is_available &&
+         is_single_map_world(game) && !game->options.visualize_frustum;
 }
 
-static void render_hands(struct Game *game, struct Map *map,
-                         struct RenderingMatrices *matrices) {
+static bool is_far_field_shown(struct Game *game) {
+  return is_far_field_enabled(game) &&
+         is_far_field_ready(&game->far_field,
+                            game->render_state->frame.map_index);
+}
+
+static void update_far_field_panorama(struct Game *game) {
+#ifndef VR_VOX_USE_ASTC
+  if (!is_far_field_enabled(game)) {
+    return;
+  }
+
+  int32_t map_index = game->render_state->frame.map_index;
+  struct Map *map = &game->maps[map_index];
+  vec3 camera_position;
+  glm_vec3_mul(game->camera.position, CAMERA_TO_TERRAIN, camera_position);
+  update_far_field(&game->far_field, &map->color_map, &map->height_map,
+                   map_index, BASE_MAP_SIZE - map->modifier, camera_position);
+#endif
+}
+
+static void render_hands(struct Game *game, int32_t map_index,
+                         int32_t view_count) {
   struct OpenGLData *gl = &game->gl;
-  glBindVertexArray(gl->cube_buffer.vao);
-  glUseProgram(gl->hand_shader);
+  bind_vertex_array(gl->cube_buffer.vao);
+  use_program(gl->hand_shader);
 
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, map->color_map_tex_id);
+  bind_texture(0, GL_TEXTURE_2D_ARRAY, gl->color_map_array);
 
   glUniform1i(gl->hand_shader_uniforms.color_map, 0);
+  glUniform1i(gl->hand_shader_uniforms.color_layer, map_index);
+  glUniform1i(gl->hand_shader_uniforms.use_virtual_texture,
+              is_virtual_texture_enabled(game));
+  count_uniform_uploads(3);
 
   for (uint32_t i = 0; i < 2; ++i) {
     struct ControllerState *controller = &game->controller[i];
@@ -300,23 +977,289 @@ static void render_hands(struct Game *game, struct Map *map,
     glm_quat_rotate(model, controller->pose.orientation, model);
     glm_scale(model, (vec3){0.1f, 0.1f, 0.1f});
     glm_mat4_mul(camera_transform, model, model);
+    glUniformMatrix4fv(gl->hand_shader_uniforms.model, 1, GL_FALSE,
+                       (float *)model);
+    count_uniform_uploads(1);
+
+    glDrawElementsInstanced(GL_TRIANGLES, gl->cube_buffer.index_count,
+                            GL_UNSIGNED_INT, gl->cube_buffer.index_offset,
+                            view_count);
+    count_draws(1);
+  }
+}
+
+// Alignment of every allocation from the frame ring, enough for indirect
+// commands, vertex attributes and uniform buffers
+#define FRAME_RING_ALIGNMENT 256
+
+/*!
+ * @return the index after the run of ranges equal to the one at first
+ */
+static int32_t get_range_run_end(struct RenderState *render_state,
+                                 int32_t first) {
+  int32_t end = first + 1;
+  while (end < render_state->num_cluster_ranges &&
+         compare_draw_ranges(&render_state->cluster_ranges[first],
+                             &render_state->cluster_ranges[end]) == 0) {
+    ++end;
+  }
+  return end;
+}
 
-    for (uint32_t i = 0; i < (matrices->enable_stereo ? 2 : 1); ++i) {
-      mat4 mvp;
-      glm_mat4_mul(matrices->projection_view_matrices[i], model, mvp);
-      glUniformMatrix4fv(gl->hand_shader_uniforms.mvp[i], 1, GL_FALSE,
-                         (float *)mvp);
+/*!
+ * Draws runs of equal cluster ranges that all index the bound map's buffers,
+ * with one multi draw when supported, otherwise each run on its own. The
+ * DrawInfo attribute is part of the vertex array's state, so it is set up
+ * again for every map.
+ *
+ * @param[in]  game
+ * @param[in]  first_range       The first run's first cluster range
+ * @param[in]  first_draw        The first run's indirect command
+ * @param[in]  num_draws         Number of runs
+ * @param[in]  draw_infos_offset Of the first cluster range's DrawInfo
+ * @param[in]  commands_offset   Of the first indirect command
+ * @param[in]  view_count        See get_view_count
+ */
+static void draw_terrain_runs(struct Game *game, int32_t first_range,
+                              int32_t first_draw, int32_t num_draws,
+                              uintptr_t draw_infos_offset,
+                              uintptr_t commands_offset, int32_t view_count) {
+  struct OpenGLData *gl = &game->gl;
+  bool use_base_instance = gl->caps.base_instance;
+
+  glEnableVertexAttribArray(DRAW_INFO_ATTRIBUTE);
+  // Every eye's copy of an instance reads the same record
+  glVertexAttribDivisor(DRAW_INFO_ATTRIBUTE, view_count);
+  glVertexAttribPointer(DRAW_INFO_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE,
+                        sizeof(struct DrawInfo), (void *)draw_infos_offset);
+
+  uintptr_t first_command =
+      commands_offset + first_draw * sizeof(struct DrawElementsIndirectCommand);
+  if (gl->caps.multi_draw_indirect && use_base_instance) {
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT,
+                                (void *)first_command, num_draws, 0);
+    count_draws(1);
+  } else {
+    int32_t first = first_range;
+    for (int32_t i_draw = 0; i_draw < num_draws; ++i_draw) {
+      if (!use_base_instance) {
+        // Point the instanced attribute at this draw's first record instead
+        glVertexAttribPointer(
+            DRAW_INFO_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(struct DrawInfo),
+            (void *)(draw_infos_offset + first * sizeof(struct DrawInfo)));
+      }
+      glDrawElementsIndirect(
+          GL_TRIANGLES, GL_UNSIGNED_SHORT,
+          (void *)(first_command +
+                   i_draw * sizeof(struct DrawElementsIndirectCommand)));
+      first = get_range_run_end(game->render_state, first);
     }
+    count_draws(num_draws);
+  }
+
+  glVertexAttribDivisor(DRAW_INFO_ATTRIBUTE, 0);
+  glDisableVertexAttribArray(DRAW_INFO_ATTRIBUTE);
+}
+
+/*!
+ * Uploads the draw commands generated on the CPU. The sorted cluster ranges
+ * each get a DrawInfo record with their command's map offset, LOD and color
+ * map layer, read through an instanced attribute. Every run of equal ranges
+ * becomes one indirect draw, instanced once per map tile, whose base instance
+ * selects the run's first record. The terrain of each map is then drawn with
+ * its buffers bound, see draw_terrain_runs. All maps share the color map
+ * array, or the pages of a streamed world theirs, so nothing else changes
+ * between them.
+ *
+ * @param[in]  game
+ * @param[in]  view_count See get_view_count
+ */
+static void draw_terrain_commands(struct Game *game, int32_t view_count) {
+  struct OpenGLData *gl = &game->gl;
+  struct RenderState *render_state = game->render_state;
+  bool use_base_instance = gl->caps.base_instance;
+  int32_t num_ranges = render_state->num_cluster_ranges;
+
+  uintptr_t draw_infos_offset, commands_offset;
+  struct DrawInfo *draw_infos = allocate_from_ring_buffer(
+      &gl->frame_ring, num_ranges * sizeof(struct DrawInfo),
+      FRAME_RING_ALIGNMENT, &draw_infos_offset);
+  struct DrawElementsIndirectCommand *gl_commands = allocate_from_ring_buffer(
+      &gl->frame_ring, num_ranges * sizeof(struct DrawElementsIndirectCommand),
+      FRAME_RING_ALIGNMENT, &commands_offset);
+  if (draw_infos == NULL || gl_commands == NULL) {
+    return;
+  }
+
+  for (int32_t i_range = 0; i_range < num_ranges; ++i_range) {
+    struct DrawRange *range = &render_state->cluster_ranges[i_range];
+    struct DrawCommand *command = &render_state->commands[range->command];
+    draw_infos[i_range] = (struct DrawInfo){
+        .offset_x = command->tile_offset[0],
+        .offset_z = command->tile_offset[1],
+        .lod = (float)command->lod,
+        .color_layer = (float)command->map_index,
+    };
+  }
+
+  int32_t num_draws = 0;
+  for (int32_t first = 0; first < num_ranges;) {
+    int32_t end = get_range_run_end(render_state, first);
+    struct Mesh *mesh = &render_state->cluster_ranges[first].mesh;
+    gl_commands[num_draws] = (struct DrawElementsIndirectCommand){
+        .count = mesh->num_indices,
+        .instance_count = (end - first) * view_count,
+        .first_index = mesh->offset,
+        .base_vertex = mesh->base_vertex,
+        .base_instance = use_base_instance ? first : 0,
+    };
+    ++num_draws;
+    first = end;
+  }
+
+  finish_ring_buffer_writes(&gl->frame_ring);
+  bind_buffer(GL_ARRAY_BUFFER, gl->frame_ring.buffer);
+  bind_buffer(GL_DRAW_INDIRECT_BUFFER, gl->frame_ring.buffer);
+
+  // Ranges are sorted by map, so each map's runs follow each other
+  struct Map *maps = get_frame_maps(game, &render_state->frame);
+  int32_t first_draw = 0;
+  for (int32_t first = 0; first < num_ranges;) {
+    int32_t map_index = render_state->cluster_ranges[first].map_index;
+    int32_t end = first;
+    int32_t end_draw = first_draw;
+    while (end < num_ranges &&
+           render_state->cluster_ranges[end].map_index == map_index) {
+      end = get_range_run_end(render_state, end);
+      ++end_draw;
+    }
+
+    bind_vertex_array(maps[map_index].map_vao);
+    draw_terrain_runs(game, first, first_draw, end_draw - first_draw,
+                      draw_infos_offset, commands_offset, view_count);
+    first = end;
+    first_draw = end_draw;
+  }
+}
+
+/*!
+ * Draws the sections of the CPU generated draw commands as tessellated
+ * patches, each command's section whole instead of its visible clusters.
+ *
+ * @param[in]  game
+ * @param[in]  map                The map the commands were built for
+ * @param[in]  matrices
+ * @param[in]  framebuffer_height In pixels
+ * @param[in]  view_count         See get_view_count
+ */
+static void draw_tessellated_sections(struct Game *game, struct Map *map,
+                                      struct RenderingMatrices *matrices,
+                                      int32_t framebuffer_height,
+                                      int32_t view_count) {
+  struct OpenGLData *gl = &game->gl;
+  struct RenderState *render_state = game->render_state;
+  int32_t num_commands = render_state->num_commands;
+
+  uintptr_t draw_infos_offset;
+  struct DrawInfo *draw_infos = allocate_from_ring_buffer(
+      &gl->frame_ring, num_commands * sizeof(struct DrawInfo),
+      FRAME_RING_ALIGNMENT, &draw_infos_offset);
+  if (draw_infos == NULL) {
+    return;
+  }
+
+  for (int32_t i = 0; i < num_commands; ++i) {
+    struct DrawCommand *command = &render_state->commands[i];
+    draw_infos[i] = (struct DrawInfo){
+        .offset_x = command->tile_offset[0],
+        .offset_z = command->tile_offset[1],
+        .lod = (float)command->lod,
+        .color_layer = (float)command->map_index,
+    };
+  }
+  finish_ring_buffer_writes(&gl->frame_ring);
+
+  update_tessellated_terrain(&gl->tessellation, map,
+                             render_state->frame.map_index);
+  float projection_scale = get_projection_scale(matrices, framebuffer_height);
+  draw_tessellated_terrain(&gl->tessellation, map, gl->color_map_array,
+                           render_state->commands, num_commands,
+                           gl->frame_ring.buffer, draw_infos_offset,
+                           projection_scale, view_count);
+}
 
-    glDrawElements(GL_TRIANGLES, gl->cube_buffer.index_count, GL_UNSIGNED_INT,
-                   gl->cube_buffer.index_offset);
+/*!
+ * Writes the state shared by every draw of the frame to the frame ring and
+ * binds it to FRAME_UNIFORMS_BINDING.
+ *
+ * @param[in]  game
+ * @param[in]  projection_views
+ * @param[in]  eye_count
+ */
+static void update_frame_uniforms(struct Game *game, mat4 projection_views[2],
+                                  int32_t eye_count) {
+  struct OpenGLData *gl = &game->gl;
+  uintptr_t offset;
+  struct FrameUniforms *uniforms =
+      allocate_from_ring_buffer(&gl->frame_ring, sizeof(struct FrameUniforms),
+                                FRAME_RING_ALIGNMENT, &offset);
+  if (uniforms == NULL) {
+    return;
+  }
+
+  for (int32_t eye = 0; eye < eye_count; ++eye) {
+    glm_mat4_copy(projection_views[eye], uniforms->projection_views[eye]);
+  }
+  glm_vec4_copy(game->camera.sky_color, uniforms->fog_color);
+  glm_vec3_mul(game->camera.position, CAMERA_TO_TERRAIN,
+               uniforms->camera_position);
+  glm_vec3_scale(uniforms->camera_position, game->camera.terrain_scale,
+                 uniforms->camera_position);
+  uniforms->terrain_scale = game->camera.terrain_scale;
+  // The meshes fog the same way as the far field behind them
+  if (is_far_field_shown(game)) {
+    uniforms->fog_distances[0] = FAR_FIELD_FOG_MIN;
+    uniforms->fog_distances[1] = FAR_FIELD_DISTANCE;
+  } else {
+    uniforms->fog_distances[0] = DISTANCE_FOG_MIN;
+    uniforms->fog_distances[1] = DISTANCE_FOG_MAX;
   }
+  uniforms->height_map_size[0] = BASE_MAP_SIZE;
+  uniforms->height_map_size[1] = BASE_MAP_SIZE;
+  uniforms->lod_morph_ranges[0] = LOD1_DISTANCE * (1.0f - LOD_MORPH_FRACTION);
+  uniforms->lod_morph_ranges[1] = LOD1_DISTANCE;
+  uniforms->lod_morph_ranges[2] =
+      LOD2_DISTANCE - (LOD2_DISTANCE - LOD1_DISTANCE) * LOD_MORPH_FRACTION;
+  uniforms->lod_morph_ranges[3] = LOD2_DISTANCE;
+  uniforms->flags = 0;
+  if (!game->options.visualize_frustum && game->options.show_fog) {
+    uniforms->flags |= TERRAIN_FLAG_ENABLE_FOG;
+  }
+  if (game->options.visualize_lod) {
+    uniforms->flags |= TERRAIN_FLAG_VISUALIZE_LOD;
+  }
+  if (eye_count == 2 && gl->caps.instanced_stereo) {
+    uniforms->flags |= TERRAIN_FLAG_INSTANCED_STEREO;
+  }
+  if (game->render_state->frame.options.adaptive_meshes) {
+    uniforms->flags |= TERRAIN_FLAG_ADAPTIVE_MESHES;
+  }
+  // Pages of a streamed world have their own color map array
+  if (is_virtual_texture_enabled(game) &&
+      !game->render_state->frame.options.streamed_world) {
+    uniforms->flags |= TERRAIN_FLAG_VIRTUAL_TEXTURE;
+  }
+
+  bind_buffer_range(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING,
+                    gl->frame_ring.buffer, offset,
+                    sizeof(struct FrameUniforms));
 }
 
 static void render_real_3d(struct Game *game,
-                           struct RenderingMatrices *matrices) {
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_CULL_FACE);
+                           struct RenderingMatrices *matrices,
+                           int32_t framebuffer_height) {
+  set_capability(GL_DEPTH_TEST, true);
+  set_capability(GL_CULL_FACE, true);
 
 #ifdef GL_POLYGON_MODE
   if (game->options.show_wireframe) {
@@ -327,6 +1270,7 @@ static void render_real_3d(struct Game *game,
 #endif
 
   int32_t eye_count = matrices->enable_stereo ? 2 : 1;
+  int32_t view_count = get_view_count(game, matrices);
 
   vec4 *sky_color = &game->camera.sky_color;
   glClearColor((*sky_color)[0], (*sky_color)[1], (*sky_color)[2],
@@ -334,7 +1278,9 @@ static void render_real_3d(struct Game *game,
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   struct OpenGLData *gl = &game->gl;
-  struct Map *map = &game->maps[game->map_index];
+  // The map the draw commands were built for, which can lag behind
+  // game->map_index by a frame when frames are pipelined
+  struct Map *map = &game->maps[game->render_state->frame.map_index];
 
   mat4 birdseye_projection_view[2] = {GLM_MAT4_IDENTITY_INIT,
                                       GLM_MAT4_IDENTITY_INIT};
@@ -350,125 +1296,59 @@ static void render_real_3d(struct Game *game,
                birdseye_view_matrix);
 
     for (int32_t eye = 0; eye < eye_count; ++eye) {
-      glm_mat4_mul(matrices->projection_matrices[eye], birdseye_view_matrix,
-                   birdseye_projection_view[eye]);
-    }
-  } else {
-    render_hands(game, map, matrices);
-  }
-
-  glUseProgram(gl->terrain_shader);
-  glBindVertexArray(map->map_vao);
-
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, map->color_map_tex_id);
-
-  struct TerrainShaderUniforms *uniforms = &game->gl.terrain_shader_uniforms;
-  glUniform2i(uniforms->height_map_size, BASE_MAP_SIZE, BASE_MAP_SIZE);
-  glUniform4fv(uniforms->fog_color, 1, *sky_color);
-  glUniform1f(uniforms->terrain_scale, game->camera.terrain_scale);
-  glUniform1ui(uniforms->flags,
-               game->options.visualize_frustum || !game->options.show_fog ? 0
-                                                                          : 1);
-
-  vec3 camera_world_position;
-  glm_vec3_mul(game->camera.position, CAMERA_TO_TERRAIN, camera_world_position);
-  glm_vec3_scale(camera_world_position, game->camera.terrain_scale,
-                 camera_world_position);
-  glUniform3fv(uniforms->camera_position, 1, camera_world_position);
-
-  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gl->draw_command_vbo);
-  int32_t draw_indirect_buffer_size;
-  glGetBufferParameteriv(GL_DRAW_INDIRECT_BUFFER, GL_BUFFER_SIZE,
-                         &draw_indirect_buffer_size);
-  int32_t required_buffer_size =
-      game->render_state.num_commands *
-      (int32_t)sizeof(struct DrawElementsIndirectCommand);
-
-  if (draw_indirect_buffer_size < required_buffer_size) {
-    info("Reallocating indirect draw buffer to %d bytes\n",
-         required_buffer_size);
-    glBufferData(GL_DRAW_INDIRECT_BUFFER, required_buffer_size, NULL,
-                 GL_DYNAMIC_DRAW);
-    draw_indirect_buffer_size = required_buffer_size;
-  }
-
-  struct DrawElementsIndirectCommand *gl_commands =
-      glMapBufferRange(GL_DRAW_INDIRECT_BUFFER, 0, draw_indirect_buffer_size,
-                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
-  if (gl_commands == NULL) {
-    GLenum gl_error = glGetError();
-    error("gl_commands was NULL: %d\n", gl_error);
-    assert(gl_commands != NULL);
-  }
-
-  // Populate indirect draw commands
-  for (int32_t i_command = 0; i_command < game->render_state.num_commands;
-       ++i_command) {
-    struct DrawCommand *command = &game->render_state.commands[i_command];
-
-    struct DrawElementsIndirectCommand *gl_command = &gl_commands[i_command];
-    gl_command->count = command->mesh.num_indices;
-    gl_command->instance_count = 1;
-    gl_command->first_index = command->mesh.offset;
-    gl_command->base_vertex = 0;
-    gl_command->reserved_must_be_zero = 0;
-  }
-
-  if (glUnmapBuffer(GL_DRAW_INDIRECT_BUFFER) != GL_TRUE) {
-    error("Error unmapping buffer range");
-  }
-
-  for (int32_t i_command = 0; i_command < game->render_state.num_commands;
-       ++i_command) {
-    struct DrawCommand *command = &game->render_state.commands[i_command];
-    vec4 blend_color = {1.0, 1.0, 1.0, 1.0};
-    if (game->options.visualize_lod) {
-      switch (command->lod) {
-      case 0:
-        glm_vec4_copy((vec4){1.0, 0.0, 0.0, 1.0}, blend_color);
-        break;
-      case 1:
-        glm_vec4_copy((vec4){0.0, 1.0, 0.0, 1.0}, blend_color);
-        break;
-      case 2:
-        glm_vec4_copy((vec4){0.0, 0.0, 1.0, 1.0}, blend_color);
-        break;
-      default:
-        break;
-      }
-    }
-
-    mat4 mvp[2] = {GLM_MAT4_IDENTITY_INIT, GLM_MAT4_IDENTITY_INIT};
-    for (int32_t eye = 0; eye < eye_count; ++eye) {
-      if (game->options.visualize_frustum) {
-        glm_mat4_mul(birdseye_projection_view[eye], command->model_matrix,
-                     mvp[eye]);
-      } else {
-        glm_mat4_mul(matrices->projection_view_matrices[eye],
-                     command->model_matrix, mvp[eye]);
-      }
-    }
-
-    glUniformMatrix4fv(uniforms->projection_views[0], 1, GL_FALSE,
-                       (float *)mvp[0]);
-    if (matrices->enable_stereo) {
-      glUniformMatrix4fv(uniforms->projection_views[1], 1, GL_FALSE,
-                         (float *)mvp[1]);
+      glm_mat4_mul(matrices->projection_matrices[eye], birdseye_view_matrix,
+                   birdseye_projection_view[eye]);
     }
-    glUniformMatrix4fv(uniforms->model, 1, GL_FALSE,
-                       (float *)command->model_matrix);
+  }
 
-    glUniform4fv(uniforms->blend_color, 1, blend_color);
+  update_color_maps(game, matrices, framebuffer_height);
+  update_far_field_panorama(game);
+  update_frame_uniforms(game,
+                        game->options.visualize_frustum
+                            ? birdseye_projection_view
+                            : matrices->projection_view_matrices,
+                        eye_count);
 
-    glDrawElementsIndirect(
-        GL_TRIANGLES, GL_UNSIGNED_INT,
-        (void *)(i_command * sizeof(struct DrawElementsIndirectCommand)));
+  bool gpu_driven = is_gpu_culling_enabled(game);
+  if (is_clipmap_enabled(game)) {
+    vec3 camera_position;
+    glm_vec3_mul(game->camera.position, CAMERA_TO_TERRAIN, camera_position);
+    finish_ring_buffer_writes(&gl->frame_ring);
+    update_clipmap(&gl->clipmap, map, game->render_state->frame.map_index,
+                   camera_position);
+    draw_clipmap(&gl->clipmap, map, gl->color_map_array, view_count);
+  } else if (is_tessellation_enabled(game)) {
+    draw_tessellated_sections(game, map, matrices, framebuffer_height,
+                              view_count);
+  } else if (gpu_driven) {
+    use_program(gl->terrain_shader);
+    glVertexAttrib4f(BLEND_COLOR_ATTRIBUTE, 1.0f, 1.0f, 1.0f, 1.0f);
+    bind_vertex_array(map->map_vao);
+    bind_texture(0, GL_TEXTURE_2D_ARRAY, gl->color_map_array);
+    finish_ring_buffer_writes(&gl->frame_ring);
+    draw_gpu_culled_sections(&gl->gpu_culling, &gl->caps, view_count);
+  } else {
+    use_program(gl->terrain_shader);
+    glVertexAttrib4f(BLEND_COLOR_ATTRIBUTE, 1.0f, 1.0f, 1.0f, 1.0f);
+    bind_texture(0, GL_TEXTURE_2D_ARRAY,
+                 game->render_state->frame.options.streamed_world
+                     ? game->streaming.color_array
+                     : gl->color_map_array);
+    draw_terrain_commands(game, view_count);
   }
 
-  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  // Drawn after the terrain because the frame ring, which holds the frame
+  // uniforms, may be mapped until the terrain's draw data is written
+  if (!game->options.visualize_frustum) {
+    render_hands(game, game->render_state->frame.map_index, view_count);
+  }
 
-  glBindVertexArray(0);
+  if (is_far_field_shown(game)) {
+    vec3 camera_position;
+    glm_vec3_mul(game->camera.position, CAMERA_TO_TERRAIN, camera_position);
+    draw_far_field(&game->far_field, camera_position,
+                   game->camera.terrain_scale, view_count);
+  }
 
   if (game->options.visualize_frustum) {
     mat4 inv_projection_view;
@@ -501,29 +1381,31 @@ static void render_real_3d(struct Game *game,
       glm_vec3(frustum_verts[6], verts[4]);
     }
 
-    glBindVertexArray(game->gl.frustum_vis_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, game->gl.frustum_vis_vbo);
+    // The terrain shader scales positions from terrain units
+    for (int32_t i = 0; i < 6; ++i) {
+      glm_vec3_scale(verts[i], 1.0f / game->camera.terrain_scale, verts[i]);
+    }
+
+    bind_vertex_array(game->gl.frustum_vis_vao);
+    bind_buffer(GL_ARRAY_BUFFER, game->gl.frustum_vis_vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_DYNAMIC_DRAW);
 
-    glUseProgram(game->gl.terrain_shader);
+    use_program(game->gl.terrain_shader);
 
-    vec4 blend_color = {1.0, 1.0, 0.0, 0.5};
-    glUniform4fv(gl->terrain_shader_uniforms.blend_color, 1, blend_color);
+    // The frustum has no draw info, use constant attributes instead. A
+    // negative LOD keeps it from being colored by LOD, and a negative layer
+    // keeps the virtual texture from being sampled.
+    glVertexAttrib4f(DRAW_INFO_ATTRIBUTE, 0.0f, 0.0f, -1.0f, -1.0f);
+    glVertexAttrib4f(BLEND_COLOR_ATTRIBUTE, 1.0f, 1.0f, 0.0f, 0.5f);
 
-    glUniformMatrix4fv(gl->terrain_shader_uniforms.projection_views[0], 1,
-                       GL_FALSE, (float *)birdseye_projection_view[0]);
-    if (matrices->enable_stereo) {
-      glUniformMatrix4fv(gl->terrain_shader_uniforms.projection_views[1], 1,
-                         GL_FALSE, (float *)birdseye_projection_view[1]);
-    }
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, game->gl.white_tex_id);
+    bind_texture(0, GL_TEXTURE_2D_ARRAY, game->gl.white_tex_id);
 
-    glEnable(GL_BLEND);
+    set_capability(GL_BLEND, true);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glDisable(GL_BLEND);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, view_count);
+    count_draws(1);
+    set_capability(GL_BLEND, false);
   }
 }
 
@@ -554,15 +1436,112 @@ static void render_buffer_to_gl(struct FrameBuffer *frame,
   glDrawArrays(GL_TRIANGLES, 0, gl->vao_num_vertices);
 }
 
+/*!
+ * Makes the RenderState to draw this frame current. When frames are pipelined,
+ * it is the one the worker built from the previous frame's snapshot, and the
+ * worker starts on the next one from this frame's snapshot.
+ *
+ * @param[in]  game
+ * @param[in]  matrices Of this frame
+ * @return the matrices to draw with
+ */
+static struct RenderingMatrices *
+prepare_render_state(struct Game *game, struct RenderingMatrices *matrices) {
+  struct RenderState *built = wait_frame_pipeline(&game->pipeline);
+  // Pages are only swapped while the worker is idle, since it reads their maps
+  if (is_streamed_world(game)) {
+    vec3 camera_position;
+    glm_vec3_mul(game->camera.position, CAMERA_TO_TERRAIN, camera_position);
+    update_world_streaming(&game->streaming, camera_position);
+  }
+
+  struct FrameSnapshot snapshot;
+  if (is_clipmap_enabled(game)) {
+    // Clipmap levels follow the camera and need no draw commands
+    take_frame_snapshot(game, matrices, false, &snapshot);
+    game->render_state->frame = snapshot;
+    game->render_state->num_commands = 0;
+    game->render_state->num_cluster_ranges = 0;
+    return matrices;
+  }
+
+  if (is_gpu_culling_enabled(game)) {
+    take_frame_snapshot(game, matrices, false, &snapshot);
+    game->render_state->frame = snapshot;
+    generate_gpu_draw_commands(game, matrices);
+    return matrices;
+  }
+
+  if (!game->options.pipelined_frames || game->pipeline.thread == NULL) {
+    take_frame_snapshot(game, matrices, false, &snapshot);
+    generate_draw_commands(get_frame_maps(game, &snapshot), &snapshot,
+                           game->render_state);
+    return matrices;
+  }
+
+  // The commands are drawn a frame after the pose they were culled with. With
+  // late latching they are drawn with the newest pose instead, which needs a
+  // wider frustum to cull with.
+  bool late_latching = game->options.late_latching;
+  take_frame_snapshot(game, matrices, late_latching, &snapshot);
+  if (built != NULL) {
+    game->render_state = built;
+  } else {
+    // Nothing in flight yet, build this frame's commands right away
+    generate_draw_commands(get_frame_maps(game, &snapshot), &snapshot,
+                           game->render_state);
+  }
+
+  struct RenderState *next = game->render_state == &game->render_states[0]
+                                 ? &game->render_states[1]
+                                 : &game->render_states[0];
+  submit_frame_pipeline(&game->pipeline, &snapshot, next);
+
+  return late_latching ? matrices : &game->render_state->frame.matrices;
+}
+
+/*!
+ * Sets the viewport to the whole framebuffer. With instanced stereo, each
+ * eye's half is given its own viewport when vertex shaders can select it,
+ * otherwise the shaders clip the eyes at the middle of the framebuffer.
+ *
+ * @param[in]  game
+ * @param[in]  matrices
+ * @param[in]  view_count See get_view_count
+ */
+static void set_viewports(struct Game *game, struct InputMatrices *matrices,
+                          int32_t view_count) {
+  int32_t width = matrices->framebuffer_width;
+  int32_t height = matrices->framebuffer_height;
+  glViewport(0, 0, width, height);
+
+  bool split_viewports = view_count == 2 && game->gl.caps.viewport_layer_array;
+#ifdef GL_ARB_viewport_array
+  if (split_viewports) {
+    glViewportIndexedf(0, 0.0f, 0.0f, width / 2.0f, height);
+    glViewportIndexedf(1, width / 2.0f, 0.0f, width / 2.0f, height);
+  }
+#endif
+#ifdef GL_CLIP_DISTANCE0
+  set_capability(GL_CLIP_DISTANCE0, view_count == 2 && !split_viewports);
+#else
+  (void)split_viewports;
+#endif
+}
+
 void render_game(struct Game *game, struct InputMatrices *matrices) {
   struct RenderingMatrices rendering_matrices;
   compute_matrices(game, matrices, &rendering_matrices);
+  begin_gl_state_frame();
+  begin_ring_buffer_frame(&game->gl.frame_ring);
 
-  generate_draw_commands(game, &rendering_matrices);
+  struct RenderingMatrices *draw_matrices =
+      prepare_render_state(game, &rendering_matrices);
 
-  glViewport(0, 0, matrices->framebuffer_width, matrices->framebuffer_height);
+  set_viewports(game, matrices, get_view_count(game, draw_matrices));
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, matrices->framebuffer);
-  render_real_3d(game, &rendering_matrices);
+  render_real_3d(game, draw_matrices, matrices->framebuffer_height);
+  end_ring_buffer_frame(&game->gl.frame_ring);
 #if 0
   if (game->options.do_raycasting) {
     memset(game->frame.pixels, 0, game->frame.height * game->frame.pitch);
@@ -739,6 +1718,80 @@ void update_game(struct Game *game, struct KeyboardState *keyboard,
     game->options.visualize_lod = !game->options.visualize_lod;
   }
 
+  if (is_key_just_pressed(game, 'o')) {
+    game->options.occlusion_culling = !game->options.occlusion_culling;
+  }
+
+  if (is_key_just_pressed(game, 'n')) {
+    game->options.cluster_culling = !game->options.cluster_culling;
+  }
+
+  if (is_key_just_pressed(game, 'm')) {
+    game->options.pipelined_frames = !game->options.pipelined_frames;
+    if (game->options.pipelined_frames && game->pipeline.thread == NULL) {
+      info("Pipelined frames are not supported, building frames serially\n");
+    }
+  }
+
+  if (is_key_just_pressed(game, 'l')) {
+    game->options.late_latching = !game->options.late_latching;
+  }
+
+  if (is_key_just_pressed(game, 'p')) {
+    game->options.use_pvs = !game->options.use_pvs;
+  }
+
+  if (is_key_just_pressed(game, 't')) {
+    game->options.render_stereo = !game->options.render_stereo;
+  }
+
+  if (is_key_just_pressed(game, 'u')) {
+    game->options.adaptive_meshes = !game->options.adaptive_meshes;
+  }
+
+  if (is_key_just_pressed(game, 'y')) {
+    game->options.clipmap_terrain = !game->options.clipmap_terrain;
+    if (game->options.clipmap_terrain && !game->gl.clipmap.shader) {
+      info("Clipmap terrain is not supported, drawing map sections\n");
+    }
+  }
+
+  if (is_key_just_pressed(game, 'i')) {
+    game->options.tessellated_terrain = !game->options.tessellated_terrain;
+    if (game->options.tessellated_terrain && !game->gl.tessellation.shader) {
+      info("Tessellated terrain is not supported, drawing section LODs\n");
+    }
+  }
+
+  if (is_key_just_pressed(game, 'c')) {
+    game->options.gpu_culling = !game->options.gpu_culling;
+    if (game->options.gpu_culling && !game->gl.caps.compute_shader) {
+      info("GPU culling is not supported, using CPU culling\n");
+    }
+  }
+
+  if (is_key_just_pressed(game, '1')) {
+    game->options.mixed_world = !game->options.mixed_world;
+  }
+
+  if (is_key_just_pressed(game, '2')) {
+    game->options.streamed_world = !game->options.streamed_world;
+    if (game->options.streamed_world && !game->streaming.is_available) {
+      info("No world to stream in %s\n", WORLD_PAGES_DIRECTORY);
+    }
+  }
+
+  if (is_key_just_pressed(game, '3')) {
+    game->options.virtual_texture = !game->options.virtual_texture;
+  }
+
+  if (is_key_just_pressed(game, '4')) {
+    game->options.far_field = !game->options.far_field;
+    if (game->options.far_field && !game->far_field.is_available) {
+      info("The far field is not available\n");
+    }
+  }
+
   if (is_key_just_pressed(game, 'v')) {
     game->options.show_wireframe = !game->options.show_wireframe;
   }
@@ -788,20 +1841,25 @@ void update_game(struct Game *game, struct KeyboardState *keyboard,
     game->camera.pitch += 2 * M_PI;
   }
 
+  // Leaving the tile in a streamed world moves on to the next page
   while (game->camera.position[0] >= 1.0) {
     game->camera.position[0] -= 1.0;
+    move_world_camera_page(&game->streaming, 1, 0);
   }
 
   while (game->camera.position[2] >= 1.0) {
     game->camera.position[2] -= 1.0;
+    move_world_camera_page(&game->streaming, 0, 1);
   }
 
   while (game->camera.position[0] < 0) {
     game->camera.position[0] += 1.0;
+    move_world_camera_page(&game->streaming, -1, 0);
   }
 
   while (game->camera.position[2] < 0) {
     game->camera.position[2] += 1.0;
+    move_world_camera_page(&game->streaming, 0, -1);
   }
 
   update_camera(&game->camera);
@@ -856,9 +1914,21 @@ static int32_t generate_indices(int32_t *index_buffer, int32_t num_indices,
   return num_indices;
 }
 
+/*!
+ * Generates the indices of one cluster of a section LOD. Samples on the edges
+ * of the section are stitched to the neighboring sections.
+ *
+ * @param[in]  map_mesh_extents
+ * @param[in]  sample_divisor   Vertices skipped between samples of this LOD
+ * @param[in]  rect             Section, in vertices
+ * @param[in]  samples          Cluster, in samples of this LOD
+ * @param[out] index_buffer
+ * @param[in]  buffer_size
+ * @return the number of indices written
+ */
 static int32_t generate_lod_indices(struct MapMeshExtents *map_mesh_extents,
                                     int32_t sample_divisor, struct Rect rect,
-                                    int32_t *index_buffer,
+                                    struct Rect samples, int32_t *index_buffer,
                                     int32_t buffer_size) {
   int32_t width = map_mesh_extents->width;
   int32_t height = map_mesh_extents->height;
@@ -868,8 +1938,10 @@ static int32_t generate_lod_indices(struct MapMeshExtents *map_mesh_extents,
   int32_t sample_width = rect.width / sample_divisor;
   int32_t sample_height = rect.height / sample_divisor;
 
-  for (int32_t sample_y = 0; sample_y < sample_height; ++sample_y) {
-    for (int32_t sample_x = 0; sample_x < sample_width; ++sample_x) {
+  for (int32_t sample_y = samples.y; sample_y < samples.y + samples.height;
+       ++sample_y) {
+    for (int32_t sample_x = samples.x; sample_x < samples.x + samples.width;
+         ++sample_x) {
       int32_t x = rect.x + (sample_x * sample_divisor);
       int32_t y = rect.y + (sample_y * sample_divisor);
       if (x < 0 || y < 0 || x + sample_divisor >= width ||
@@ -996,121 +2068,812 @@ static int32_t generate_lod_indices(struct MapMeshExtents *map_mesh_extents,
             }
           }
 
-          // Top and bottom strips
-          if (sample_y == 0 || sample_y == sample_height - 1) {
-            int32_t pivot = v_index;
-            int32_t v_begin = v_index + (sample_divisor * width);
-            int32_t direction = 1;
-            if (sample_y == 0) {
-              direction = -1;
-              v_begin = v_index + sample_divisor;
-              pivot = v_index + (sample_divisor * width);
-            }
+          // Top and bottom strips
+          if (sample_y == 0 || sample_y == sample_height - 1) {
+            int32_t pivot = v_index;
+            int32_t v_begin = v_index + (sample_divisor * width);
+            int32_t direction = 1;
+            if (sample_y == 0) {
+              direction = -1;
+              v_begin = v_index + sample_divisor;
+              pivot = v_index + (sample_divisor * width);
+            }
+
+            for (int32_t i = 1; i <= sample_divisor; ++i) {
+              assert(num_indices + 3 < buffer_size);
+              index_buffer[num_indices++] = pivot;
+              index_buffer[num_indices++] = v_begin + (direction * (i - 1));
+              index_buffer[num_indices++] = v_begin + (direction * i);
+            }
+
+            if (direction == 1) {
+              assert(num_indices + 3 < buffer_size);
+              index_buffer[num_indices++] = pivot;
+              index_buffer[num_indices++] =
+                  pivot + sample_divisor + (width * sample_divisor);
+              index_buffer[num_indices++] = pivot + sample_divisor;
+            } else {
+              index_buffer[num_indices++] = pivot;
+              index_buffer[num_indices++] = pivot + sample_divisor;
+              index_buffer[num_indices++] =
+                  pivot + sample_divisor - (width * sample_divisor);
+            }
+          }
+        }
+
+      } else {
+        num_indices = generate_indices(index_buffer, num_indices, buffer_size,
+                                       v_index, sample_divisor, width);
+      }
+    }
+  }
+
+  return num_indices;
+}
+
+/*!
+ * Counts the indices generate_lod_indices writes for a cluster, without
+ * generating them.
+ */
+static int32_t count_lod_indices(struct MapMeshExtents *map_mesh_extents,
+                                 int32_t sample_divisor, struct Rect rect,
+                                 struct Rect samples) {
+  int32_t sample_width = rect.width / sample_divisor;
+  int32_t sample_height = rect.height / sample_divisor;
+  int32_t num_indices = 0;
+  for (int32_t sample_y = samples.y; sample_y < samples.y + samples.height;
+       ++sample_y) {
+    for (int32_t sample_x = samples.x; sample_x < samples.x + samples.width;
+         ++sample_x) {
+      int32_t x = rect.x + (sample_x * sample_divisor);
+      int32_t y = rect.y + (sample_y * sample_divisor);
+      if (x < 0 || y < 0 || x + sample_divisor >= map_mesh_extents->width ||
+          y + sample_divisor >= map_mesh_extents->height) {
+        continue;
+      }
+
+      bool is_side = sample_x == 0 || sample_x == sample_width - 1;
+      bool is_end = sample_y == 0 || sample_y == sample_height - 1;
+      if (sample_divisor == 1 || (!is_side && !is_end)) {
+        num_indices += 6;
+      } else if (is_side && is_end) {
+        // Corners fan out to both neighbors
+        num_indices += 6 * sample_divisor;
+      } else {
+        num_indices += 3 * (sample_divisor + 1);
+      }
+    }
+  }
+  return num_indices;
+}
+
+/*!
+ * Finds the height range of a section, and the lowest height within each of
+ * its occluder cells. Includes the row and column of vertices shared with the
+ * neighboring sections, since the section's triangles reach them.
+ *
+ * @param[out] section
+ * @param[in]  vertices
+ * @param[in]  extents
+ * @param[in]  rect
+ */
+static void compute_section_bounds(struct MapSection *section, V3 *vertices,
+                                   struct MapMeshExtents *extents,
+                                   struct Rect rect) {
+  int32_t right = rect.x + rect.width;
+  int32_t bottom = rect.y + rect.height;
+  if (right > extents->width - 1) {
+    right = extents->width - 1;
+  }
+  if (bottom > extents->height - 1) {
+    bottom = extents->height - 1;
+  }
+
+  glm_vec3_copy(vertices[rect.y * extents->width + rect.x],
+                section->bounds_min);
+  glm_vec3_copy(vertices[bottom * extents->width + right],
+                section->bounds_max);
+  section->bounds_min[1] = 255.0f;
+  section->bounds_max[1] = 0.0f;
+
+  for (int32_t cell_y = 0; cell_y < SECTION_OCCLUDER_CELLS; ++cell_y) {
+    for (int32_t cell_x = 0; cell_x < SECTION_OCCLUDER_CELLS; ++cell_x) {
+      int32_t x0 = rect.x + (cell_x * rect.width) / SECTION_OCCLUDER_CELLS;
+      int32_t x1 =
+          rect.x + ((cell_x + 1) * rect.width) / SECTION_OCCLUDER_CELLS;
+      int32_t y0 = rect.y + (cell_y * rect.height) / SECTION_OCCLUDER_CELLS;
+      int32_t y1 =
+          rect.y + ((cell_y + 1) * rect.height) / SECTION_OCCLUDER_CELLS;
+      if (x1 > right) {
+        x1 = right;
+      }
+      if (y1 > bottom) {
+        y1 = bottom;
+      }
+
+      float cell_min = 255.0f;
+      for (int32_t y = y0; y <= y1; ++y) {
+        for (int32_t x = x0; x <= x1; ++x) {
+          float height = vertices[y * extents->width + x][1];
+          cell_min = fminf(cell_min, height);
+          section->bounds_max[1] = fmaxf(section->bounds_max[1], height);
+        }
+      }
+
+      section->occluder_heights[cell_y * SECTION_OCCLUDER_CELLS + cell_x] =
+          (uint8_t)cell_min;
+      section->bounds_min[1] = fminf(section->bounds_min[1], cell_min);
+    }
+  }
+}
+
+/*!
+ * @return the number of vertices in each of a map's vertex blocks, see
+ *         SECTION_VERTEX_BLOCKS
+ */
+static int32_t get_block_vertex_count(struct MapMeshExtents *extents) {
+  int32_t section_width = extents->width / MAP_X_SEGMENTS;
+  int32_t section_height = extents->height / MAP_Y_SEGMENTS;
+  return (section_width + 1) * (section_height / SECTION_VERTEX_BLOCKS + 1);
+}
+
+/*!
+ * Finds the grid vertex a vertex block starts at. Blocks are numbered
+ * SECTION_VERTEX_BLOCKS per section, in section order.
+ */
+static void get_block_origin(struct MapMeshExtents *extents, int32_t i_block,
+                             int32_t *x, int32_t *y) {
+  int32_t section_width = extents->width / MAP_X_SEGMENTS;
+  int32_t section_height = extents->height / MAP_Y_SEGMENTS;
+  int32_t i_section = i_block / SECTION_VERTEX_BLOCKS;
+  *x = (i_section % MAP_X_SEGMENTS) * section_width;
+  *y = (i_section / MAP_Y_SEGMENTS) * section_height +
+       (i_block % SECTION_VERTEX_BLOCKS) * section_height /
+           SECTION_VERTEX_BLOCKS;
+}
+
+/*!
+ * @return the first vertex of the block holding a section cluster's vertices
+ */
+static int32_t get_cluster_base_vertex(struct MapMeshExtents *extents,
+                                       int32_t i_section, int32_t i_cluster) {
+  int32_t cluster_y = i_cluster / SECTION_CLUSTERS_PER_SIDE;
+  int32_t i_block = i_section * SECTION_VERTEX_BLOCKS +
+                    cluster_y * SECTION_VERTEX_BLOCKS /
+                        SECTION_CLUSTERS_PER_SIDE;
+  return i_block * get_block_vertex_count(extents);
+}
+
+/*!
+ * Sets the meshes of a LOD's vertex blocks to the runs of clusters in them.
+ *
+ * @param[out] block_meshes
+ * @param[in]  clusters     The LOD's SECTION_CLUSTER_COUNT clusters
+ */
+static void set_block_meshes(struct Mesh block_meshes[SECTION_VERTEX_BLOCKS],
+                             struct MeshCluster *clusters) {
+  int32_t clusters_per_block = SECTION_CLUSTER_COUNT / SECTION_VERTEX_BLOCKS;
+  for (int32_t i_block = 0; i_block < SECTION_VERTEX_BLOCKS; ++i_block) {
+    struct Mesh *first = &clusters[i_block * clusters_per_block].mesh;
+    struct Mesh *last = &clusters[(i_block + 1) * clusters_per_block - 1].mesh;
+    block_meshes[i_block] = (struct Mesh){
+        .offset = first->offset,
+        .num_indices = last->offset + last->num_indices - first->offset,
+        .base_vertex = first->base_vertex,
+    };
+  }
+}
+
+/*!
+ * Copies the grid's vertices into every vertex block. Rows where blocks meet
+ * are in both.
+ *
+ * @param[out] block_vertices
+ * @param[in]  grid_vertices  One per grid vertex, row major
+ * @param[in]  vertex_size    Bytes per vertex
+ * @param[in]  extents
+ */
+static void copy_block_vertices(void *block_vertices, void *grid_vertices,
+                                size_t vertex_size,
+                                struct MapMeshExtents *extents) {
+  int32_t row_length = extents->width / MAP_X_SEGMENTS + 1;
+  int32_t num_rows = get_block_vertex_count(extents) / row_length;
+  uint8_t *destination = block_vertices;
+  for (int32_t i_block = 0; i_block < MAP_SECTION_COUNT * SECTION_VERTEX_BLOCKS;
+       ++i_block) {
+    int32_t x, y;
+    get_block_origin(extents, i_block, &x, &y);
+    for (int32_t row = 0; row < num_rows; ++row) {
+      uint8_t *source = (uint8_t *)grid_vertices +
+                        ((y + row) * extents->width + x) * vertex_size;
+      memcpy(destination, source, row_length * vertex_size);
+      destination += row_length * vertex_size;
+    }
+  }
+}
+
+/*!
+ * Converts the indices of clusters from grid vertices to 16 bit indices of
+ * the vertices in their block.
+ *
+ * @param[out] packed_indices Same offsets as indices
+ * @param[in]  indices
+ * @param[in]  clusters
+ * @param[in]  num_clusters
+ * @param[in]  extents
+ */
+static void pack_block_indices(uint16_t *packed_indices, int32_t *indices,
+                               struct MeshCluster *clusters,
+                               int32_t num_clusters,
+                               struct MapMeshExtents *extents) {
+  int32_t block_vertex_count = get_block_vertex_count(extents);
+  int32_t row_length = extents->width / MAP_X_SEGMENTS + 1;
+  for (int32_t i_cluster = 0; i_cluster < num_clusters; ++i_cluster) {
+    struct Mesh *mesh = &clusters[i_cluster].mesh;
+    int32_t block_x, block_y;
+    get_block_origin(extents, mesh->base_vertex / block_vertex_count,
+                     &block_x, &block_y);
+    for (int32_t i = mesh->offset; i < mesh->offset + mesh->num_indices; ++i) {
+      int32_t x = indices[i] % extents->width - block_x;
+      int32_t y = indices[i] / extents->width - block_y;
+      int32_t block_index = y * row_length + x;
+      assert(x >= 0 && x < row_length);
+      assert(block_index >= 0 && block_index < block_vertex_count);
+      packed_indices[i] = (uint16_t)block_index;
+    }
+  }
+}
+
+/*!
+ * Finds the bounding sphere and normal cone of a cluster's triangles.
+ *
+ * @param[out] cluster
+ * @param[in]  vertices
+ * @param[in]  indices
+ * @param[in]  num_indices
+ */
+static void compute_cluster_bounds(struct MeshCluster *cluster, V3 *vertices,
+                                   int32_t *indices, int32_t num_indices) {
+  glm_vec3_zero(cluster->center);
+  cluster->radius = 0.0f;
+  glm_vec3_copy((vec3){0.0f, 1.0f, 0.0f}, cluster->cone_axis);
+  // Never back facing until proven otherwise
+  cluster->cone_cutoff = 1.0f;
+  if (num_indices == 0) {
+    return;
+  }
+
+  vec3 bounds_min, bounds_max;
+  glm_vec3_copy(vertices[indices[0]], bounds_min);
+  glm_vec3_copy(vertices[indices[0]], bounds_max);
+  vec3 normal_sum = {0.0f, 0.0f, 0.0f};
+  for (int32_t i = 0; i < num_indices; i += 3) {
+    float *a = vertices[indices[i]];
+    float *b = vertices[indices[i + 1]];
+    float *c = vertices[indices[i + 2]];
+    for (int32_t j = 0; j < 3; ++j) {
+      glm_vec3_minv(bounds_min, vertices[indices[i + j]], bounds_min);
+      glm_vec3_maxv(bounds_max, vertices[indices[i + j]], bounds_max);
+    }
+
+    vec3 ab, ac, normal;
+    glm_vec3_sub(b, a, ab);
+    glm_vec3_sub(c, a, ac);
+    glm_vec3_cross(ab, ac, normal);
+    glm_vec3_normalize(normal);
+    glm_vec3_add(normal_sum, normal, normal_sum);
+  }
+
+  glm_vec3_center(bounds_min, bounds_max, cluster->center);
+  cluster->radius = glm_vec3_distance(bounds_min, bounds_max) / 2.0f;
+
+  if (glm_vec3_norm(normal_sum) == 0.0f) {
+    return;
+  }
+  glm_vec3_normalize_to(normal_sum, cluster->cone_axis);
+
+  float min_dot = 1.0f;
+  for (int32_t i = 0; i < num_indices; i += 3) {
+    vec3 ab, ac, normal;
+    glm_vec3_sub(vertices[indices[i + 1]], vertices[indices[i]], ab);
+    glm_vec3_sub(vertices[indices[i + 2]], vertices[indices[i]], ac);
+    glm_vec3_cross(ab, ac, normal);
+    glm_vec3_normalize(normal);
+    min_dot = fminf(min_dot, glm_vec3_dot(normal, cluster->cone_axis));
+  }
+
+  // A cone wider than a hemisphere always has a triangle facing the camera
+  if (min_dot > 0.0f) {
+    cluster->cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+  }
+}
+
+/*!
+ * Finds where each vertex goes when it morphs into the next LOD. A vertex is
+ * dropped by the first LOD whose sample grid it is not on, and morphs to the
+ * height of that LOD's triangle edge through it beforehand. Vertices that no
+ * LOD drops don't morph.
+ *
+ * @param[out] morph_targets The height to morph to, and the LOD the vertex is
+ *                           last used by
+ * @param[in]  vertices
+ * @param[in]  extents
+ */
+static void create_morph_targets(vec2 *morph_targets, V3 *vertices,
+                                 struct MapMeshExtents *extents) {
+  for (int32_t y = 0; y < extents->height; ++y) {
+    for (int32_t x = 0; x < extents->width; ++x) {
+      int32_t v_index = y * extents->width + x;
+      morph_targets[v_index][0] = vertices[v_index][1];
+      morph_targets[v_index][1] = LOD_COUNT - 1;
+
+      int32_t step = 1;
+      for (int32_t lod = 0; lod < LOD_COUNT - 1; ++lod, step *= 2) {
+        bool odd_x = x % (step * 2) != 0;
+        bool odd_y = y % (step * 2) != 0;
+        if (!odd_x && !odd_y) {
+          continue;
+        }
+
+        // The ends of the coarser LOD's edge through the vertex. Quads are
+        // split from their bottom left to their top right corner, see
+        // generate_indices.
+        int32_t x0 = x, y0 = y, x1 = x, y1 = y;
+        if (odd_x) {
+          x0 -= step;
+          x1 += step;
+        }
+        if (odd_y) {
+          y0 += step;
+          y1 -= step;
+        }
+        morph_targets[v_index][0] =
+            (vertices[y0 * extents->width + x0][1] +
+             vertices[y1 * extents->width + x1][1]) /
+            2.0f;
+        morph_targets[v_index][1] = lod;
+        break;
+      }
+    }
+  }
+}
+
+/*!
+ * Generates the adaptive meshes of every section LOD after the regular ones.
+ * Flat areas are covered by a few large triangles, and no LOD is finer than
+ * the regular grid of the same LOD. Triangles along section edges are fanned
+ * out to the edge vertices of LOD 0, like the regular grid is stitched to the
+ * full resolution edges, so that neighbors of any LOD meet. Maps that are not
+ * 2^n texels wide use their regular meshes instead.
+ *
+ * @param[in]  map
+ * @param[in]  vertices
+ * @param[in]  extents
+ * @param[out] index_buffer
+ * @param[in]  buffer_size
+ * @param[in]  num_indices  Indices already in index_buffer
+ * @param[in]  log_stats    Whether to log the triangle counts
+ * @return the number of indices in index_buffer
+ */
+static int32_t create_adaptive_meshes(struct Map *map, V3 *vertices,
+                                      struct MapMeshExtents *extents,
+                                      int32_t *index_buffer,
+                                      int32_t buffer_size,
+                                      int32_t num_indices, bool log_stats) {
+  int32_t size = extents->width;
+  int32_t section_size = size / MAP_X_SEGMENTS;
+  if (extents->height != size || !is_rtin_grid_size(size)) {
+    for (int32_t i_section = 0; i_section < MAP_SECTION_COUNT; ++i_section) {
+      struct MapSection *section = &map->sections[i_section];
+      memcpy(section->adaptive_lods, section->lods, sizeof(section->lods));
+      section->adaptive_clusters = section->clusters;
+    }
+    return num_indices;
+  }
+
+  float *errors = malloc(sizeof(float) * size * size);
+  compute_rtin_errors(errors, vertices, size,
+                      section_size / SECTION_VERTEX_BLOCKS);
+
+  int32_t num_triangles[LOD_COUNT] = {0};
+  int32_t num_grid_triangles[LOD_COUNT] = {0};
+  for (int32_t i_section = 0; i_section < MAP_SECTION_COUNT; ++i_section) {
+    struct MapSection *section = &map->sections[i_section];
+    int32_t section_x = (i_section % MAP_X_SEGMENTS) * section_size;
+    int32_t section_y = (i_section / MAP_Y_SEGMENTS) * section_size;
+    section->adaptive_clusters =
+        &map->clusters[(MAP_SECTION_COUNT + i_section) * LOD_COUNT *
+                       SECTION_CLUSTER_COUNT];
+
+    for (int32_t i_lod = 0; i_lod < LOD_COUNT; ++i_lod) {
+      int32_t lod_offset = num_indices;
+      for (int32_t i_cluster = 0; i_cluster < SECTION_CLUSTER_COUNT;
+           ++i_cluster) {
+        int32_t cluster_x = i_cluster % SECTION_CLUSTERS_PER_SIDE;
+        int32_t cluster_y = i_cluster / SECTION_CLUSTERS_PER_SIDE;
+        int32_t x0 = section_x +
+                     cluster_x * section_size / SECTION_CLUSTERS_PER_SIDE;
+        int32_t x1 = section_x + (cluster_x + 1) * section_size /
+                                     SECTION_CLUSTERS_PER_SIDE;
+        int32_t y0 = section_y +
+                     cluster_y * section_size / SECTION_CLUSTERS_PER_SIDE;
+        int32_t y1 = section_y + (cluster_y + 1) * section_size /
+                                     SECTION_CLUSTERS_PER_SIDE;
+
+        struct MeshCluster *cluster =
+            &section->adaptive_clusters[i_lod * SECTION_CLUSTER_COUNT +
+                                        i_cluster];
+        // No finer than the regular grid of the same LOD, and stitched to
+        // the edges of LOD 0, which every LOD of the neighbors shares
+        int32_t num_cluster_indices = generate_rtin_indices(
+            errors, size, ADAPTIVE_LOD_ERRORS[i_lod], 1 << i_lod,
+            section_size, ADAPTIVE_LOD_ERRORS[0], x0, y0, x1, y1,
+            &index_buffer[num_indices], buffer_size - num_indices);
+        cluster->mesh.offset = num_indices;
+        cluster->mesh.num_indices = num_cluster_indices;
+        cluster->mesh.base_vertex =
+            get_cluster_base_vertex(extents, i_section, i_cluster);
+        compute_cluster_bounds(cluster, vertices, &index_buffer[num_indices],
+                               num_cluster_indices);
+        num_indices += num_cluster_indices;
+      }
+      set_block_meshes(
+          section->adaptive_lods[i_lod],
+          &section->adaptive_clusters[i_lod * SECTION_CLUSTER_COUNT]);
+      num_triangles[i_lod] += (num_indices - lod_offset) / 3;
+      for (int32_t i_block = 0; i_block < SECTION_VERTEX_BLOCKS; ++i_block) {
+        num_grid_triangles[i_lod] +=
+            section->lods[i_lod][i_block].num_indices / 3;
+      }
+    }
+  }
+  free(errors);
+
+  if (log_stats) {
+    info("Adaptive meshes: LOD 0 %d triangles (%d%% of grid), LOD 1 %d "
+         "(%d%%), LOD 2 %d (%d%%)\n",
+         num_triangles[0], 100 * num_triangles[0] / num_grid_triangles[0],
+         num_triangles[1], 100 * num_triangles[1] / num_grid_triangles[1],
+         num_triangles[2], 100 * num_triangles[2] / num_grid_triangles[2]);
+  }
+  return num_indices;
+}
+
+/*!
+ * Reorders the triangles of every section cluster for the post-transform
+ * vertex cache. Clusters keep their index ranges, only the order within them
+ * changes, so their bounds and the LOD meshes holding them stay valid.
+ *
+ * @param[in]     map
+ * @param[in,out] index_buffer
+ * @param[in]     num_vertices
+ * @param[in]     include_regular Whether the regular meshes are in index_buffer
+ *                                too, or only the adaptive ones
+ * @param[in]     log_stats       Whether to simulate the cache before and after
+ *                                to log the average cache miss ratio
+ */
+static void optimize_cluster_index_order(struct Map *map, int32_t *index_buffer,
+                                         int32_t num_vertices,
+                                         bool include_regular, bool log_stats) {
+  int32_t *vertex_slots = malloc(sizeof(int32_t) * num_vertices);
+  for (int32_t i = 0; i < num_vertices; ++i) {
+    vertex_slots[i] = -1;
+  }
+
+  int64_t misses_before = 0, misses_after = 0, num_triangles = 0;
+  for (int32_t i_section = 0; i_section < MAP_SECTION_COUNT; ++i_section) {
+    struct MapSection *section = &map->sections[i_section];
+    int32_t num_cluster_sets =
+        section->adaptive_clusters != section->clusters ? 2 : 1;
+    for (int32_t i_set = include_regular ? 0 : 1; i_set < num_cluster_sets;
+         ++i_set) {
+      struct MeshCluster *clusters =
+          i_set == 0 ? section->clusters : section->adaptive_clusters;
+      for (int32_t i = 0; i < LOD_COUNT * SECTION_CLUSTER_COUNT; ++i) {
+        struct Mesh *mesh = &clusters[i].mesh;
+        int32_t *indices = &index_buffer[mesh->offset];
+        if (log_stats) {
+          misses_before += count_vertex_cache_misses(
+              indices, mesh->num_indices, vertex_slots);
+        }
+        optimize_vertex_cache(indices, mesh->num_indices, vertex_slots);
+        if (log_stats) {
+          misses_after += count_vertex_cache_misses(
+              indices, mesh->num_indices, vertex_slots);
+          num_triangles += mesh->num_indices / 3;
+        }
+      }
+    }
+  }
+  free(vertex_slots);
+
+  if (num_triangles > 0) {
+    info("Vertex cache: ACMR %.3f before reordering, %.3f after\n",
+         (double)misses_before / num_triangles,
+         (double)misses_after / num_triangles);
+  }
+}
 
-            for (int32_t i = 1; i <= sample_divisor; ++i) {
-              assert(num_indices + 3 < buffer_size);
-              index_buffer[num_indices++] = pivot;
-              index_buffer[num_indices++] = v_begin + (direction * (i - 1));
-              index_buffer[num_indices++] = v_begin + (direction * i);
-            }
+/*!
+ * Sets the index ranges of every section's regular LOD clusters, section by
+ * section and LOD by LOD like Map's clusters, and the meshes of their LODs.
+ *
+ * @param[in]  map
+ * @param[in]  vertices
+ * @param[in]  extents
+ * @param[out] index_buffer
+ * @param[in]  buffer_size
+ * @param[in]  count_only   Leave the indices and cluster bounds to the GPU,
+ *                          see generate_map_mesh
+ * @return the number of indices of the regular meshes
+ */
+static int32_t create_regular_meshes(struct Map *map, V3 *vertices,
+                                     struct MapMeshExtents *extents,
+                                     int32_t *index_buffer,
+                                     int32_t buffer_size, bool count_only) {
+  int32_t section_width = extents->width / MAP_X_SEGMENTS;
+  int32_t section_height = extents->height / MAP_Y_SEGMENTS;
+  int32_t num_indices = 0;
+  for (int32_t i_section = 0; i_section < MAP_SECTION_COUNT; ++i_section) {
+    struct Rect rect = {.x = (i_section % MAP_X_SEGMENTS) * section_width,
+                        .y = (i_section / MAP_Y_SEGMENTS) * section_height,
+                        .width = section_width,
+                        .height = section_height};
+    struct MapSection *section = &map->sections[i_section];
 
-            if (direction == 1) {
-              assert(num_indices + 3 < buffer_size);
-              index_buffer[num_indices++] = pivot;
-              index_buffer[num_indices++] =
-                  pivot + sample_divisor + (width * sample_divisor);
-              index_buffer[num_indices++] = pivot + sample_divisor;
-            } else {
-              index_buffer[num_indices++] = pivot;
-              index_buffer[num_indices++] = pivot + sample_divisor;
-              index_buffer[num_indices++] =
-                  pivot + sample_divisor - (width * sample_divisor);
-            }
-          }
+    int32_t divisor = 1;
+    for (int32_t i_lod = 0; i_lod < LOD_COUNT; ++i_lod) {
+      int32_t sample_width = rect.width / divisor;
+      int32_t sample_height = rect.height / divisor;
+      for (int32_t i_cluster = 0; i_cluster < SECTION_CLUSTER_COUNT;
+           ++i_cluster) {
+        int32_t cluster_x = i_cluster % SECTION_CLUSTERS_PER_SIDE;
+        int32_t cluster_y = i_cluster / SECTION_CLUSTERS_PER_SIDE;
+        int32_t x0 = cluster_x * sample_width / SECTION_CLUSTERS_PER_SIDE;
+        int32_t x1 = (cluster_x + 1) * sample_width / SECTION_CLUSTERS_PER_SIDE;
+        int32_t y0 = cluster_y * sample_height / SECTION_CLUSTERS_PER_SIDE;
+        int32_t y1 =
+            (cluster_y + 1) * sample_height / SECTION_CLUSTERS_PER_SIDE;
+        struct Rect samples = {
+            .x = x0, .y = y0, .width = x1 - x0, .height = y1 - y0};
+
+        struct MeshCluster *cluster =
+            &section->clusters[i_lod * SECTION_CLUSTER_COUNT + i_cluster];
+        int32_t num_cluster_indices;
+        if (count_only) {
+          num_cluster_indices =
+              count_lod_indices(extents, divisor, rect, samples);
+        } else {
+          num_cluster_indices = generate_lod_indices(
+              extents, divisor, rect, samples, &index_buffer[num_indices],
+              buffer_size - num_indices);
+          compute_cluster_bounds(cluster, vertices,
+                                 &index_buffer[num_indices],
+                                 num_cluster_indices);
         }
-
-      } else {
-        num_indices = generate_indices(index_buffer, num_indices, buffer_size,
-                                       v_index, sample_divisor, width);
+        cluster->mesh.offset = num_indices;
+        cluster->mesh.num_indices = num_cluster_indices;
+        cluster->mesh.base_vertex =
+            get_cluster_base_vertex(extents, i_section, i_cluster);
+        num_indices += num_cluster_indices;
       }
+      set_block_meshes(section->lods[i_lod],
+                       &section->clusters[i_lod * SECTION_CLUSTER_COUNT]);
+      divisor *= 2;
     }
   }
-
   return num_indices;
 }
 
-static void create_map_gl_data(struct Map *map) {
-  glGenTextures(1, &map->color_map_tex_id);
-  glBindTexture(GL_TEXTURE_2D, map->color_map_tex_id);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                  GL_NEAREST_MIPMAP_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+/*!
+ * Fills the vertex blocks and their morph targets from the grid's vertices.
+ *
+ * @param[out] block_vertices
+ * @param[out] block_morph_targets
+ * @param[in]  vertices
+ * @param[in]  extents
+ */
+static void create_block_vertices(V3 *block_vertices,
+                                  vec2 *block_morph_targets, V3 *vertices,
+                                  struct MapMeshExtents *extents) {
+  copy_block_vertices(block_vertices, vertices, sizeof(V3), extents);
+  vec2 *morph_targets = malloc(sizeof(vec2) * extents->width * extents->height);
+  create_morph_targets(morph_targets, vertices, extents);
+  copy_block_vertices(block_morph_targets, morph_targets, sizeof(vec2),
+                      extents);
+  free(morph_targets);
+}
 
-#ifdef VR_VOX_USE_ASTC
+static void upload_block_vertices(struct Map *map, V3 *vertices,
+                                  struct MapMeshExtents *extents,
+                                  int32_t num_block_vertices) {
+  V3 *block_vertices = malloc(sizeof(V3) * num_block_vertices);
+  vec2 *block_morph_targets = malloc(sizeof(vec2) * num_block_vertices);
+  create_block_vertices(block_vertices, block_morph_targets, vertices,
+                        extents);
+  glBindBuffer(GL_ARRAY_BUFFER, map->map_vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, num_block_vertices * sizeof(V3),
+                  block_vertices);
+  glBindBuffer(GL_ARRAY_BUFFER, map->map_vbo_morph_targets);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, num_block_vertices * sizeof(vec2),
+                  block_morph_targets);
+  free(block_vertices);
+  free(block_morph_targets);
+}
 
-  for (uint32_t mip = 0; mip < map->num_mip_levels; ++mip) {
-    struct AstcImageBuffer *color_map = &map->color_map[mip];
-    glCompressedTexImage2D(GL_TEXTURE_2D, mip, GL_COMPRESSED_RGBA_ASTC_6x6_KHR,
-                           color_map->width, color_map->height, 0,
-                           color_map->image_data_size, color_map->image_data);
+#ifdef VR_VOX_VALIDATE_MESH_GENERATION
+static bool is_nearly_equal(float a, float b) {
+  return fabsf(a - b) <= 1e-3f * fmaxf(1.0f, fabsf(b));
+}
+
+static void *map_buffer_for_reading(GLuint buffer, size_t size) {
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  void *mapped =
+      glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, GL_MAP_READ_BIT);
+  if (mapped == NULL) {
+    error("Could not map buffer for validation: %d\n", glGetError());
   }
+  return mapped;
+}
 
-#else
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, map->color_map.width,
-               map->color_map.height, 0, GL_RGB, GL_UNSIGNED_BYTE,
-               map->color_map.pixels);
-  glGenerateMipmap(GL_TEXTURE_2D);
+/*!
+ * Generates a map's vertices and regular meshes on the CPU as well, and
+ * reports how much of what the GPU generated differs. Vertices and indices
+ * have to match exactly, cluster bounds up to rounding. The CPU's cluster
+ * bounds are kept.
+ *
+ * @param[in]  map
+ * @param[in]  vertices
+ * @param[in]  extents
+ * @param[out] index_buffer        Scratch space for the CPU's indices
+ * @param[in]  buffer_size
+ * @param[in]  num_regular_indices
+ * @param[in]  num_block_vertices
+ */
+static void validate_generated_mesh(struct Map *map, V3 *vertices,
+                                    struct MapMeshExtents *extents,
+                                    int32_t *index_buffer,
+                                    int32_t buffer_size,
+                                    int32_t num_regular_indices,
+                                    int32_t num_block_vertices) {
+  int32_t num_clusters = MAP_SECTION_COUNT * LOD_COUNT * SECTION_CLUSTER_COUNT;
+  struct MeshCluster *gpu_clusters =
+      malloc(sizeof(struct MeshCluster) * num_clusters);
+  memcpy(gpu_clusters, map->clusters,
+         sizeof(struct MeshCluster) * num_clusters);
+  create_regular_meshes(map, vertices, extents, index_buffer, buffer_size,
+                        false);
+  uint16_t *packed_indices = malloc(sizeof(uint16_t) * num_regular_indices);
+  pack_block_indices(packed_indices, index_buffer, map->clusters,
+                     num_clusters, extents);
+  V3 *block_vertices = malloc(sizeof(V3) * num_block_vertices);
+  vec2 *block_morph_targets = malloc(sizeof(vec2) * num_block_vertices);
+  create_block_vertices(block_vertices, block_morph_targets, vertices,
+                        extents);
+
+  int32_t vertex_mismatches = 0, morph_target_mismatches = 0;
+  int32_t index_mismatches = 0, cluster_mismatches = 0;
+  V3 *gpu_vertices =
+      map_buffer_for_reading(map->map_vbo, num_block_vertices * sizeof(V3));
+  if (gpu_vertices != NULL) {
+    for (int32_t i = 0; i < num_block_vertices; ++i) {
+      vertex_mismatches +=
+          memcmp(gpu_vertices[i], block_vertices[i], sizeof(V3)) != 0;
+    }
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+  }
+  vec2 *gpu_morph_targets = map_buffer_for_reading(
+      map->map_vbo_morph_targets, num_block_vertices * sizeof(vec2));
+  if (gpu_morph_targets != NULL) {
+    for (int32_t i = 0; i < num_block_vertices; ++i) {
+      morph_target_mismatches += memcmp(gpu_morph_targets[i],
+                                        block_morph_targets[i],
+                                        sizeof(vec2)) != 0;
+    }
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+  }
+  uint16_t *gpu_indices = map_buffer_for_reading(
+      map->map_vbo_indices, num_regular_indices * sizeof(uint16_t));
+  if (gpu_indices != NULL) {
+    for (int32_t i = 0; i < num_regular_indices; ++i) {
+      index_mismatches += gpu_indices[i] != packed_indices[i];
+    }
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+  for (int32_t i = 0; i < num_clusters; ++i) {
+    struct MeshCluster *cpu = &map->clusters[i];
+    struct MeshCluster *gpu = &gpu_clusters[i];
+    bool is_equal = cpu->mesh.offset == gpu->mesh.offset &&
+                    cpu->mesh.num_indices == gpu->mesh.num_indices &&
+                    is_nearly_equal(gpu->radius, cpu->radius) &&
+                    is_nearly_equal(gpu->cone_cutoff, cpu->cone_cutoff);
+    for (int32_t j = 0; j < 3; ++j) {
+      is_equal = is_equal && is_nearly_equal(gpu->center[j], cpu->center[j]) &&
+                 is_nearly_equal(gpu->cone_axis[j], cpu->cone_axis[j]);
+    }
+    cluster_mismatches += !is_equal;
+  }
+
+  if (vertex_mismatches + morph_target_mismatches + index_mismatches +
+          cluster_mismatches ==
+      0) {
+    info("GPU mesh generation matches the CPU: %d vertices, %d indices, %d "
+         "clusters\n",
+         num_block_vertices, num_regular_indices, num_clusters);
+  } else {
+    error("GPU mesh generation differs from the CPU: %d of %d vertices, %d "
+          "morph targets, %d of %d indices and %d of %d clusters\n",
+          vertex_mismatches, num_block_vertices, morph_target_mismatches,
+          index_mismatches, num_regular_indices, cluster_mismatches,
+          num_clusters);
+  }
+
+  free(gpu_clusters);
+  free(packed_indices);
+  free(block_vertices);
+  free(block_morph_targets);
+}
 #endif
 
+/*!
+ * Creates the vertex grid of a map and lays out its sections over it.
+ *
+ * @param[in]  map
+ * @param[in]  grid_heights Height of every grid vertex, row major, or NULL to
+ *                          wrap the last row and column around to the first
+ * @param[out] extents      Of the grid
+ * @return the grid's vertices, to be freed by the caller
+ */
+static V3 *create_map_grid(struct Map *map, const uint8_t *grid_heights,
+                           struct MapMeshExtents *extents) {
   // NOTE generate vertices for 1 past the width and height, so that maps
   // can be seamlessly tiled together
-  struct MapMeshExtents extents = {
-      .width = map->height_map.width + 1,
-      .height = map->height_map.height + 1,
-  };
+  extents->width = map->height_map.width + 1;
+  extents->height = map->height_map.height + 1;
 
-  int32_t num_map_vertices = (extents.width * extents.height);
+  int32_t num_map_vertices = (extents->width * extents->height);
   V3 *map_vertices = malloc(sizeof(V3) * num_map_vertices);
 
-  int32_t indices_per_vert = 6;
-
   float modifier = map->modifier;
 
-  int32_t index_buffer_length = num_map_vertices * indices_per_vert * LOD_COUNT;
-  int32_t *index_buffer = malloc(sizeof(int32_t) * index_buffer_length);
+  map->clusters = malloc(sizeof(struct MeshCluster) * MAP_SECTION_COUNT * 2 *
+                         LOD_COUNT * SECTION_CLUSTER_COUNT);
 
-  for (int32_t y = 0; y < extents.height; ++y) {
-    for (int32_t x = 0; x < extents.width; ++x) {
-      int32_t v_index = ((y * extents.width) + x);
+  for (int32_t y = 0; y < extents->height; ++y) {
+    for (int32_t x = 0; x < extents->width; ++x) {
+      int32_t v_index = ((y * extents->width) + x);
 
       assert(v_index >= 0);
       assert(v_index < num_map_vertices);
 
       map_vertices[v_index][0] = x * modifier;
+      map_vertices[v_index][2] = y * modifier;
+      if (grid_heights != NULL) {
+        map_vertices[v_index][1] = (float)grid_heights[v_index];
+        continue;
+      }
 
       // NOTE When sampling 1 past the width or height, wrap around to get
       // the depth value. So that edges of the maps match up nice when
       // tiling.
       int32_t height_sample_x = x;
-      if (height_sample_x == extents.width - 1) {
+      if (height_sample_x == extents->width - 1) {
         height_sample_x = 0;
       }
       int32_t height_sample_y = y;
-      if (height_sample_y == extents.height - 1) {
+      if (height_sample_y == extents->height - 1) {
         height_sample_y = 0;
       }
 
       map_vertices[v_index][1] = (float)get_image_grey(
           &map->height_map, height_sample_x, height_sample_y);
-      map_vertices[v_index][2] = y * modifier;
     }
   }
 
-  int32_t num_indices = 0;
-  int32_t section_width = extents.width / MAP_X_SEGMENTS;
-  int32_t section_height = extents.height / MAP_Y_SEGMENTS;
+  int32_t section_width = extents->width / MAP_X_SEGMENTS;
+  int32_t section_height = extents->height / MAP_Y_SEGMENTS;
   float half_section_width = section_width / 2.0f;
   float half_section_height = section_height / 2.0f;
   vec3 section_corner = {half_section_width * modifier, 128.0f,
@@ -1127,43 +2890,315 @@ static void create_map_gl_data(struct Map *map) {
     section->center[2] = (rect.y + half_section_height) * modifier;
 
     section->bounding_sphere_radius = bounding_sphere_radius;
+    compute_section_bounds(section, map_vertices, extents, rect);
+    section->clusters =
+        &map->clusters[i_section * LOD_COUNT * SECTION_CLUSTER_COUNT];
+  }
 
-    int32_t divisor = 1;
-    for (int32_t i_lod = 0; i_lod < LOD_COUNT; ++i_lod) {
-      section->lods[i_lod].offset = num_indices;
-      int32_t num_lod_indices = generate_lod_indices(
-          &extents, divisor, rect, &index_buffer[num_indices],
-          index_buffer_length - num_indices);
-      section->lods[i_lod].num_indices = num_lod_indices;
-      num_indices += num_lod_indices;
-      divisor *= 2;
+  return map_vertices;
+}
+
+/*!
+ * @return the number of indices to allocate for the index buffer passed to
+ *         create_map_meshes
+ */
+static int32_t get_index_buffer_length(struct MapMeshExtents *extents) {
+  int32_t indices_per_vert = 6;
+  // Room for the regular and the adaptive meshes of every LOD, which have at
+  // most as many triangles as the full grid
+  return extents->width * extents->height * indices_per_vert * LOD_COUNT * 2;
+}
+
+/*!
+ * Creates the regular and adaptive meshes of every section and packs their
+ * indices into 16 bit vertex blocks, without touching GL so that it can run on
+ * any thread.
+ *
+ * @param[in]  map
+ * @param[in]  vertices            Returned by create_map_grid
+ * @param[in]  extents
+ * @param[out] index_buffer        Of get_index_buffer_length indices
+ * @param[in]  index_buffer_length
+ * @param[in]  generate_on_gpu     Only count the regular meshes' indices and
+ *                                 leave them and the block vertices to
+ *                                 generate_map_mesh
+ * @param[in]  log_stats           Whether to log the meshes' statistics, which
+ *                                 streamed pages skip
+ * @param[out] mesh
+ * @return the number of indices of the regular meshes
+ */
+static int32_t create_map_meshes(struct Map *map, V3 *vertices,
+                                 struct MapMeshExtents *extents,
+                                 int32_t *index_buffer,
+                                 int32_t index_buffer_length,
+                                 bool generate_on_gpu, bool log_stats,
+                                 struct MapMeshData *mesh) {
+  int32_t num_indices =
+      create_regular_meshes(map, vertices, extents, index_buffer,
+                            index_buffer_length, generate_on_gpu);
+  int32_t num_regular_indices = num_indices;
+  num_indices =
+      create_adaptive_meshes(map, vertices, extents, index_buffer,
+                             index_buffer_length, num_indices, log_stats);
+  optimize_cluster_index_order(map, index_buffer,
+                               extents->width * extents->height,
+                               !generate_on_gpu, log_stats);
+
+  // Every section's vertices are split into blocks small enough for 16 bit
+  // indices, each cluster indexes its block from the block's base vertex
+  mesh->num_block_vertices = MAP_SECTION_COUNT * SECTION_VERTEX_BLOCKS *
+                             get_block_vertex_count(extents);
+  assert(extents->height / MAP_Y_SEGMENTS % SECTION_VERTEX_BLOCKS == 0);
+  assert(get_block_vertex_count(extents) <= UINT16_MAX + 1);
+  // Rounded up to whole 32 bit words, which the GPU writes indices in. Indices
+  // left to the GPU stay zero.
+  mesh->num_indices = num_indices;
+  mesh->num_packed_indices = (num_indices + 1) / 2 * 2;
+  mesh->packed_indices = calloc(mesh->num_packed_indices, sizeof(uint16_t));
+  for (int32_t i_section = 0; i_section < MAP_SECTION_COUNT; ++i_section) {
+    struct MapSection *section = &map->sections[i_section];
+    if (!generate_on_gpu) {
+      pack_block_indices(mesh->packed_indices, index_buffer, section->clusters,
+                         LOD_COUNT * SECTION_CLUSTER_COUNT, extents);
+    }
+    if (section->adaptive_clusters != section->clusters) {
+      pack_block_indices(mesh->packed_indices, index_buffer,
+                         section->adaptive_clusters,
+                         LOD_COUNT * SECTION_CLUSTER_COUNT, extents);
     }
   }
 
-  glGenVertexArrays(1, &map->map_vao);
-  glBindVertexArray(map->map_vao);
+  mesh->block_vertices = NULL;
+  mesh->block_morph_targets = NULL;
+  if (!generate_on_gpu) {
+    mesh->block_vertices = malloc(sizeof(V3) * mesh->num_block_vertices);
+    mesh->block_morph_targets =
+        malloc(sizeof(vec2) * mesh->num_block_vertices);
+    create_block_vertices(mesh->block_vertices, mesh->block_morph_targets,
+                          vertices, extents);
+  }
+  return num_regular_indices;
+}
+
+static void free_map_mesh_data(struct MapMeshData *mesh) {
+  free(mesh->packed_indices);
+  free(mesh->block_vertices);
+  free(mesh->block_morph_targets);
+  mesh->packed_indices = NULL;
+  mesh->block_vertices = NULL;
+  mesh->block_morph_targets = NULL;
+}
 
-  glGenBuffers(1, &map->map_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, map->map_vbo);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
-  glBufferData(GL_ARRAY_BUFFER, num_map_vertices * sizeof(V3), map_vertices,
-               GL_STATIC_DRAW);
-  free(map_vertices);
+/*!
+ * Uploads a map's meshes, creating its vertex array and buffers the first
+ * time. Buffers are sized for the vertices and indices even when the mesh
+ * leaves them to the GPU. Binds through gl_state.c, since the pages of a
+ * streamed world are uploaded during frames.
+ *
+ * @param[in]  map
+ * @param[in]  mesh Returned by create_map_meshes
+ */
+static void upload_map_mesh(struct Map *map, struct MapMeshData *mesh) {
+  if (map->map_vao == 0) {
+    glGenVertexArrays(1, &map->map_vao);
+    bind_vertex_array(map->map_vao);
+
+    glGenBuffers(1, &map->map_vbo);
+    bind_buffer(GL_ARRAY_BUFFER, map->map_vbo);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float),
+                          (void *)0);
+    glEnableVertexAttribArray(0);
+
+    glGenBuffers(1, &map->map_vbo_morph_targets);
+    bind_buffer(GL_ARRAY_BUFFER, map->map_vbo_morph_targets);
+    glVertexAttribPointer(MORPH_TARGET_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(vec2), (void *)0);
+    glEnableVertexAttribArray(MORPH_TARGET_ATTRIBUTE);
+
+    glGenBuffers(1, &map->map_vbo_indices);
+    bind_buffer(GL_ELEMENT_ARRAY_BUFFER, map->map_vbo_indices);
+  } else {
+    bind_vertex_array(map->map_vao);
+  }
+
+  bind_buffer(GL_ARRAY_BUFFER, map->map_vbo);
+  glBufferData(GL_ARRAY_BUFFER, mesh->num_block_vertices * sizeof(V3),
+               mesh->block_vertices, GL_STATIC_DRAW);
+  bind_buffer(GL_ARRAY_BUFFER, map->map_vbo_morph_targets);
+  glBufferData(GL_ARRAY_BUFFER, mesh->num_block_vertices * sizeof(vec2),
+               mesh->block_morph_targets, GL_STATIC_DRAW);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               mesh->num_packed_indices * sizeof(uint16_t),
+               mesh->packed_indices, GL_STATIC_DRAW);
+  bind_vertex_array(0);
+}
+
+static void create_map_gl_data(struct Map *map,
+                               struct MeshGenerator *generator) {
+  struct MapMeshExtents extents;
+  V3 *map_vertices = create_map_grid(map, NULL, &extents);
+  int32_t num_map_vertices = extents.width * extents.height;
+  int32_t index_buffer_length = get_index_buffer_length(&extents);
+  int32_t *index_buffer = malloc(sizeof(int32_t) * index_buffer_length);
 
-  glGenBuffers(1, &map->map_vbo_indices);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, map->map_vbo_indices);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(int32_t),
-               index_buffer, GL_STATIC_DRAW);
+  // The GPU fills in the regular meshes once their buffers exist, the
+  // adaptive ones are always generated here
+  bool generate_on_gpu = generator != NULL && generator->shader != 0;
+  struct MapMeshData mesh;
+  int32_t num_regular_indices =
+      create_map_meshes(map, map_vertices, &extents, index_buffer,
+                        index_buffer_length, generate_on_gpu, true, &mesh);
+  int32_t num_block_vertices = mesh.num_block_vertices;
+  info("Terrain indices: %d KB in 16 bits, %d vertices in blocks for %d in "
+       "the grid\n",
+       (int32_t)(mesh.num_indices * sizeof(uint16_t) / 1024),
+       num_block_vertices, num_map_vertices);
+
+  upload_map_mesh(map, &mesh);
+
+  if (generate_on_gpu) {
+    if (generate_map_mesh(generator, map, num_block_vertices) == GAME_ERROR) {
+      error("Generating the map on the GPU failed, generating it on the "
+            "CPU\n");
+      create_regular_meshes(map, map_vertices, &extents, index_buffer,
+                            index_buffer_length, false);
+      pack_block_indices(mesh.packed_indices, index_buffer, map->clusters,
+                         MAP_SECTION_COUNT * LOD_COUNT * SECTION_CLUSTER_COUNT,
+                         &extents);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, map->map_vbo_indices);
+      glBufferSubData(GL_COPY_WRITE_BUFFER, 0,
+                      num_regular_indices * sizeof(uint16_t),
+                      mesh.packed_indices);
+      upload_block_vertices(map, map_vertices, &extents, num_block_vertices);
+    }
+#ifdef VR_VOX_VALIDATE_MESH_GENERATION
+    else {
+      validate_generated_mesh(map, map_vertices, &extents, index_buffer,
+                              index_buffer_length, num_regular_indices,
+                              num_block_vertices);
+    }
+#endif
+  }
+  free_map_mesh_data(&mesh);
   free(index_buffer);
+  free(map_vertices);
 
-  glBindVertexArray(0);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+static int32_t get_page_mip_level_count(uint32_t page_size) {
+  int32_t num_mip_levels = 1;
+  while ((page_size >> num_mip_levels) > 0 &&
+         num_mip_levels < MAX_MIP_LEVELS) {
+    ++num_mip_levels;
+  }
+  return num_mip_levels;
+}
+
+/*!
+ * Reads a page of the streamed world and builds everything a map needs from
+ * it, short of GL objects. Runs on the streaming worker.
+ */
+static void load_world_page(void *data, struct WorldStreaming *streaming,
+                            struct WorldPageBuild *build) {
+  (void)data;
+  build->result = GAME_ERROR;
+  uint8_t *page =
+      read_world_page(streaming, build->page_x, build->page_y);
+  if (page == NULL) {
+    return;
+  }
+
+  int32_t page_size = (int32_t)streaming->header.page_size;
+  int32_t grid_size = WORLD_PAGE_GRID_SIZE(page_size);
+  struct Map *map = &build->map;
+  map->height_map.width = page_size;
+  map->height_map.height = page_size;
+  map->height_map.num_channels = 1;
+  map->height_map.pixels = malloc(page_size * page_size);
+  for (int32_t y = 0; y < page_size; ++y) {
+    memcpy(&map->height_map.pixels[y * page_size], &page[y * grid_size],
+           page_size);
+  }
+  map->modifier = (float)BASE_MAP_SIZE / grid_size;
+
+  // The page's last row and column of heights come from the next pages, so
+  // they meet without seams instead of wrapping around like a map
+  struct MapMeshExtents extents;
+  V3 *vertices = create_map_grid(map, page, &extents);
+  int32_t index_buffer_length = get_index_buffer_length(&extents);
+  int32_t *index_buffer = malloc(sizeof(int32_t) * index_buffer_length);
+  // Logged once per map at load, pages stream in all the time
+  create_map_meshes(map, vertices, &extents, index_buffer,
+                    index_buffer_length, false, false, &build->mesh);
+  free(index_buffer);
+  free(vertices);
+
+  int32_t width = page_size;
+  int32_t height = page_size;
+  build->color_mips[0] = malloc(page_size * page_size * 3);
+  memcpy(build->color_mips[0], &page[grid_size * grid_size],
+         page_size * page_size * 3);
+  build->num_mip_levels = get_page_mip_level_count(page_size);
+  for (int32_t level = 1; level < build->num_mip_levels; ++level) {
+    build->color_mips[level] =
+        downsample_color(build->color_mips[level - 1], width, height);
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+  }
+
+  free(page);
+  build->result = GAME_SUCCESS;
+}
+
+/*!
+ * Uploads a loaded page into its slot's buffers and color map layer. The
+ * slots' color map array is created with the first page.
+ */
+static void upload_world_page(void *data, struct WorldStreaming *streaming,
+                              struct WorldPageBuild *build) {
+  (void)data;
+  struct Map *map = &streaming->maps[build->slot];
+  upload_map_mesh(map, &build->mesh);
+
+  uint32_t page_size = streaming->header.page_size;
+  if (streaming->color_array == 0) {
+    glGenTextures(1, &streaming->color_array);
+    bind_texture_for_update(0, GL_TEXTURE_2D_ARRAY, streaming->color_array);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                    GL_NEAREST_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    for (int32_t level = 0; level < build->num_mip_levels; ++level) {
+      uint32_t size = page_size >> level > 0 ? page_size >> level : 1;
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGB8, size, size,
+                   WORLD_PAGE_SLOT_COUNT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    }
+  } else {
+    bind_texture_for_update(0, GL_TEXTURE_2D_ARRAY, streaming->color_array);
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int32_t level = 0; level < build->num_mip_levels; ++level) {
+    uint32_t size = page_size >> level > 0 ? page_size >> level : 1;
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, build->slot, size, size,
+                    1, GL_RGB, GL_UNSIGNED_BYTE, build->color_mips[level]);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
-static void create_terrain_shader(struct OpenGLData *gl) {
+/*!
+ * Points a program's FrameUniforms block at FRAME_UNIFORMS_BINDING.
+ */
+static void bind_frame_uniform_block(GLuint program) {
+  GLuint block_index = glGetUniformBlockIndex(program, "FrameUniforms");
+  assert(block_index != GL_INVALID_INDEX);
+  glUniformBlockBinding(program, block_index, FRAME_UNIFORMS_BINDING);
+}
 
+static GLuint create_terrain_shader(const char *defines) {
   char *model_vertex_shader_source = read_file("src/shaders/model_view.vert");
   assert(model_vertex_shader_source != NULL);
 
@@ -1171,41 +3206,28 @@ static void create_terrain_shader(struct OpenGLData *gl) {
       read_file("src/shaders/get_color.frag");
   assert(get_color_fragment_shader_source != NULL);
 
-  gl->terrain_shader = create_shader(model_vertex_shader_source,
-                                     get_color_fragment_shader_source);
+  GLuint shader =
+      create_shader_with_defines(defines, model_vertex_shader_source,
+                                 get_color_fragment_shader_source);
 
   free(model_vertex_shader_source);
   free(get_color_fragment_shader_source);
-  assert(gl->terrain_shader);
-
-  gl->terrain_shader_uniforms.height_map_size =
-      glGetUniformLocation(gl->terrain_shader, "heightMapSize");
-  gl->terrain_shader_uniforms.fog_color =
-      glGetUniformLocation(gl->terrain_shader, "fogColor");
-  gl->terrain_shader_uniforms.terrain_scale =
-      glGetUniformLocation(gl->terrain_shader, "terrainScale");
-  gl->terrain_shader_uniforms.flags =
-      glGetUniformLocation(gl->terrain_shader, "flags");
-  gl->terrain_shader_uniforms.camera_position =
-      glGetUniformLocation(gl->terrain_shader, "cameraPosition");
-  gl->terrain_shader_uniforms.projection_views[0] =
-      glGetUniformLocation(gl->terrain_shader, "projectionViews[0]");
-  gl->terrain_shader_uniforms.projection_views[1] =
-      glGetUniformLocation(gl->terrain_shader, "projectionViews[1]");
-  gl->terrain_shader_uniforms.model =
-      glGetUniformLocation(gl->terrain_shader, "model");
-  gl->terrain_shader_uniforms.blend_color =
-      glGetUniformLocation(gl->terrain_shader, "blendColor");
-}
-
-static void create_hand_shader(struct OpenGLData *gl) {
+  assert(shader);
+
+  bind_frame_uniform_block(shader);
+  set_virtual_texture_units(shader);
+  return shader;
+}
+
+static void create_hand_shader(struct OpenGLData *gl, const char *defines) {
   char *vertex_shader_source = read_file("src/shaders/hand.vert");
   assert(vertex_shader_source != NULL);
 
   char *fragment_shader_source = read_file("src/shaders/hand.frag");
   assert(fragment_shader_source != NULL);
 
-  gl->hand_shader = create_shader(vertex_shader_source, fragment_shader_source);
+  gl->hand_shader = create_shader_with_defines(defines, vertex_shader_source,
+                                              fragment_shader_source);
 
   free(vertex_shader_source);
   free(fragment_shader_source);
@@ -1213,10 +3235,14 @@ static void create_hand_shader(struct OpenGLData *gl) {
 
   gl->hand_shader_uniforms.color_map =
       glGetUniformLocation(gl->hand_shader, "colorMap");
-  gl->hand_shader_uniforms.mvp[0] =
-      glGetUniformLocation(gl->hand_shader, "mvp[0]");
-  gl->hand_shader_uniforms.mvp[1] =
-      glGetUniformLocation(gl->hand_shader, "mvp[1]");
+  gl->hand_shader_uniforms.color_layer =
+      glGetUniformLocation(gl->hand_shader, "colorLayer");
+  gl->hand_shader_uniforms.use_virtual_texture =
+      glGetUniformLocation(gl->hand_shader, "useVirtualTexture");
+  gl->hand_shader_uniforms.model =
+      glGetUniformLocation(gl->hand_shader, "model");
+  bind_frame_uniform_block(gl->hand_shader);
+  set_virtual_texture_units(gl->hand_shader);
 }
 
 static void create_cube_buffer(struct CubeBuffer *buffer) {
@@ -1284,24 +3310,17 @@ static void create_gl_objects(struct Game *game) {
   glEnableVertexAttribArray(0);
   glBindVertexArray(0);
 
+  // An array, like the color maps the terrain shader usually reads
   glGenTextures(1, &gl->white_tex_id);
-  glBindTexture(GL_TEXTURE_2D, gl->white_tex_id);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, gl->white_tex_id);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
   uint8_t white_tex_pixels[4] = {255, 255, 255, 0};
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE,
-               white_tex_pixels);
-
-  glGenBuffers(1, &gl->draw_command_vbo);
-  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gl->draw_command_vbo);
-  // Reserve space for 500 draw commands
-  glBufferData(GL_DRAW_INDIRECT_BUFFER,
-               500 * sizeof(struct DrawElementsIndirectCommand), NULL,
-               GL_DYNAMIC_DRAW);
-  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, 1, 1, 1, 0, GL_RGB,
+               GL_UNSIGNED_BYTE, white_tex_pixels);
 
   char *vertex_shader_source = read_file("src/shaders/to_screen_space.vert");
   assert(vertex_shader_source != NULL);
@@ -1315,13 +3334,80 @@ static void create_gl_objects(struct Game *game) {
   free(fragment_shader_source);
   assert(gl->shader_program);
 
-  create_terrain_shader(gl);
-  create_hand_shader(gl);
   create_cube_buffer(&gl->cube_buffer);
 
+  query_gl_capabilities(&gl->caps);
+
+  // Instanced stereo is compiled in when supported and enabled per frame
+  // through the frame uniforms
+  const char *stereo_defines = "";
+  if (gl->caps.viewport_layer_array) {
+    stereo_defines = "#define USE_INSTANCED_STEREO\n"
+                     "#define USE_STEREO_VIEWPORT_INDEX\n";
+  } else if (gl->caps.instanced_stereo) {
+    stereo_defines = "#define USE_INSTANCED_STEREO\n";
+  }
+  gl->terrain_shader = create_terrain_shader(stereo_defines);
+  create_hand_shader(gl, stereo_defines);
+  if (create_clipmap(&gl->clipmap, stereo_defines) == GAME_ERROR) {
+    error("Could not create clipmap, terrain is drawn by map section\n");
+    gl->clipmap.shader = 0;
+  } else {
+    bind_frame_uniform_block(gl->clipmap.shader);
+    set_virtual_texture_units(gl->clipmap.shader);
+  }
+  gl->tessellation.shader = 0;
+  if (gl->caps.tessellation_shader) {
+    if (create_tessellated_terrain(&gl->tessellation, stereo_defines) ==
+        GAME_ERROR) {
+      error("Could not create tessellated terrain\n");
+      gl->tessellation.shader = 0;
+    } else {
+      bind_frame_uniform_block(gl->tessellation.shader);
+      set_virtual_texture_units(gl->tessellation.shader);
+    }
+  }
+#ifndef VR_VOX_USE_ASTC
+  if (create_far_field(&game->far_field, stereo_defines) == GAME_ERROR) {
+    error("Could not create the far field\n");
+    free_far_field(&game->far_field);
+  } else {
+    bind_frame_uniform_block(game->far_field.shader);
+  }
+#endif
+
+  struct RenderState *render_state = game->render_state;
+  int32_t frame_ring_size =
+      render_state->cluster_range_capacity *
+          (sizeof(struct DrawInfo) +
+           sizeof(struct DrawElementsIndirectCommand)) +
+      sizeof(struct FrameUniforms) + 3 * FRAME_RING_ALIGNMENT;
+  if (create_ring_buffer(&gl->frame_ring, &gl->caps, frame_ring_size) ==
+      GAME_ERROR) {
+    free_ring_buffer(&gl->frame_ring);
+    gl->caps.buffer_storage = false;
+    create_ring_buffer(&gl->frame_ring, &gl->caps, frame_ring_size);
+  }
+
+  if (gl->caps.compute_shader) {
+    if (create_gpu_culling(&gl->gpu_culling, render_state->num_sections) ==
+        GAME_ERROR) {
+      error("Could not create GPU culling, falling back to CPU culling\n");
+      gl->caps.compute_shader = false;
+    }
+  }
+
+  struct MeshGenerator mesh_generator = {0};
+#ifdef VR_VOX_GPU_MESH_GENERATION
+  if (gl->caps.compute_shader &&
+      create_mesh_generator(&mesh_generator) == GAME_ERROR) {
+    error("Could not create mesh generator, maps are generated on the CPU\n");
+  }
+#endif
   for (int i = 0; i < MAP_COUNT; i++) {
-    create_map_gl_data(&game->maps[i]);
+    create_map_gl_data(&game->maps[i], &mesh_generator);
   }
+  free_mesh_generator(&mesh_generator);
 }
 
 static int32_t load_map(struct Map *map, struct MapEntry *map_entry) {
@@ -1430,6 +3516,18 @@ static int32_t load_map(struct Map *map, struct MapEntry *map_entry) {
   // Add on to the height map width to account for the extra column we add
   map->modifier = (float)BASE_MAP_SIZE / (map->height_map.width + 1);
 
+  char pvs_file_name[256];
+  int32_t pvs_file_name_length = snprintf(
+      pvs_file_name, sizeof(pvs_file_name), "%s.pvs", map_entry->height);
+  if (pvs_file_name_length >= (int32_t)sizeof(pvs_file_name) - 1) {
+    error("Unable to format PVS filename for %s\n", map_entry->height);
+    return GAME_ERROR;
+  }
+
+  if (load_pvs(&map->pvs, pvs_file_name) != GAME_SUCCESS) {
+    return GAME_ERROR;
+  }
+
   return GAME_SUCCESS;
 }
 
@@ -1460,8 +3558,59 @@ static void create_frame_buffer(struct Game *game, int32_t width,
   game->frame.pitch = game->frame.width * sizeof(uint32_t);
 }
 
+/*! Allocates the arrays of a render state, sized for every section of the
+ * tiled world, and fills its section list.
+ */
+static void create_render_state(struct RenderState *render_state) {
+  int32_t map_min = -PVS_TILE_RADIUS, map_max = PVS_TILE_RADIUS;
+  int32_t map_count = map_max - map_min + 1;
+  int32_t num_sections = map_count * map_count * MAP_SECTION_COUNT;
+
+  render_state->num_commands = 0;
+  // A section is drawn by at most one command
+  render_state->command_capacity = num_sections;
+  render_state->num_cluster_ranges = 0;
+  render_state->cluster_range_capacity =
+      num_sections * DRAW_RANGES_PER_SECTION;
+  render_state->num_occluded_sections = 0;
+  render_state->commands =
+      malloc(sizeof(struct DrawCommand) * render_state->command_capacity);
+  render_state->cluster_ranges =
+      malloc(sizeof(struct DrawRange) * render_state->cluster_range_capacity);
+  render_state->sections_by_distance =
+      malloc(sizeof(struct WorldSection) * num_sections);
+  render_state->horizon = malloc(sizeof(struct HorizonBuffer));
+
+  render_state->num_sections = 0;
+  for (int32_t map_x = map_min; map_x <= map_max; ++map_x) {
+    for (int32_t map_y = map_min; map_y <= map_max; ++map_y) {
+      for (int32_t section = 0; section < MAP_SECTION_COUNT; ++section) {
+        struct WorldSection *world_section =
+            &render_state->sections_by_distance[render_state->num_sections];
+        world_section->map_x = map_x;
+        world_section->map_y = map_y;
+        world_section->section_index = section;
+        world_section->camera_distance = 0.0f;
+        ++render_state->num_sections;
+      }
+    }
+  }
+}
+
+static void free_render_state(struct RenderState *render_state) {
+  free(render_state->commands);
+  render_state->commands = NULL;
+  free(render_state->cluster_ranges);
+  render_state->cluster_ranges = NULL;
+  free(render_state->sections_by_distance);
+  render_state->sections_by_distance = NULL;
+  free(render_state->horizon);
+  render_state->horizon = NULL;
+}
+
 int32_t game_init(struct Game *game, int32_t width, int32_t height) {
   memset(&game->maps, 0, sizeof(game->maps));
+  game->render_state = &game->render_states[0];
 
   if (load_assets(game) == GAME_ERROR) {
     return GAME_ERROR;
@@ -1503,33 +3652,40 @@ int32_t game_init(struct Game *game, int32_t width, int32_t height) {
       .sky_color = {0.529f, 0.808f, 0.98f, 1.0f},
   };
 
+  for (int32_t i = 0; i < 2; ++i) {
+    create_render_state(&game->render_states[i]);
+  }
+
   create_gl_objects(game);
   game->map_index = 0;
   game->options.visualize_lod = false;
   game->options.visualize_frustum = false;
   game->options.show_wireframe = false;
-  game->render_state.capacity = sizeof(game->render_state.commands) /
-                                sizeof(game->render_state.commands[0]);
-
-  int32_t map_min = -3, map_max = 3;
-  assert(
-      (map_max - map_min) * 2 * MAP_SECTION_COUNT <=
-          (int32_t)(sizeof(game->render_state.sections_by_distance) /
-                    sizeof(game->render_state.sections_by_distance[0])) &&
-      "The capacity of RenderState's sections_by_distance is not high enough");
-  int32_t *i_section = &game->render_state.num_sections;
-  for (int32_t map_x = map_min; map_x <= map_max; ++map_x) {
-    for (int32_t map_y = map_min; map_y <= map_max; ++map_y) {
-      for (int32_t section = 0; section < MAP_SECTION_COUNT; ++section) {
-        struct WorldSection *world_section =
-            &game->render_state.sections_by_distance[*i_section];
-        world_section->map_x = map_x;
-        world_section->map_y = map_y;
-        world_section->section_index = section;
-        world_section->camera_distance = 0.0f;
-        ++(*i_section);
-      }
-    }
+  game->options.occlusion_culling = true;
+  game->options.gpu_culling = false;
+  game->options.use_pvs = true;
+  game->options.cluster_culling = true;
+  game->options.pipelined_frames = false;
+  game->options.late_latching = true;
+  game->options.render_stereo = false;
+  game->options.clipmap_terrain = false;
+  game->options.adaptive_meshes = false;
+  game->options.mixed_world = false;
+  game->options.streamed_world = false;
+  game->options.virtual_texture = true;
+  game->options.far_field = false;
+
+  if (create_frame_pipeline(&game->pipeline, build_frame_render_state, game) ==
+      GAME_ERROR) {
+    error("Could not create frame pipeline, frames will be built serially\n");
+    free_frame_pipeline(&game->pipeline);
+  }
+
+  if (create_world_streaming(&game->streaming, WORLD_PAGES_DIRECTORY,
+                             load_world_page, upload_world_page,
+                             game) == GAME_ERROR) {
+    error("Could not start streaming the world\n");
+    free_world_streaming(&game->streaming);
   }
 
   for (int i = 0; i < 2; ++i) {
@@ -1539,7 +3695,87 @@ int32_t game_init(struct Game *game, int32_t width, int32_t height) {
   return GAME_SUCCESS;
 }
 
+/*!
+ * @return the number of terrain triangles drawn by a recent frame, 0 when the
+ *         terrain is culled on the GPU or drawn with clipmaps
+ */
+uint32_t get_terrain_triangle_count(struct Game *game) {
+  if (is_clipmap_enabled(game) || is_gpu_culling_enabled(game)) {
+    return 0;
+  }
+  if (is_tessellation_enabled(game)) {
+    return game->gl.tessellation.num_triangles;
+  }
+
+  uint32_t num_triangles = 0;
+  struct RenderState *render_state = game->render_state;
+  for (int32_t i = 0; i < render_state->num_cluster_ranges; ++i) {
+    num_triangles += render_state->cluster_ranges[i].mesh.num_indices / 3;
+  }
+  return num_triangles;
+}
+
+// Frames timed for each thread count by benchmark_raycasting
+#define RAYCAST_BENCHMARK_FRAMES 20
+
+/*!
+ * Times the software raycaster on the game's frame buffer from the current
+ * camera, with 1 up to as many threads as there are processors, and prints
+ * each frame time and its speedup over a single thread.
+ */
+void benchmark_raycasting(struct Game *game) {
+#ifdef VR_VOX_USE_ASTC
+  info("ASTC builds keep no uncompressed colors to raycast\n");
+  (void)game;
+#else
+  struct Map *map = &game->maps[game->map_index];
+  // The raycaster works in the map's texels
+  struct Camera camera = game->camera;
+  glm_vec3_mul(camera.position, CAMERA_TO_TERRAIN, camera.position);
+  camera.position[0] /= map->modifier;
+  camera.position[2] /= map->modifier;
+  struct RaycastJob job = {
+      .frame = &game->frame,
+      .color_map = &map->color_map,
+      .height_map = &map->height_map,
+      .camera = &camera,
+      .panorama = NULL,
+  };
+
+  int32_t max_threads =
+      clamp_i(get_processor_count(), 1, RAYCAST_MAX_THREADS);
+  info("Raycasting %dx%d with 1 to %d threads\n", game->frame.width,
+       game->frame.height, max_threads);
+  double single_thread_time = 0.0;
+  for (int32_t threads = 1; threads <= max_threads; ++threads) {
+    struct RaycastPool pool;
+    if (create_raycast_pool(&pool, threads) == GAME_ERROR) {
+      free_raycast_pool(&pool);
+      break;
+    }
+
+    // Warms up the caches and the workers
+    raycast_in_bands(&pool, &job);
+    double start = get_time_seconds();
+    for (int32_t i = 0; i < RAYCAST_BENCHMARK_FRAMES; ++i) {
+      raycast_in_bands(&pool, &job);
+    }
+    double frame_time =
+        (get_time_seconds() - start) / RAYCAST_BENCHMARK_FRAMES;
+    free_raycast_pool(&pool);
+
+    if (threads == 1) {
+      single_thread_time = frame_time;
+    }
+    info("%2d threads: %.2f ms, %.2fx\n", threads, frame_time * 1000.0,
+         single_thread_time / frame_time);
+  }
+#endif
+}
+
 void game_free(struct Game *game) {
+  // Its worker reads the maps
+  free_far_field(&game->far_field);
   for (int i = 0; i < MAP_COUNT; ++i) {
     struct Map *map = &game->maps[i];
 #ifdef VR_VOX_USE_ASTC
@@ -1561,7 +3797,22 @@ void game_free(struct Game *game) {
       stbi_image_free(map->height_map.pixels);
       map->height_map.pixels = NULL;
     }
+
+    if (map->clusters != NULL) {
+      free(map->clusters);
+      map->clusters = NULL;
+    }
+
+    free_pvs(&map->pvs);
+  }
+
+  free_frame_pipeline(&game->pipeline);
+  free_world_streaming(&game->streaming);
+  for (int32_t i = 0; i < 2; ++i) {
+    free_render_state(&game->render_states[i]);
   }
+  free_clipmap(&game->gl.clipmap);
+  free_virtual_texture(&game->virtual_texture);
 
   if (game->frame.y_buffer != NULL) {
     free(game->frame.y_buffer);
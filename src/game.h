@@ -9,3 +9,5 @@ void update_game(struct Game *, struct KeyboardState *,
 void render_game(struct Game *, struct InputMatrices *);
 int32_t game_init(struct Game *, int32_t width, int32_t height);
 void game_free(struct Game *);
+uint32_t get_terrain_triangle_count(struct Game *);
+void benchmark_raycasting(struct Game *);
@@ -7,4 +7,13 @@
 #include <GLES3/gl31.h>
 #include <GLES2/gl2ext.h>
 // clang-format on
+
+// Extension entry points, loaded by the platform layer. NULL when the
+// extension is not supported.
+extern PFNGLMULTIDRAWELEMENTSINDIRECTEXTPROC glMultiDrawElementsIndirectEXT;
+#define glMultiDrawElementsIndirect glMultiDrawElementsIndirectEXT
+extern PFNGLBUFFERSTORAGEEXTPROC glBufferStorageEXT;
+#define glBufferStorage glBufferStorageEXT
+#define GL_MAP_PERSISTENT_BIT GL_MAP_PERSISTENT_BIT_EXT
+#define GL_MAP_COHERENT_BIT GL_MAP_COHERENT_BIT_EXT
 #endif
@@ -0,0 +1,81 @@
+#include "gl_extensions.h"
+#include "platform.h"
+#include "string.h"
+
+#ifdef INCLUDE_GLAD
+
+void query_gl_capabilities(struct GLCapabilities *caps) {
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+  // Compute shaders are compiled as GLSL 4.30, so the context itself has to
+  // be 4.3 or newer, not just advertise the extensions
+  caps->compute_shader = (major > 4 || (major == 4 && minor >= 3)) &&
+                         GLAD_GL_ARB_compute_shader &&
+                         GLAD_GL_ARB_shader_storage_buffer_object &&
+                         GLAD_GL_ARB_shader_image_load_store;
+  caps->multi_draw_indirect = GLAD_GL_ARB_multi_draw_indirect;
+  caps->base_instance = GLAD_GL_ARB_base_instance;
+  caps->indirect_parameters = GLAD_GL_ARB_indirect_parameters;
+  caps->buffer_storage = GLAD_GL_ARB_buffer_storage;
+  // Falls back to clip distances when the viewport can't be selected
+  caps->instanced_stereo = true;
+  caps->viewport_layer_array = GLAD_GL_ARB_viewport_array &&
+                               GLAD_GL_ARB_shader_viewport_layer_array;
+  // Tessellation shaders are compiled as GLSL 4.00
+  caps->tessellation_shader = major >= 4;
+
+  info("GL %d.%d compute: %d, multi draw indirect: %d, base instance: %d, "
+       "indirect parameters: %d, buffer storage: %d, viewport index: %d, "
+       "tessellation: %d\n",
+       major, minor, caps->compute_shader, caps->multi_draw_indirect,
+       caps->base_instance, caps->indirect_parameters, caps->buffer_storage,
+       caps->viewport_layer_array, caps->tessellation_shader);
+}
+
+#else
+
+PFNGLMULTIDRAWELEMENTSINDIRECTEXTPROC glMultiDrawElementsIndirectEXT;
+PFNGLBUFFERSTORAGEEXTPROC glBufferStorageEXT;
+
+static bool has_extension(const char *name) {
+  GLint num_extensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+  for (GLint i = 0; i < num_extensions; ++i) {
+    const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (extension != NULL && strcmp(extension, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void query_gl_capabilities(struct GLCapabilities *caps) {
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+  // Compute shaders and shader storage buffers are core in GLES 3.1
+  caps->compute_shader = major > 3 || (major == 3 && minor >= 1);
+  caps->multi_draw_indirect = has_extension("GL_EXT_multi_draw_indirect") &&
+                              glMultiDrawElementsIndirectEXT != NULL;
+  // Only needed for the base instance field of indirect commands, which has
+  // no entry point of its own
+  caps->base_instance = has_extension("GL_EXT_base_instance");
+  caps->indirect_parameters = false;
+  caps->buffer_storage = has_extension("GL_EXT_buffer_storage") &&
+                         glBufferStorageEXT != NULL;
+  // Stereo is drawn with multiview
+  caps->instanced_stereo = false;
+  caps->viewport_layer_array = false;
+  // Only drawn on desktop
+  caps->tessellation_shader = false;
+
+  info("GLES %d.%d compute: %d, multi draw indirect: %d, base instance: %d, "
+       "buffer storage: %d\n",
+       major, minor, caps->compute_shader, caps->multi_draw_indirect,
+       caps->base_instance, caps->buffer_storage);
+}
+
+#endif
@@ -0,0 +1,4 @@
+#pragma once
+#include "types.h"
+
+void query_gl_capabilities(struct GLCapabilities *caps);
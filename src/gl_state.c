@@ -0,0 +1,233 @@
+#include "gl_state.h"
+#include "string.h"
+
+// Skips binds and enables of state that is already set, and counts the GL
+// calls made each frame. Everything that runs during a frame has to go through
+// here for the cache to stay correct, setup code that runs before the first
+// frame can call GL directly.
+
+// Texture units whose bindings are tracked, binds to others always go to GL
+#define TRACKED_TEXTURE_UNITS 4
+// Stands for a binding the cache does not know, so the next bind is sent
+#define UNKNOWN_BINDING 0xffffffffu
+
+enum TrackedBufferTarget {
+  TRACKED_ARRAY_BUFFER,
+  TRACKED_DRAW_INDIRECT_BUFFER,
+  TRACKED_COPY_WRITE_BUFFER,
+  TRACKED_UNIFORM_BUFFER,
+  TRACKED_SHADER_STORAGE_BUFFER,
+  TRACKED_BUFFER_TARGET_COUNT,
+};
+
+enum TrackedCapability {
+  TRACKED_DEPTH_TEST,
+  TRACKED_CULL_FACE,
+  TRACKED_BLEND,
+  TRACKED_CAPABILITY_COUNT,
+};
+
+enum CapabilityState {
+  CAPABILITY_UNKNOWN,
+  CAPABILITY_DISABLED,
+  CAPABILITY_ENABLED,
+};
+
+struct GLStateCache {
+  GLuint program;
+  GLuint vertex_array;
+  GLuint buffers[TRACKED_BUFFER_TARGET_COUNT];
+  GLuint active_texture_unit;
+  GLuint textures[TRACKED_TEXTURE_UNITS];
+  enum CapabilityState capabilities[TRACKED_CAPABILITY_COUNT];
+  struct GLCallCounters counters;
+  struct GLCallCounters last_frame_counters;
+};
+
+// GL state belongs to the context, which only the render thread uses, so the
+// cache is shared by everything that talks to GL
+static struct GLStateCache cache;
+
+static int32_t get_tracked_buffer_target(GLenum target) {
+  switch (target) {
+  case GL_ARRAY_BUFFER:
+    return TRACKED_ARRAY_BUFFER;
+  case GL_DRAW_INDIRECT_BUFFER:
+    return TRACKED_DRAW_INDIRECT_BUFFER;
+  case GL_COPY_WRITE_BUFFER:
+    return TRACKED_COPY_WRITE_BUFFER;
+  case GL_UNIFORM_BUFFER:
+    return TRACKED_UNIFORM_BUFFER;
+  case GL_SHADER_STORAGE_BUFFER:
+    return TRACKED_SHADER_STORAGE_BUFFER;
+  default:
+    // Element array buffers belong to the vertex array, so they are not
+    // tracked either
+    return -1;
+  }
+}
+
+static int32_t get_tracked_capability(GLenum capability) {
+  switch (capability) {
+  case GL_DEPTH_TEST:
+    return TRACKED_DEPTH_TEST;
+  case GL_CULL_FACE:
+    return TRACKED_CULL_FACE;
+  case GL_BLEND:
+    return TRACKED_BLEND;
+  default:
+    return -1;
+  }
+}
+
+/*!
+ * Forgets every cached binding, since the platform layer or the compositor may
+ * have changed GL state between frames, and starts counting a new frame.
+ */
+void begin_gl_state_frame(void) {
+  cache.program = UNKNOWN_BINDING;
+  cache.vertex_array = UNKNOWN_BINDING;
+  for (int32_t i = 0; i < TRACKED_BUFFER_TARGET_COUNT; ++i) {
+    cache.buffers[i] = UNKNOWN_BINDING;
+  }
+  cache.active_texture_unit = UNKNOWN_BINDING;
+  for (int32_t i = 0; i < TRACKED_TEXTURE_UNITS; ++i) {
+    cache.textures[i] = UNKNOWN_BINDING;
+  }
+  for (int32_t i = 0; i < TRACKED_CAPABILITY_COUNT; ++i) {
+    cache.capabilities[i] = CAPABILITY_UNKNOWN;
+  }
+
+  cache.last_frame_counters = cache.counters;
+  memset(&cache.counters, 0, sizeof(cache.counters));
+}
+
+/*!
+ * @return the calls made during the last complete frame
+ */
+struct GLCallCounters get_gl_call_counters(void) {
+  return cache.last_frame_counters;
+}
+
+void count_uniform_uploads(uint32_t count) {
+  cache.counters.uniform_uploads += count;
+}
+
+void count_draws(uint32_t count) { cache.counters.draws += count; }
+
+void count_buffer_maps(uint32_t count) { cache.counters.buffer_maps += count; }
+
+void use_program(GLuint program) {
+  if (cache.program == program) {
+    ++cache.counters.skipped_calls;
+    return;
+  }
+
+  glUseProgram(program);
+  cache.program = program;
+  ++cache.counters.binds;
+}
+
+void bind_vertex_array(GLuint vertex_array) {
+  if (cache.vertex_array == vertex_array) {
+    ++cache.counters.skipped_calls;
+    return;
+  }
+
+  glBindVertexArray(vertex_array);
+  cache.vertex_array = vertex_array;
+  ++cache.counters.binds;
+}
+
+void bind_buffer(GLenum target, GLuint buffer) {
+  int32_t tracked = get_tracked_buffer_target(target);
+  if (tracked >= 0) {
+    if (cache.buffers[tracked] == buffer) {
+      ++cache.counters.skipped_calls;
+      return;
+    }
+    cache.buffers[tracked] = buffer;
+  }
+
+  glBindBuffer(target, buffer);
+  ++cache.counters.binds;
+}
+
+// Binding to an indexed target also binds to the generic one
+static void set_generic_buffer(GLenum target, GLuint buffer) {
+  int32_t tracked = get_tracked_buffer_target(target);
+  if (tracked >= 0) {
+    cache.buffers[tracked] = buffer;
+  }
+}
+
+void bind_buffer_base(GLenum target, GLuint index, GLuint buffer) {
+  glBindBufferBase(target, index, buffer);
+  set_generic_buffer(target, buffer);
+  ++cache.counters.binds;
+}
+
+void bind_buffer_range(GLenum target, GLuint index, GLuint buffer,
+                       GLintptr offset, GLsizeiptr size) {
+  glBindBufferRange(target, index, buffer, offset, size);
+  set_generic_buffer(target, buffer);
+  ++cache.counters.binds;
+}
+
+/*!
+ * Texture names belong to a single target, so textures of any target are
+ * tracked per unit together.
+ */
+void bind_texture(GLuint unit, GLenum target, GLuint texture) {
+  if (unit < TRACKED_TEXTURE_UNITS && cache.textures[unit] == texture) {
+    ++cache.counters.skipped_calls;
+    return;
+  }
+
+  if (cache.active_texture_unit != unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    cache.active_texture_unit = unit;
+  }
+  glBindTexture(target, texture);
+  if (unit < TRACKED_TEXTURE_UNITS) {
+    cache.textures[unit] = texture;
+  }
+  ++cache.counters.binds;
+}
+
+/*!
+ * Binds a texture to be written to. Calls like glTexSubImage2D act on the
+ * active unit, which bind_texture leaves alone when the texture is already
+ * bound.
+ */
+void bind_texture_for_update(GLuint unit, GLenum target, GLuint texture) {
+  if (cache.active_texture_unit != unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    cache.active_texture_unit = unit;
+  }
+  bind_texture(unit, target, texture);
+}
+
+void bind_texture_2d(GLuint unit, GLuint texture) {
+  bind_texture(unit, GL_TEXTURE_2D, texture);
+}
+
+void set_capability(GLenum capability, bool enabled) {
+  int32_t tracked = get_tracked_capability(capability);
+  enum CapabilityState state =
+      enabled ? CAPABILITY_ENABLED : CAPABILITY_DISABLED;
+  if (tracked >= 0) {
+    if (cache.capabilities[tracked] == state) {
+      ++cache.counters.skipped_calls;
+      return;
+    }
+    cache.capabilities[tracked] = state;
+  }
+
+  if (enabled) {
+    glEnable(capability);
+  } else {
+    glDisable(capability);
+  }
+  ++cache.counters.capability_changes;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "game_gl.h"
+#include "stdbool.h"
+#include "types.h"
+
+void begin_gl_state_frame(void);
+struct GLCallCounters get_gl_call_counters(void);
+void count_uniform_uploads(uint32_t count);
+void count_draws(uint32_t count);
+void count_buffer_maps(uint32_t count);
+
+void use_program(GLuint program);
+void bind_vertex_array(GLuint vertex_array);
+void bind_buffer(GLenum target, GLuint buffer);
+void bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+void bind_buffer_range(GLenum target, GLuint index, GLuint buffer,
+                       GLintptr offset, GLsizeiptr size);
+void bind_texture(GLuint unit, GLenum target, GLuint texture);
+void bind_texture_for_update(GLuint unit, GLenum target, GLuint texture);
+void bind_texture_2d(GLuint unit, GLuint texture);
+void set_capability(GLenum capability, bool enabled);
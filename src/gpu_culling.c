@@ -0,0 +1,209 @@
+#include "gpu_culling.h"
+#include "assert.h"
+#include "file.h"
+#include "gl_state.h"
+#include "platform.h"
+#include "shader.h"
+#include <stdlib.h>
+
+#define CULL_WORK_GROUP_SIZE 64
+
+int32_t create_gpu_culling(struct GpuCulling *culling, int32_t capacity) {
+  char *compute_source = read_file("src/shaders/cull_sections.comp");
+  assert(compute_source != NULL);
+  culling->cull_shader = create_compute_shader(compute_source);
+  free(compute_source);
+  if (!culling->cull_shader) {
+    return GAME_ERROR;
+  }
+
+  GLuint shader = culling->cull_shader;
+  culling->uniforms.frustum_planes =
+      glGetUniformLocation(shader, "frustumPlanes");
+  culling->uniforms.camera_position =
+      glGetUniformLocation(shader, "cameraPosition");
+  culling->uniforms.terrain_scale =
+      glGetUniformLocation(shader, "terrainScale");
+  culling->uniforms.lod_distances =
+      glGetUniformLocation(shader, "lodDistances");
+  culling->uniforms.fog_distance = glGetUniformLocation(shader, "fogDistance");
+  culling->uniforms.section_count =
+      glGetUniformLocation(shader, "sectionCount");
+  culling->uniforms.command_capacity =
+      glGetUniformLocation(shader, "commandCapacity");
+  culling->uniforms.clear_commands =
+      glGetUniformLocation(shader, "clearCommands");
+  culling->uniforms.use_base_instance =
+      glGetUniformLocation(shader, "useBaseInstance");
+  culling->uniforms.view_count = glGetUniformLocation(shader, "viewCount");
+
+  culling->capacity = capacity;
+  culling->command_capacity = capacity * SECTION_VERTEX_BLOCKS;
+  culling->num_sections = 0;
+  culling->map_index = -1;
+
+  glGenBuffers(1, &culling->section_buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->section_buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(struct GpuSection),
+               NULL, GL_STATIC_DRAW);
+
+  glGenBuffers(1, &culling->command_buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->command_buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               culling->command_capacity *
+                   sizeof(struct DrawElementsIndirectCommand),
+               NULL, GL_DYNAMIC_COPY);
+
+  glGenBuffers(1, &culling->draw_info_buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->draw_info_buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               culling->command_capacity * sizeof(struct DrawInfo), NULL,
+               GL_DYNAMIC_COPY);
+
+  glGenBuffers(1, &culling->draw_count_buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->draw_count_buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL,
+               GL_DYNAMIC_COPY);
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  return GAME_SUCCESS;
+}
+
+void upload_gpu_culling_sections(struct GpuCulling *culling,
+                                 struct GpuSection *sections,
+                                 int32_t num_sections, int32_t map_index) {
+  assert(num_sections <= culling->capacity);
+  bind_buffer(GL_SHADER_STORAGE_BUFFER, culling->section_buffer);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                  num_sections * sizeof(struct GpuSection), sections);
+  culling->num_sections = num_sections;
+  culling->map_index = map_index;
+}
+
+/*!
+ * Culls every world section against the frustum and the fog distance, and
+ * writes a compacted list of indirect draw commands, along with the number of
+ * commands written.
+ *
+ * @param[in]  culling
+ * @param[in]  caps
+ * @param[in]  frustum_planes  In rendering units
+ * @param[in]  camera_position In terrain units
+ * @param[in]  terrain_scale
+ * @param[in]  view_count      Instances to draw of each section, see
+ *                             get_view_count
+ */
+void dispatch_gpu_culling(struct GpuCulling *culling,
+                          struct GLCapabilities *caps, vec4 frustum_planes[6],
+                          vec3 camera_position, float terrain_scale,
+                          int32_t view_count) {
+  use_program(culling->cull_shader);
+  bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 0, culling->section_buffer);
+  bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 1, culling->command_buffer);
+  bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 2, culling->draw_info_buffer);
+  bind_buffer_base(GL_SHADER_STORAGE_BUFFER, 3, culling->draw_count_buffer);
+
+  struct GpuCullingUniforms *uniforms = &culling->uniforms;
+  glUniform4fv(uniforms->frustum_planes, 6, (float *)frustum_planes);
+  glUniform3fv(uniforms->camera_position, 1, camera_position);
+  glUniform1f(uniforms->terrain_scale, terrain_scale);
+  glUniform2f(uniforms->lod_distances, LOD1_DISTANCE, LOD2_DISTANCE);
+  glUniform1f(uniforms->fog_distance, DISTANCE_FOG_MAX);
+  glUniform1ui(uniforms->section_count, culling->num_sections);
+  glUniform1ui(uniforms->command_capacity, culling->command_capacity);
+  glUniform1i(uniforms->use_base_instance, caps->base_instance);
+  glUniform1ui(uniforms->view_count, view_count);
+  count_uniform_uploads(9);
+
+  GLuint num_groups = (culling->command_capacity + CULL_WORK_GROUP_SIZE - 1) /
+                      CULL_WORK_GROUP_SIZE;
+  glUniform1i(uniforms->clear_commands, GL_TRUE);
+  glDispatchCompute(num_groups, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  glUniform1i(uniforms->clear_commands, GL_FALSE);
+  glDispatchCompute(num_groups, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                  GL_BUFFER_UPDATE_BARRIER_BIT);
+  count_uniform_uploads(2);
+  count_draws(2);
+}
+
+/*!
+ * Reads back how many commands the last dispatch wrote. Stalls until the
+ * dispatch has finished, only used when the draw count cannot be consumed
+ * by the GPU directly.
+ */
+static GLuint read_draw_count(struct GpuCulling *culling) {
+  bind_buffer(GL_SHADER_STORAGE_BUFFER, culling->draw_count_buffer);
+  GLuint *mapped = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0,
+                                    sizeof(GLuint), GL_MAP_READ_BIT);
+  count_buffer_maps(1);
+  GLuint draw_count = 0;
+  if (mapped != NULL) {
+    draw_count = *mapped;
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+  } else {
+    error("Could not map draw count buffer: %d\n", glGetError());
+  }
+
+  if (draw_count > (GLuint)culling->command_capacity) {
+    draw_count = culling->command_capacity;
+  }
+  return draw_count;
+}
+
+/*!
+ * Draws the commands written by dispatch_gpu_culling. Expects the terrain VAO
+ * and the terrain shader to be bound.
+ *
+ * @param[in]  culling
+ * @param[in]  caps
+ * @param[in]  view_count Must match the one the commands were written with
+ */
+void draw_gpu_culled_sections(struct GpuCulling *culling,
+                              struct GLCapabilities *caps,
+                              int32_t view_count) {
+  bind_buffer(GL_ARRAY_BUFFER, culling->draw_info_buffer);
+  glEnableVertexAttribArray(DRAW_INFO_ATTRIBUTE);
+  glVertexAttribPointer(DRAW_INFO_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE,
+                        sizeof(struct DrawInfo), (void *)0);
+  glVertexAttribDivisor(DRAW_INFO_ATTRIBUTE, view_count);
+
+  bind_buffer(GL_DRAW_INDIRECT_BUFFER, culling->command_buffer);
+
+  if (caps->multi_draw_indirect && caps->base_instance) {
+#ifdef GL_ARB_indirect_parameters
+    if (caps->indirect_parameters) {
+      bind_buffer(GL_PARAMETER_BUFFER_ARB, culling->draw_count_buffer);
+      glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_SHORT,
+                                          (void *)0, 0,
+                                          culling->command_capacity, 0);
+      bind_buffer(GL_PARAMETER_BUFFER_ARB, 0);
+    } else
+#endif
+    {
+      // Commands past the draw count were cleared, so they draw nothing
+      glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, (void *)0,
+                                  culling->command_capacity, 0);
+    }
+    count_draws(1);
+  } else {
+    GLuint draw_count = read_draw_count(culling);
+    for (GLuint i = 0; i < draw_count; ++i) {
+      if (!caps->base_instance) {
+        // Point the instanced attribute at this draw's record instead
+        glVertexAttribPointer(DRAW_INFO_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE,
+                              sizeof(struct DrawInfo),
+                              (void *)(i * sizeof(struct DrawInfo)));
+      }
+      glDrawElementsIndirect(
+          GL_TRIANGLES, GL_UNSIGNED_SHORT,
+          (void *)(i * sizeof(struct DrawElementsIndirectCommand)));
+    }
+    count_draws(draw_count);
+  }
+
+  glVertexAttribDivisor(DRAW_INFO_ATTRIBUTE, 0);
+  glDisableVertexAttribArray(DRAW_INFO_ATTRIBUTE);
+}
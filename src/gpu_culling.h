@@ -0,0 +1,13 @@
+#pragma once
+#include "types.h"
+
+int32_t create_gpu_culling(struct GpuCulling *culling, int32_t capacity);
+void upload_gpu_culling_sections(struct GpuCulling *culling,
+                                 struct GpuSection *sections,
+                                 int32_t num_sections, int32_t map_index);
+void dispatch_gpu_culling(struct GpuCulling *culling,
+                          struct GLCapabilities *caps, vec4 frustum_planes[6],
+                          vec3 camera_position, float terrain_scale,
+                          int32_t view_count);
+void draw_gpu_culled_sections(struct GpuCulling *culling,
+                              struct GLCapabilities *caps, int32_t view_count);
@@ -4,6 +4,7 @@
 #include "assert.h"
 #include "stdio.h"
 #include "platform.h"
+#include <stdlib.h>
 
 void wrap_coordinates(struct ImageBuffer *image, int *x, int *y) {
   while (*x < 0) {
@@ -68,3 +69,32 @@ int clamp_i(int position, int min, int max) {
 
   return position;
 }
+
+/*!
+ * Halves an RGB image with a box filter, for the next mip level.
+ *
+ * @return the texels of the level, max(1, width / 2) by max(1, height / 2),
+ *         to be freed by the caller
+ */
+uint8_t *downsample_color(const uint8_t *texels, int32_t width,
+                          int32_t height) {
+  int32_t mip_width = width > 1 ? width / 2 : 1;
+  int32_t mip_height = height > 1 ? height / 2 : 1;
+  uint8_t *mip = malloc(mip_width * mip_height * 3);
+  for (int32_t y = 0; y < mip_height; ++y) {
+    int32_t y0 = y * 2 < height ? y * 2 : height - 1;
+    int32_t y1 = y * 2 + 1 < height ? y * 2 + 1 : height - 1;
+    for (int32_t x = 0; x < mip_width; ++x) {
+      int32_t x0 = x * 2 < width ? x * 2 : width - 1;
+      int32_t x1 = x * 2 + 1 < width ? x * 2 + 1 : width - 1;
+      for (int32_t channel = 0; channel < 3; ++channel) {
+        int32_t sum = texels[(y0 * width + x0) * 3 + channel] +
+                      texels[(y0 * width + x1) * 3 + channel] +
+                      texels[(y1 * width + x0) * 3 + channel] +
+                      texels[(y1 * width + x1) * 3 + channel];
+        mip[(y * mip_width + x) * 3 + channel] = (uint8_t)((sum + 2) / 4);
+      }
+    }
+  }
+  return mip;
+}
@@ -7,3 +7,5 @@ void wrap_coordinates(struct ImageBuffer *, int *x, int *y);
 unsigned char get_image_grey(struct ImageBuffer *, int x, int y);
 struct Color get_image_color(struct ImageBuffer *, int x, int y); 
 int clamp_i(int position, int min, int max);       
+uint8_t *downsample_color(const uint8_t *texels, int32_t width,
+                          int32_t height);
@@ -0,0 +1,177 @@
+#include "mesh_generation.h"
+#include "assert.h"
+#include "file.h"
+#include "image.h"
+#include "platform.h"
+#include "shader.h"
+#include <stdlib.h>
+
+#define GENERATE_WORK_GROUP_SIZE 64
+#define REGULAR_CLUSTER_COUNT                                                  \
+  (MAP_SECTION_COUNT * LOD_COUNT * SECTION_CLUSTER_COUNT)
+
+// Runs once per map while loading, before the first frame, so it calls GL
+// directly instead of going through gl_state.c
+
+int32_t create_mesh_generator(struct MeshGenerator *generator) {
+  char *compute_source = read_file("src/shaders/generate_mesh.comp");
+  assert(compute_source != NULL);
+  generator->shader = create_compute_shader(compute_source);
+  free(compute_source);
+  if (!generator->shader) {
+    return GAME_ERROR;
+  }
+
+  GLuint shader = generator->shader;
+  generator->uniforms.grid_size = glGetUniformLocation(shader, "gridSize");
+  generator->uniforms.section_size =
+      glGetUniformLocation(shader, "sectionSize");
+  generator->uniforms.vertex_spacing =
+      glGetUniformLocation(shader, "vertexSpacing");
+  generator->uniforms.vertex_count =
+      glGetUniformLocation(shader, "vertexCount");
+  generator->uniforms.cluster_count =
+      glGetUniformLocation(shader, "clusterCount");
+  generator->uniforms.generate_indices =
+      glGetUniformLocation(shader, "generateIndices");
+  glUseProgram(shader);
+  glUniform1i(glGetUniformLocation(shader, "heights"), 0);
+  glUseProgram(0);
+  return GAME_SUCCESS;
+}
+
+void free_mesh_generator(struct MeshGenerator *generator) {
+  if (generator->shader) {
+    glDeleteProgram(generator->shader);
+    generator->shader = 0;
+  }
+}
+
+static GLuint create_height_texture(struct ImageBuffer *height_map) {
+  uint8_t *heights = malloc(height_map->width * height_map->height);
+  for (int32_t y = 0; y < height_map->height; ++y) {
+    for (int32_t x = 0; x < height_map->width; ++x) {
+      heights[y * height_map->width + x] = get_image_grey(height_map, x, y);
+    }
+  }
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, height_map->width, height_map->height,
+               0, GL_RED, GL_UNSIGNED_BYTE, heights);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  free(heights);
+  return texture;
+}
+
+/*!
+ * Copies the bounds the GPU found into the map's regular clusters.
+ *
+ * @return GAME_ERROR when the buffer could not be read or a cluster got a
+ *         different number of indices than the CPU made room for
+ */
+static int32_t read_cluster_bounds(GLuint cluster_buffer,
+                                   struct MeshCluster *clusters) {
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_buffer);
+  struct GpuMeshCluster *gpu_clusters = glMapBufferRange(
+      GL_SHADER_STORAGE_BUFFER, 0,
+      REGULAR_CLUSTER_COUNT * sizeof(struct GpuMeshCluster), GL_MAP_READ_BIT);
+  if (gpu_clusters == NULL) {
+    error("Could not map generated clusters: %d\n", glGetError());
+    return GAME_ERROR;
+  }
+
+  int32_t num_mismatches = 0;
+  for (int32_t i = 0; i < REGULAR_CLUSTER_COUNT; ++i) {
+    struct MeshCluster *cluster = &clusters[i];
+    struct GpuMeshCluster *gpu_cluster = &gpu_clusters[i];
+    glm_vec3_copy(gpu_cluster->center_radius, cluster->center);
+    cluster->radius = gpu_cluster->center_radius[3];
+    glm_vec3_copy(gpu_cluster->cone_axis_cutoff, cluster->cone_axis);
+    cluster->cone_cutoff = gpu_cluster->cone_axis_cutoff[3];
+    if ((int32_t)gpu_cluster->num_indices != cluster->mesh.num_indices) {
+      ++num_mismatches;
+    }
+  }
+  glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+  if (num_mismatches > 0) {
+    error("%d generated clusters have the wrong number of indices\n",
+          num_mismatches);
+    return GAME_ERROR;
+  }
+  return GAME_SUCCESS;
+}
+
+/*!
+ * Fills a map's vertex blocks, morph targets and the indices of its regular
+ * LOD clusters from its height map, and finds the bounds of those clusters.
+ * The map's buffers must already be allocated, with the regular clusters'
+ * index range cleared to zero, and every regular cluster's mesh must have its
+ * offset and number of indices set.
+ *
+ * @param[in]  generator
+ * @param[in]  map
+ * @param[in]  num_block_vertices In map_vbo and map_vbo_morph_targets
+ * @return GAME_ERROR when the result could not be read back
+ */
+int32_t generate_map_mesh(struct MeshGenerator *generator, struct Map *map,
+                          int32_t num_block_vertices) {
+  int32_t grid_width = map->height_map.width + 1;
+  int32_t grid_height = map->height_map.height + 1;
+
+  struct GpuMeshCluster *gpu_clusters =
+      calloc(REGULAR_CLUSTER_COUNT, sizeof(struct GpuMeshCluster));
+  for (int32_t i = 0; i < REGULAR_CLUSTER_COUNT; ++i) {
+    gpu_clusters[i].offset = map->clusters[i].mesh.offset;
+  }
+  GLuint cluster_buffer;
+  glGenBuffers(1, &cluster_buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               REGULAR_CLUSTER_COUNT * sizeof(struct GpuMeshCluster),
+               gpu_clusters, GL_STREAM_READ);
+  free(gpu_clusters);
+
+  GLuint height_texture = create_height_texture(&map->height_map);
+
+  glUseProgram(generator->shader);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, map->map_vbo);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, map->map_vbo_morph_targets);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, map->map_vbo_indices);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, cluster_buffer);
+
+  struct MeshGeneratorUniforms *uniforms = &generator->uniforms;
+  glUniform2i(uniforms->grid_size, grid_width, grid_height);
+  glUniform2i(uniforms->section_size, grid_width / MAP_X_SEGMENTS,
+              grid_height / MAP_Y_SEGMENTS);
+  glUniform1f(uniforms->vertex_spacing, map->modifier);
+  glUniform1ui(uniforms->vertex_count, num_block_vertices);
+  glUniform1ui(uniforms->cluster_count, REGULAR_CLUSTER_COUNT);
+
+  glUniform1i(uniforms->generate_indices, GL_FALSE);
+  glDispatchCompute((num_block_vertices + GENERATE_WORK_GROUP_SIZE - 1) /
+                        GENERATE_WORK_GROUP_SIZE,
+                    1, 1);
+  glUniform1i(uniforms->generate_indices, GL_TRUE);
+  glDispatchCompute((REGULAR_CLUSTER_COUNT + GENERATE_WORK_GROUP_SIZE - 1) /
+                        GENERATE_WORK_GROUP_SIZE,
+                    1, 1);
+  glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                  GL_ELEMENT_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+  int32_t result = read_cluster_bounds(cluster_buffer, map->clusters);
+
+  for (GLuint i = 0; i < 4; ++i) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+  }
+  glUseProgram(0);
+  glDeleteTextures(1, &height_texture);
+  glDeleteBuffers(1, &cluster_buffer);
+  return result;
+}
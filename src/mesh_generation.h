@@ -0,0 +1,7 @@
+#pragma once
+#include "types.h"
+
+int32_t create_mesh_generator(struct MeshGenerator *generator);
+void free_mesh_generator(struct MeshGenerator *generator);
+int32_t generate_map_mesh(struct MeshGenerator *generator, struct Map *map,
+                          int32_t num_block_vertices);
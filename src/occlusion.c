@@ -0,0 +1,156 @@
+#include "occlusion.h"
+#include "math.h"
+
+// Bins are indexed by a pseudo angle in [0, 4) rather than the true angle,
+// which avoids calling atan2 for every box corner. The mapping is monotonic,
+// so the angular extent of a box is still given by its corners.
+#define PSEUDO_ANGLE_RANGE 4.0f
+#define BINS_PER_PSEUDO_ANGLE (HORIZON_BIN_COUNT / PSEUDO_ANGLE_RANGE)
+
+struct AzimuthSpan {
+  float begin;
+  float end;
+  float min_distance;
+  float max_distance;
+};
+
+inline static float get_pseudo_angle(float x, float z) {
+  if (z >= 0.0f) {
+    return x >= 0.0f ? z / (x + z) : 1.0f - x / (-x + z);
+  } else {
+    return x < 0.0f ? 2.0f - z / (-x - z) : 3.0f + x / (x - z);
+  }
+}
+
+inline static float wrap_pseudo_angle(float angle) {
+  if (angle >= PSEUDO_ANGLE_RANGE * 0.5f) {
+    return angle - PSEUDO_ANGLE_RANGE;
+  } else if (angle < -PSEUDO_ANGLE_RANGE * 0.5f) {
+    return angle + PSEUDO_ANGLE_RANGE;
+  }
+  return angle;
+}
+
+inline static int32_t wrap_bin(int32_t bin) {
+  return bin & (HORIZON_BIN_COUNT - 1);
+}
+
+/*!
+ * Computes the range of azimuth bins covered by the footprint of a box, as
+ * seen from the eye.
+ *
+ * @param[in]  horizon
+ * @param[in]  box_min
+ * @param[in]  box_max
+ * @param[out] out
+ * @return false if the eye is inside the footprint of the box
+ */
+static bool get_azimuth_span(struct HorizonBuffer *horizon, vec3 box_min,
+                             vec3 box_max, struct AzimuthSpan *out) {
+  float min_x = box_min[0] - horizon->eye[0];
+  float max_x = box_max[0] - horizon->eye[0];
+  float min_z = box_min[2] - horizon->eye[2];
+  float max_z = box_max[2] - horizon->eye[2];
+  if (min_x <= 0.0f && max_x >= 0.0f && min_z <= 0.0f && max_z >= 0.0f) {
+    return false;
+  }
+
+  float nearest_x = min_x > 0.0f ? min_x : (max_x < 0.0f ? max_x : 0.0f);
+  float nearest_z = min_z > 0.0f ? min_z : (max_z < 0.0f ? max_z : 0.0f);
+  float farthest_x = fmaxf(fabsf(min_x), fabsf(max_x));
+  float farthest_z = fmaxf(fabsf(min_z), fabsf(max_z));
+  out->min_distance = sqrtf(nearest_x * nearest_x + nearest_z * nearest_z);
+  out->max_distance = sqrtf(farthest_x * farthest_x + farthest_z * farthest_z);
+
+  // The footprint does not contain the eye, so it spans less than half a
+  // turn. Measure the corners relative to the center so the span never
+  // straddles the wrap around point.
+  float center = get_pseudo_angle((min_x + max_x) * 0.5f,
+                                  (min_z + max_z) * 0.5f);
+  float corners[4][2] = {
+      {min_x, min_z}, {max_x, min_z}, {min_x, max_z}, {max_x, max_z}};
+  float lowest = 0.0f;
+  float highest = 0.0f;
+  for (int32_t i = 0; i < 4; ++i) {
+    float delta = wrap_pseudo_angle(
+        get_pseudo_angle(corners[i][0], corners[i][1]) - center);
+    lowest = fminf(lowest, delta);
+    highest = fmaxf(highest, delta);
+  }
+
+  out->begin = (center + lowest) * BINS_PER_PSEUDO_ANGLE;
+  out->end = (center + highest) * BINS_PER_PSEUDO_ANGLE;
+  return true;
+}
+
+void clear_horizon(struct HorizonBuffer *horizon, vec3 eye) {
+  glm_vec3_copy(eye, horizon->eye);
+  for (int32_t i = 0; i < HORIZON_BIN_COUNT; ++i) {
+    horizon->slopes[i] = -INFINITY;
+    horizon->distances[i] = INFINITY;
+  }
+}
+
+/*!
+ * Tests if everything inside the box lies beneath the horizon, in every bin
+ * the box touches. The box may only be hidden by terrain that is closer to the
+ * eye than any part of the box.
+ *
+ * @param[in]  horizon
+ * @param[in]  box_min
+ * @param[in]  box_max
+ */
+bool is_box_below_horizon(struct HorizonBuffer *horizon, vec3 box_min,
+                          vec3 box_max) {
+  struct AzimuthSpan span;
+  if (!get_azimuth_span(horizon, box_min, box_max, &span) ||
+      span.min_distance <= 0.0f) {
+    return false;
+  }
+
+  float rise = box_max[1] - horizon->eye[1];
+  float max_slope =
+      rise / (rise >= 0.0f ? span.min_distance : span.max_distance);
+
+  int32_t first_bin = (int32_t)floorf(span.begin);
+  int32_t last_bin = (int32_t)floorf(span.end);
+  for (int32_t i = first_bin; i <= last_bin; ++i) {
+    int32_t bin = wrap_bin(i);
+    if (horizon->slopes[bin] < max_slope ||
+        horizon->distances[bin] > span.min_distance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*!
+ * Raises the horizon with a box that is solid up to its min height. Only bins
+ * that lie entirely within the box's footprint are updated.
+ *
+ * @param[in]  horizon
+ * @param[in]  box_min
+ * @param[in]  box_max
+ */
+void add_box_to_horizon(struct HorizonBuffer *horizon, vec3 box_min,
+                        vec3 box_max) {
+  struct AzimuthSpan span;
+  if (!get_azimuth_span(horizon, box_min, box_max, &span) ||
+      span.min_distance <= 0.0f) {
+    return;
+  }
+
+  float rise = box_min[1] - horizon->eye[1];
+  float min_slope =
+      rise / (rise >= 0.0f ? span.max_distance : span.min_distance);
+
+  int32_t first_bin = (int32_t)ceilf(span.begin);
+  int32_t last_bin = (int32_t)floorf(span.end) - 1;
+  for (int32_t i = first_bin; i <= last_bin; ++i) {
+    int32_t bin = wrap_bin(i);
+    if (min_slope > horizon->slopes[bin]) {
+      horizon->slopes[bin] = min_slope;
+      horizon->distances[bin] = span.max_distance;
+    }
+  }
+}
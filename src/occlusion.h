@@ -0,0 +1,8 @@
+#pragma once
+#include "types.h"
+
+void clear_horizon(struct HorizonBuffer *horizon, vec3 eye);
+bool is_box_below_horizon(struct HorizonBuffer *horizon, vec3 box_min,
+                          vec3 box_max);
+void add_box_to_horizon(struct HorizonBuffer *horizon, vec3 box_min,
+                        vec3 box_max);
@@ -1,4 +1,27 @@
 #pragma once
+#include "stdbool.h"
+#include "stdint.h"
 
 int info(const char *message, ...);
 int error(const char *message, ...);
+
+// Threads and semaphores, implemented by each platform layer
+struct PlatformThread;
+struct PlatformSemaphore;
+
+typedef int (*PlatformThreadFunction)(void *data);
+
+struct PlatformThread *create_thread(PlatformThreadFunction function,
+                                     const char *name, void *data);
+void join_thread(struct PlatformThread *thread);
+
+struct PlatformSemaphore *create_semaphore(uint32_t initial_value);
+void destroy_semaphore(struct PlatformSemaphore *semaphore);
+void wait_semaphore(struct PlatformSemaphore *semaphore);
+// Takes the semaphore only when that doesn't block, returns whether it did
+bool try_wait_semaphore(struct PlatformSemaphore *semaphore);
+void post_semaphore(struct PlatformSemaphore *semaphore);
+
+int32_t get_processor_count(void);
+// Monotonic wall clock time, for timing work spread over threads
+double get_time_seconds(void);
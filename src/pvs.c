@@ -0,0 +1,87 @@
+#include "pvs.h"
+#include "file.h"
+#include "image.h"
+#include "math.h"
+#include "platform.h"
+#include "string.h"
+#include <stdlib.h>
+
+/*!
+ * Loads the PVS baked for a height map. A missing file is not an error, the
+ * map is then drawn without a PVS.
+ *
+ * @param[out] pvs
+ * @param[in]  filename
+ */
+int32_t load_pvs(struct Pvs *pvs, const char *filename) {
+  memset(pvs, 0, sizeof(*pvs));
+  if (!file_exists(filename)) {
+    info("No PVS found at %s\n", filename);
+    return GAME_SUCCESS;
+  }
+
+  uint8_t *data = NULL;
+  uint32_t size = read_binary_file(filename, &data);
+  if (size < sizeof(struct PvsFileHeader)) {
+    error("Malformed PVS %s\n", filename);
+    free(data);
+    return GAME_ERROR;
+  }
+
+  struct PvsFileHeader *header = &pvs->header;
+  memcpy(header, data, sizeof(*header));
+  uint32_t expected_size =
+      sizeof(*header) +
+      header->num_bands * header->cells_y * header->cells_x * PVS_ROW_BYTES;
+  if (header->magic != PVS_MAGIC || header->tile_radius != PVS_TILE_RADIUS ||
+      header->sections_per_tile != MAP_SECTION_COUNT ||
+      header->band_height <= 0.0f || size != expected_size) {
+    error("Malformed PVS %s. Expected %d bytes but file was %d bytes.\n",
+          filename, expected_size, size);
+    free(data);
+    return GAME_ERROR;
+  }
+
+  pvs->data = data;
+  pvs->rows = &data[sizeof(*header)];
+  return GAME_SUCCESS;
+}
+
+void free_pvs(struct Pvs *pvs) {
+  if (pvs->data != NULL) {
+    free(pvs->data);
+    pvs->data = NULL;
+    pvs->rows = NULL;
+  }
+}
+
+/*!
+ * Finds the sections that can be seen from the camera's cell and height band.
+ *
+ * @param[in]  pvs
+ * @param[in]  camera_position In terrain units
+ * @param[in]  map_size        Width of one world tile in terrain units
+ * @return the row to test with is_in_pvs, or NULL if every section has to be
+ *         considered
+ */
+const uint8_t *get_pvs_row(struct Pvs *pvs, vec3 camera_position,
+                           float map_size) {
+  if (pvs->rows == NULL) {
+    return NULL;
+  }
+
+  struct PvsFileHeader *header = &pvs->header;
+  int32_t band = (int32_t)floorf(camera_position[1] / header->band_height);
+  if (band >= (int32_t)header->num_bands) {
+    return NULL;
+  }
+  band = band < 0 ? 0 : band;
+
+  int32_t cell_x = (int32_t)(camera_position[0] / map_size * header->cells_x);
+  int32_t cell_y = (int32_t)(camera_position[2] / map_size * header->cells_y);
+  cell_x = clamp_i(cell_x, 0, header->cells_x - 1);
+  cell_y = clamp_i(cell_y, 0, header->cells_y - 1);
+
+  uint32_t row = (band * header->cells_y + cell_y) * header->cells_x + cell_x;
+  return &pvs->rows[row * PVS_ROW_BYTES];
+}
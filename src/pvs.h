@@ -0,0 +1,15 @@
+#pragma once
+#include "types.h"
+
+int32_t load_pvs(struct Pvs *pvs, const char *filename);
+void free_pvs(struct Pvs *pvs);
+const uint8_t *get_pvs_row(struct Pvs *pvs, vec3 camera_position,
+                           float map_size);
+
+inline static bool is_in_pvs(const uint8_t *row, int32_t map_x, int32_t map_y,
+                             uint32_t section_index) {
+  uint32_t tile = (map_x + PVS_TILE_RADIUS) * PVS_TILES_PER_SIDE +
+                  (map_y + PVS_TILE_RADIUS);
+  uint32_t bit = tile * PVS_SECTIONS_PER_TILE + section_index;
+  return (row[bit / 8] >> (bit % 8)) & 1;
+}
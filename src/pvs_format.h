@@ -0,0 +1,34 @@
+#pragma once
+#include "stdint.h"
+
+// Potentially visible set baked offline by pvs_baker, stored next to the
+// height map as <height map>.pvs. Kept free of GL and cglm so the baker can
+// include it.
+
+#define PVS_MAGIC 0x31535650 // "PVS1"
+
+// World tiles on each side of the camera's tile, matches the tiled world
+#define PVS_TILE_RADIUS 3
+#define PVS_TILES_PER_SIDE (PVS_TILE_RADIUS * 2 + 1)
+#define PVS_SECTIONS_PER_SIDE 4
+#define PVS_SECTIONS_PER_TILE (PVS_SECTIONS_PER_SIDE * PVS_SECTIONS_PER_SIDE)
+#define PVS_ROW_BITS                                                           \
+  (PVS_TILES_PER_SIDE * PVS_TILES_PER_SIDE * PVS_SECTIONS_PER_TILE)
+#define PVS_ROW_BYTES ((PVS_ROW_BITS + 7) / 8)
+
+// The file is this header followed by num_bands * cells_y * cells_x rows of
+// PVS_ROW_BYTES, band major. Bit
+// ((tile_x + PVS_TILE_RADIUS) * PVS_TILES_PER_SIDE + tile_y + PVS_TILE_RADIUS)
+// * PVS_SECTIONS_PER_TILE + section of a row is set when the baker found that
+// section visible from the cell, at eye heights up to the top of the band. See
+// cast_horizon in pvs_baker for what it samples.
+struct PvsFileHeader {
+  uint32_t magic;
+  uint32_t cells_x;
+  uint32_t cells_y;
+  uint32_t num_bands;
+  // Eye heights covered by each band, in height map units
+  float band_height;
+  uint32_t tile_radius;
+  uint32_t sections_per_tile;
+};
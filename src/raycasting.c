@@ -1,6 +1,7 @@
 #include "assert.h"
 #include "image.h"
 #include "math.h"
+#include "platform.h"
 #include "stdio.h"
 #include "types.h"
 
@@ -23,21 +24,27 @@ void render_vertical_line(struct FrameBuffer *frame, int x, int y_start,
                           int y_end, struct Color color) {
   x = clamp_i(x, 0, frame->width - 1);
   y_start = clamp_i(y_start, 0, frame->height - 1);
-  y_end = clamp_i(y_end, 0, frame->height - 1);
+  // Exclusive, so a line can reach the last row
+  y_end = clamp_i(y_end, 0, frame->height);
 
-  assert(y_end >= 0 && y_end < frame->height);
+  assert(y_end >= 0 && y_end <= frame->height);
 
   for (int y = y_start; y < y_end; ++y) {
     put_pixel(frame, color, x, y);
   }
 }
 
+/*!
+ * Raycasts the terrain into the columns of frame between clip_left_x and
+ * clip_right_x. Only those columns of y_buffer are touched, so bands of columns
+ * can be rendered on different threads.
+ */
 void render(struct FrameBuffer *frame, struct ImageBuffer *color_map,
             struct ImageBuffer *height_map, struct Camera *camera) {
   float cosphi = cos(camera->pitch);
   float sinphi = sin(camera->pitch);
 
-  for (int i = 0; i < frame->width; ++i) {
+  for (int i = frame->clip_left_x; i < frame->clip_right_x; ++i) {
     frame->y_buffer[i] = frame->height;
   }
 
@@ -76,3 +83,180 @@ void render(struct FrameBuffer *frame, struct ImageBuffer *color_map,
     delta_z += 0.005f;
   }
 }
+
+static int32_t wrap_texel(float position, float tile_size, int32_t size) {
+  float local = fmodf(position, tile_size);
+  if (local < 0.0f) {
+    local += tile_size;
+  }
+  return clamp_i((int32_t)(local * size / BASE_MAP_SIZE), 0, size - 1);
+}
+
+/*!
+ * Raycasts the terrain around panorama->eye into the columns of frame between
+ * clip_left_x and clip_right_x. Column x looks along the angle 2 * pi * (x +
+ * 0.5) / width around the y axis, from +x towards +z, and rows are spaced
+ * evenly in the tangent of the elevation, from tan_top down to tan_bottom.
+ * Colors are premultiplied by their alpha, which fades to 0 through the fog
+ * and is 0 where no terrain is hit.
+ *
+ * @param[out] frame
+ * @param[in]  color_map  Covers the map's tile, like height_map
+ * @param[in]  height_map
+ * @param[in]  panorama
+ */
+void render_panorama(struct FrameBuffer *frame, struct ImageBuffer *color_map,
+                     struct ImageBuffer *height_map,
+                     struct PanoramaCamera *panorama) {
+  float rows_per_tan =
+      frame->height / (panorama->tan_top - panorama->tan_bottom);
+  // Steps grow with the distance so that they stay about a column wide
+  float step_scale = 2.0f * (float)M_PI / frame->width;
+  float fog_range = panorama->fog_max - panorama->fog_min;
+
+  for (int32_t x = frame->clip_left_x; x < frame->clip_right_x; ++x) {
+    for (int32_t y = 0; y < frame->height; ++y) {
+      put_pixel(frame, (struct Color){0, 0, 0, 0}, x, y);
+    }
+    frame->y_buffer[x] = frame->height;
+
+    float angle = 2.0f * (float)M_PI * (x + 0.5f) / frame->width;
+    float direction_x = cosf(angle);
+    float direction_z = sinf(angle);
+    for (float z = panorama->near; z < panorama->far; z += z * step_scale) {
+      float world_x = panorama->eye[0] + direction_x * z;
+      float world_z = panorama->eye[2] + direction_z * z;
+      int32_t height = get_image_grey(
+          height_map,
+          wrap_texel(world_x, panorama->tile_size, height_map->width),
+          wrap_texel(world_z, panorama->tile_size, height_map->height));
+      float tan_elevation = (height - panorama->eye[1]) / z;
+      int32_t row =
+          (int32_t)((panorama->tan_top - tan_elevation) * rows_per_tan);
+
+      int32_t y_start = frame->y_buffer[x];
+      if (row >= y_start) {
+        continue;
+      }
+
+      struct Color color = get_image_color(
+          color_map, wrap_texel(world_x, panorama->tile_size, color_map->width),
+          wrap_texel(world_z, panorama->tile_size, color_map->height));
+      float fog = fog_range > 0.0f ? (z - panorama->fog_min) / fog_range : 0.0f;
+      float alpha = 1.0f - fminf(fmaxf(fog, 0.0f), 1.0f);
+      color.r = (uint8_t)(color.r * alpha);
+      color.g = (uint8_t)(color.g * alpha);
+      color.b = (uint8_t)(color.b * alpha);
+      color.a = (uint8_t)(255.0f * alpha);
+      render_vertical_line(frame, x, row, y_start, color);
+      frame->y_buffer[x] = row < 0 ? 0 : row;
+      if (row <= 0) {
+        break;
+      }
+    }
+  }
+}
+
+static void raycast_band(struct RaycastPool *pool, int32_t band) {
+  struct RaycastJob *job = &pool->job;
+  struct FrameBuffer frame = *job->frame;
+  // Contiguous bands, so that threads don't share the cache lines of y_buffer
+  // and of most rows
+  int32_t left = job->frame->clip_left_x;
+  int32_t width = job->frame->clip_right_x - left;
+  frame.clip_left_x = left + width * band / pool->thread_count;
+  frame.clip_right_x = left + width * (band + 1) / pool->thread_count;
+  if (job->panorama != NULL) {
+    render_panorama(&frame, job->color_map, job->height_map, job->panorama);
+  } else {
+    render(&frame, job->color_map, job->height_map, job->camera);
+  }
+}
+
+static int run_raycast_worker(void *data) {
+  struct RaycastWorker *worker = data;
+  struct RaycastPool *pool = worker->pool;
+  for (;;) {
+    wait_semaphore(worker->work_ready);
+    if (pool->quit) {
+      break;
+    }
+
+    raycast_band(pool, worker->band);
+    post_semaphore(pool->work_done);
+  }
+
+  return 0;
+}
+
+/*!
+ * Starts the workers of a pool. The pool must not move while they run.
+ *
+ * @param[out] pool
+ * @param[in]  thread_count Including the thread calling raycast_in_bands,
+ *                          clamped to 1..RAYCAST_MAX_THREADS
+ */
+int32_t create_raycast_pool(struct RaycastPool *pool, int32_t thread_count) {
+  pool->thread_count = 1;
+  pool->quit = false;
+  pool->work_done = create_semaphore(0);
+  if (pool->work_done == NULL) {
+    error("Could not create raycast pool semaphore\n");
+    return GAME_ERROR;
+  }
+
+  thread_count = clamp_i(thread_count, 1, RAYCAST_MAX_THREADS);
+  for (int32_t i = 1; i < thread_count; ++i) {
+    struct RaycastWorker *worker = &pool->workers[i - 1];
+    worker->pool = pool;
+    worker->band = i;
+    worker->work_ready = create_semaphore(0);
+    if (worker->work_ready == NULL) {
+      error("Could not create raycast worker semaphore\n");
+      return GAME_ERROR;
+    }
+
+    worker->thread = create_thread(run_raycast_worker, "raycast", worker);
+    if (worker->thread == NULL) {
+      destroy_semaphore(worker->work_ready);
+      return GAME_ERROR;
+    }
+    pool->thread_count = i + 1;
+  }
+
+  return GAME_SUCCESS;
+}
+
+void free_raycast_pool(struct RaycastPool *pool) {
+  pool->quit = true;
+  for (int32_t i = 0; i < pool->thread_count - 1; ++i) {
+    struct RaycastWorker *worker = &pool->workers[i];
+    post_semaphore(worker->work_ready);
+    join_thread(worker->thread);
+    destroy_semaphore(worker->work_ready);
+  }
+  pool->thread_count = 0;
+
+  if (pool->work_done != NULL) {
+    destroy_semaphore(pool->work_done);
+    pool->work_done = NULL;
+  }
+}
+
+/*!
+ * Raycasts a job's columns a band per thread of the pool, and returns once
+ * every band is done. The calling thread renders the first band.
+ */
+void raycast_in_bands(struct RaycastPool *pool, struct RaycastJob *job) {
+  assert(pool->thread_count >= 1);
+  pool->job = *job;
+  for (int32_t i = 0; i < pool->thread_count - 1; ++i) {
+    post_semaphore(pool->workers[i].work_ready);
+  }
+
+  raycast_band(pool, 0);
+
+  for (int32_t i = 0; i < pool->thread_count - 1; ++i) {
+    wait_semaphore(pool->work_done);
+  }
+}
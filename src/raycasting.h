@@ -7,3 +7,9 @@
 void put_pixel(struct FrameBuffer *frame, struct Color color, int x, int y); 
 void render_vertical_line(struct FrameBuffer *frame, int x, int y_start, int y_end, struct Color color); 
 void render(struct FrameBuffer *frame, struct ImageBuffer *color_map, struct ImageBuffer *height_map, struct Camera *camera);
+void render_panorama(struct FrameBuffer *frame, struct ImageBuffer *color_map,
+                     struct ImageBuffer *height_map,
+                     struct PanoramaCamera *panorama);
+int32_t create_raycast_pool(struct RaycastPool *pool, int32_t thread_count);
+void free_raycast_pool(struct RaycastPool *pool);
+void raycast_in_bands(struct RaycastPool *pool, struct RaycastJob *job);
@@ -0,0 +1,156 @@
+#include "ring_buffer.h"
+#include "assert.h"
+#include "gl_state.h"
+#include "platform.h"
+
+// How long to wait for the GPU to release a frame's region before giving up,
+// in nanoseconds
+#define RING_BUFFER_FENCE_TIMEOUT 1000000000ull
+
+/*!
+ * Creates a buffer split into RING_BUFFER_FRAME_COUNT regions, one per frame in
+ * flight. With buffer storage it stays mapped for its whole lifetime,
+ * otherwise each frame's region is mapped unsynchronized while it is written.
+ * Either way fences keep the CPU from writing a region the GPU still reads.
+ *
+ * @param[out] ring
+ * @param[in]  caps
+ * @param[in]  frame_size Bytes needed per frame
+ */
+int32_t create_ring_buffer(struct RingBuffer *ring,
+                           struct GLCapabilities *caps, int32_t frame_size) {
+  ring->frame_size = frame_size;
+  ring->frame_index = 0;
+  ring->frame_offset = 0;
+  ring->mapped = NULL;
+  for (int32_t i = 0; i < RING_BUFFER_FRAME_COUNT; ++i) {
+    ring->fences[i] = NULL;
+  }
+
+  GLsizeiptr size = (GLsizeiptr)frame_size * RING_BUFFER_FRAME_COUNT;
+  glGenBuffers(1, &ring->buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+
+  ring->persistent = caps->buffer_storage;
+  if (ring->persistent) {
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+    ring->mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+    if (ring->mapped == NULL) {
+      error("Could not persistently map ring buffer: %d\n", glGetError());
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+      return GAME_ERROR;
+    }
+  } else {
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  info("Created %s ring buffer of %d bytes per frame\n",
+       ring->persistent ? "persistent" : "unsynchronized", frame_size);
+  return GAME_SUCCESS;
+}
+
+void free_ring_buffer(struct RingBuffer *ring) {
+  for (int32_t i = 0; i < RING_BUFFER_FRAME_COUNT; ++i) {
+    if (ring->fences[i] != NULL) {
+      glDeleteSync(ring->fences[i]);
+      ring->fences[i] = NULL;
+    }
+  }
+
+  if (ring->persistent && ring->mapped != NULL) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+  ring->mapped = NULL;
+  glDeleteBuffers(1, &ring->buffer);
+  ring->buffer = 0;
+}
+
+/*!
+ * Waits until the GPU is done with the current frame's region, then makes it
+ * writable.
+ */
+void begin_ring_buffer_frame(struct RingBuffer *ring) {
+  GLsync fence = ring->fences[ring->frame_index];
+  if (fence != NULL) {
+    GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                     RING_BUFFER_FENCE_TIMEOUT);
+    if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED) {
+      error("Timed out waiting for ring buffer frame %d\n", ring->frame_index);
+    }
+    glDeleteSync(fence);
+    ring->fences[ring->frame_index] = NULL;
+  }
+
+  ring->frame_offset = 0;
+  if (!ring->persistent) {
+    // The fence already guarantees the GPU is done with this region, so the
+    // driver does not need to synchronize or orphan anything
+    bind_buffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+    ring->mapped = glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, ring->frame_index * ring->frame_size,
+        ring->frame_size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+            GL_MAP_UNSYNCHRONIZED_BIT);
+    count_buffer_maps(1);
+    if (ring->mapped == NULL) {
+      error("Could not map ring buffer frame: %d\n", glGetError());
+      assert(ring->mapped != NULL);
+    }
+  }
+}
+
+/*!
+ * Reserves space in the current frame's region.
+ *
+ * @param[in]  ring
+ * @param[in]  size      In bytes
+ * @param[in]  alignment Of the returned offset, in bytes
+ * @param[out] offset    Offset of the allocation from the start of the buffer
+ * @return where to write the allocation, or NULL if the frame is out of space
+ */
+void *allocate_from_ring_buffer(struct RingBuffer *ring, int32_t size,
+                                int32_t alignment, uintptr_t *offset) {
+  int32_t start = (ring->frame_offset + alignment - 1) / alignment * alignment;
+  if (start + size > ring->frame_size) {
+    error("Ring buffer frame out of space, %d bytes requested\n", size);
+    return NULL;
+  }
+
+  ring->frame_offset = start + size;
+  uintptr_t frame_start = (uintptr_t)ring->frame_index * ring->frame_size;
+  *offset = frame_start + start;
+  if (ring->persistent) {
+    return &ring->mapped[frame_start + start];
+  }
+  return &ring->mapped[start];
+}
+
+/*!
+ * Makes the current frame's writes visible to the GPU, has to be called before
+ * drawing with them.
+ */
+void finish_ring_buffer_writes(struct RingBuffer *ring) {
+  if (!ring->persistent && ring->mapped != NULL) {
+    bind_buffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+    if (glUnmapBuffer(GL_COPY_WRITE_BUFFER) != GL_TRUE) {
+      error("Error unmapping ring buffer frame");
+    }
+    ring->mapped = NULL;
+  }
+}
+
+/*!
+ * Marks the end of the GPU commands reading the current frame's region, and
+ * moves on to the next region.
+ */
+void end_ring_buffer_frame(struct RingBuffer *ring) {
+  finish_ring_buffer_writes(ring);
+  ring->fences[ring->frame_index] =
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  ring->frame_index = (ring->frame_index + 1) % RING_BUFFER_FRAME_COUNT;
+}
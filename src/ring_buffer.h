@@ -0,0 +1,11 @@
+#pragma once
+#include "types.h"
+
+int32_t create_ring_buffer(struct RingBuffer *ring,
+                           struct GLCapabilities *caps, int32_t frame_size);
+void free_ring_buffer(struct RingBuffer *ring);
+void begin_ring_buffer_frame(struct RingBuffer *ring);
+void *allocate_from_ring_buffer(struct RingBuffer *ring, int32_t size,
+                                int32_t alignment, uintptr_t *offset);
+void finish_ring_buffer_writes(struct RingBuffer *ring);
+void end_ring_buffer_frame(struct RingBuffer *ring);
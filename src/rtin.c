@@ -0,0 +1,353 @@
+#include "rtin.h"
+#include "assert.h"
+#include "float.h"
+#include "math.h"
+#include <stdlib.h>
+
+// Right triangulated irregular network over a square grid of 2^n + 1
+// vertices. Every triangle of the hierarchy is split at the midpoint of its
+// hypotenuse into two halves. Each midpoint has an error, the largest height
+// difference between the grid and the triangles left if it and its
+// descendants are dropped. A mesh for a maximum error is every triangle whose
+// midpoint error is within it, and is crack free because both triangles
+// sharing a hypotenuse share its midpoint's error.
+//
+// Cells meshed for different maximum errors, like map sections at different
+// LODs, would not meet without cracks. Their edges are stitched instead: the
+// triangles along a cell edge are fanned out to every vertex of that edge in
+// the finest mesh, which neighboring cells share whatever their own error.
+
+// Error of vertices that every mesh includes
+#define RTIN_FORCED_ERROR FLT_MAX
+
+struct RtinMeshBuilder {
+  float *errors;
+  int32_t size;
+  float max_error;
+  // Manhattan length of the shortest legs of triangles that are split
+  int32_t min_split_leg;
+  // Vertices between cell edges, whose triangles are stitched to every edge
+  // vertex with an error above stitch_error
+  int32_t cell_size;
+  float stitch_error;
+  // Triangles are added when their centroid is within these vertices
+  int32_t x0, y0, x1, y1;
+  int32_t *index_buffer;
+  int32_t buffer_size;
+  int32_t num_indices;
+  // Vertices along one side of a triangle, see collect_stitch_vertices
+  int32_t *side_vertices[2];
+};
+
+bool is_rtin_grid_size(int32_t size) {
+  int32_t tile = size - 1;
+  return tile > 1 && (tile & (tile - 1)) == 0;
+}
+
+/*!
+ * Gives vertices on opposite edges of the grid the larger of their errors.
+ * The grid is tiled and its opposite edges are the same vertices, which have
+ * descendants on both sides.
+ */
+static void merge_wrapped_errors(float *errors, int32_t size) {
+  int32_t last = size - 1;
+  for (int32_t i = 0; i < size; ++i) {
+    float *left = &errors[i * size];
+    float *right = &errors[i * size + last];
+    *left = *right = fmaxf(*left, *right);
+  }
+  for (int32_t i = 0; i < size; ++i) {
+    float *top = &errors[i];
+    float *bottom = &errors[last * size + i];
+    *top = *bottom = fmaxf(*top, *bottom);
+  }
+}
+
+static float get_interpolation_error(V3 *vertices, int32_t size, int32_t x,
+                                     int32_t y, int32_t x0, int32_t y0,
+                                     int32_t x1, int32_t y1) {
+  float interpolated =
+      (vertices[y0 * size + x0][1] + vertices[y1 * size + x1][1]) / 2.0f;
+  return fabsf(interpolated - vertices[y * size + x][1]);
+}
+
+/*!
+ * Raises each midpoint's error to its own interpolation error and the errors
+ * of its descendants, from the smallest triangles up. Triangles come in two
+ * kinds at each scale. Halves of aligned squares of size s have the square's
+ * center as midpoint, and are split along the diagonal pointing at the center
+ * of the square twice their size. Quarters of those squares have an edge of
+ * the square as hypotenuse.
+ */
+static void propagate_rtin_errors(float *errors, V3 *vertices, int32_t size,
+                                  int32_t split_size) {
+  int32_t tile = size - 1;
+  for (int32_t s = 2; s <= tile; s *= 2) {
+    int32_t h = s / 2;
+    // Triangles reaching across split lines are always split, so that every
+    // triangle of a mesh is within one square between them
+    bool is_forced = s > split_size;
+
+    // Midpoints of the squares' edges, shared by the two triangles on either
+    // side. Their children's midpoints are the centers of the squares of half
+    // the size around them.
+    for (int32_t y = 0; y <= tile; y += h) {
+      bool is_horizontal = y % s == 0;
+      for (int32_t x = is_horizontal ? h : 0; x <= tile; x += s) {
+        float *error = &errors[y * size + x];
+        if (is_horizontal) {
+          *error = fmaxf(*error, get_interpolation_error(vertices, size, x, y,
+                                                         x - h, y, x + h, y));
+        } else {
+          *error = fmaxf(*error, get_interpolation_error(vertices, size, x, y,
+                                                         x, y - h, x, y + h));
+        }
+        if (is_forced) {
+          *error = RTIN_FORCED_ERROR;
+        }
+
+        int32_t q = h / 2;
+        for (int32_t i = 0; q > 0 && i < 4; ++i) {
+          int32_t child_x = x + ((i & 1) ? q : -q);
+          int32_t child_y = y + ((i & 2) ? q : -q);
+          if (child_x >= 0 && child_x <= tile && child_y >= 0 &&
+              child_y <= tile) {
+            *error = fmaxf(*error, errors[child_y * size + child_x]);
+          }
+        }
+      }
+    }
+    merge_wrapped_errors(errors, size);
+
+    // Centers of the squares, whose children's midpoints are the midpoints of
+    // the square's edges
+    for (int32_t y = h; y < tile; y += s) {
+      for (int32_t x = h; x < tile; x += s) {
+        float *error = &errors[y * size + x];
+        bool is_main_diagonal = ((x / s) + (y / s)) % 2 == 0;
+        if (is_main_diagonal) {
+          *error = fmaxf(*error, get_interpolation_error(vertices, size, x, y,
+                                                         x - h, y - h, x + h,
+                                                         y + h));
+        } else {
+          *error = fmaxf(*error, get_interpolation_error(vertices, size, x, y,
+                                                         x + h, y - h, x - h,
+                                                         y + h));
+        }
+        if (is_forced) {
+          *error = RTIN_FORCED_ERROR;
+        }
+
+        *error = fmaxf(*error, fmaxf(errors[y * size + x - h],
+                                     errors[y * size + x + h]));
+        *error = fmaxf(*error, fmaxf(errors[(y - h) * size + x],
+                                     errors[(y + h) * size + x]));
+      }
+    }
+  }
+}
+
+/*!
+ * Computes the error of every vertex of a tiled grid.
+ *
+ * @param[out] errors     One per vertex
+ * @param[in]  vertices   size * size, row major
+ * @param[in]  size       Vertices along each side, 2^n + 1
+ * @param[in]  split_size Vertices between lines that no triangle crosses, a
+ *                        power of two
+ */
+void compute_rtin_errors(float *errors, V3 *vertices, int32_t size,
+                         int32_t split_size) {
+  assert(is_rtin_grid_size(size));
+  for (int32_t i = 0; i < size * size; ++i) {
+    errors[i] = 0.0f;
+  }
+  propagate_rtin_errors(errors, vertices, size, split_size);
+}
+
+static void emit_rtin_triangle(struct RtinMeshBuilder *builder, int32_t a,
+                               int32_t b, int32_t c) {
+  int32_t size = builder->size;
+  int32_t ax = a % size, ay = a / size;
+  int32_t bx = b % size, by = b / size;
+  int32_t cx = c % size, cy = c / size;
+  // Wound like the regular grid, see generate_indices
+  if ((bx - ax) * (cy - ay) - (by - ay) * (cx - ax) > 0) {
+    int32_t swap = b;
+    b = c;
+    c = swap;
+  }
+
+  (void)builder->buffer_size;
+  assert(builder->num_indices + 3 <= builder->buffer_size);
+  int32_t *indices = &builder->index_buffer[builder->num_indices];
+  indices[0] = a;
+  indices[1] = b;
+  indices[2] = c;
+  builder->num_indices += 3;
+}
+
+/*!
+ * Lists the vertices from u to v, both included, that a stitched triangle side
+ * passes through. Sides along cell edges pass through every edge vertex of the
+ * finest mesh, other sides only through their ends.
+ *
+ * @return the number of vertices written to vertices
+ */
+static int32_t collect_stitch_vertices(struct RtinMeshBuilder *builder,
+                                       int32_t ux, int32_t uy, int32_t vx,
+                                       int32_t vy, int32_t *vertices) {
+  int32_t size = builder->size;
+  int32_t cell_size = builder->cell_size;
+  bool is_on_edge = (ux == vx && ux % cell_size == 0) ||
+                    (uy == vy && uy % cell_size == 0);
+  int32_t count = 0;
+  vertices[count++] = uy * size + ux;
+  if (is_on_edge) {
+    int32_t step_x = (vx > ux) - (vx < ux);
+    int32_t step_y = (vy > uy) - (vy < uy);
+    for (int32_t x = ux + step_x, y = uy + step_y; x != vx || y != vy;
+         x += step_x, y += step_y) {
+      if (builder->errors[y * size + x] > builder->stitch_error) {
+        vertices[count++] = y * size + x;
+      }
+    }
+  }
+  vertices[count++] = vy * size + vx;
+  return count;
+}
+
+static void emit_rtin_fan(struct RtinMeshBuilder *builder, int32_t apex,
+                          int32_t *side, int32_t side_count) {
+  for (int32_t i = 0; i + 1 < side_count; ++i) {
+    emit_rtin_triangle(builder, apex, side[i], side[i + 1]);
+  }
+}
+
+/*!
+ * Emits a triangle of the mesh, fanned out to the edge vertices its sides
+ * pass through, see collect_stitch_vertices. Either the hypotenuse or the legs
+ * can be along cell edges, never both.
+ */
+static void emit_stitched_triangle(struct RtinMeshBuilder *builder,
+                                   int32_t ax, int32_t ay, int32_t bx,
+                                   int32_t by, int32_t cx, int32_t cy) {
+  int32_t size = builder->size;
+  int32_t a = ay * size + ax;
+  int32_t b = by * size + bx;
+  int32_t c = cy * size + cx;
+  int32_t *leg_a = builder->side_vertices[0];
+  int32_t *leg_b = builder->side_vertices[1];
+
+  int32_t hypotenuse_count =
+      collect_stitch_vertices(builder, ax, ay, bx, by, leg_a);
+  if (hypotenuse_count > 2) {
+    emit_rtin_fan(builder, c, leg_a, hypotenuse_count);
+    return;
+  }
+
+  int32_t leg_a_count = collect_stitch_vertices(builder, ax, ay, cx, cy, leg_a);
+  int32_t leg_b_count = collect_stitch_vertices(builder, cx, cy, bx, by, leg_b);
+  if (leg_b_count == 2) {
+    emit_rtin_fan(builder, b, leg_a, leg_a_count);
+  } else if (leg_a_count == 2) {
+    emit_rtin_fan(builder, a, leg_b, leg_b_count);
+  } else {
+    // Fanned from a to the leg from c to b, except for the first triangle,
+    // whose side from a to c is fanned from the first vertex after c
+    emit_rtin_fan(builder, leg_b[1], leg_a, leg_a_count);
+    emit_rtin_fan(builder, a, &leg_b[1], leg_b_count - 1);
+  }
+}
+
+static void add_rtin_triangle(struct RtinMeshBuilder *builder, int32_t ax,
+                              int32_t ay, int32_t bx, int32_t by, int32_t cx,
+                              int32_t cy) {
+  int32_t min_x = ax < bx ? ax : bx;
+  int32_t max_x = ax < bx ? bx : ax;
+  int32_t min_y = ay < by ? ay : by;
+  int32_t max_y = ay < by ? by : ay;
+  min_x = cx < min_x ? cx : min_x;
+  max_x = cx > max_x ? cx : max_x;
+  min_y = cy < min_y ? cy : min_y;
+  max_y = cy > max_y ? cy : max_y;
+  if (max_x <= builder->x0 || min_x >= builder->x1 || max_y <= builder->y0 ||
+      min_y >= builder->y1) {
+    return;
+  }
+
+  int32_t size = builder->size;
+  int32_t mx = (ax + bx) >> 1;
+  int32_t my = (ay + by) >> 1;
+  if (abs(ax - cx) + abs(ay - cy) > builder->min_split_leg &&
+      builder->errors[my * size + mx] > builder->max_error) {
+    add_rtin_triangle(builder, cx, cy, ax, ay, mx, my);
+    add_rtin_triangle(builder, bx, by, cx, cy, mx, my);
+    return;
+  }
+
+  // Triangles can overlap several regions, they belong to the one holding
+  // their centroid
+  int32_t centroid_x = ax + bx + cx;
+  int32_t centroid_y = ay + by + cy;
+  if (centroid_x < builder->x0 * 3 || centroid_x >= builder->x1 * 3 ||
+      centroid_y < builder->y0 * 3 || centroid_y >= builder->y1 * 3) {
+    return;
+  }
+
+  emit_stitched_triangle(builder, ax, ay, bx, by, cx, cy);
+}
+
+/*!
+ * Generates the mesh of a region of the grid for a maximum error, with the
+ * edges of the cells it covers stitched to the mesh for stitch_error.
+ *
+ * @param[in]  errors        See compute_rtin_errors
+ * @param[in]  size          Vertices along each side of the grid
+ * @param[in]  max_error     Largest height error of the mesh, wherever its
+ *                           triangles are larger than min_spacing
+ * @param[in]  min_spacing   Vertices between the corners of the smallest
+ *                           triangles, so that the mesh is no finer than a
+ *                           regular grid of that spacing
+ * @param[in]  cell_size     Vertices between cell edges, a power of two at
+ *                           least the split_size of compute_rtin_errors
+ * @param[in]  stitch_error  Maximum error of the finest mesh of any cell,
+ *                           up to max_error
+ * @param[in]  x0            First vertex of the region
+ * @param[in]  y0
+ * @param[in]  x1           Vertex past the region
+ * @param[in]  y1
+ * @param[out] index_buffer
+ * @param[in]  buffer_size
+ * @return the number of indices written
+ */
+int32_t generate_rtin_indices(float *errors, int32_t size, float max_error,
+                              int32_t min_spacing, int32_t cell_size,
+                              float stitch_error, int32_t x0, int32_t y0,
+                              int32_t x1, int32_t y1, int32_t *index_buffer,
+                              int32_t buffer_size) {
+  assert(stitch_error <= max_error);
+  int32_t *side_vertices = malloc(sizeof(int32_t) * 2 * (cell_size + 1));
+  struct RtinMeshBuilder builder = {
+      .errors = errors,
+      .size = size,
+      .max_error = max_error,
+      .min_split_leg = min_spacing,
+      .cell_size = cell_size,
+      .stitch_error = stitch_error,
+      .x0 = x0,
+      .y0 = y0,
+      .x1 = x1,
+      .y1 = y1,
+      .index_buffer = index_buffer,
+      .buffer_size = buffer_size,
+      .num_indices = 0,
+      .side_vertices = {side_vertices, side_vertices + cell_size + 1},
+  };
+
+  int32_t tile = size - 1;
+  add_rtin_triangle(&builder, 0, 0, tile, tile, tile, 0);
+  add_rtin_triangle(&builder, tile, tile, 0, 0, 0, tile);
+  free(side_vertices);
+  return builder.num_indices;
+}
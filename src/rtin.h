@@ -0,0 +1,11 @@
+#pragma once
+#include "types.h"
+
+bool is_rtin_grid_size(int32_t size);
+void compute_rtin_errors(float *errors, V3 *vertices, int32_t size,
+                         int32_t split_size);
+int32_t generate_rtin_indices(float *errors, int32_t size, float max_error,
+                              int32_t min_spacing, int32_t cell_size,
+                              float stitch_error, int32_t x0, int32_t y0,
+                              int32_t x1, int32_t y1, int32_t *index_buffer,
+                              int32_t buffer_size);
@@ -30,14 +30,23 @@ static int32_t check_program_link_errors(uint32_t program) {
   return success;
 }
 
-uint32_t compile_shader(int32_t shader_type, const char *shader_source) {
+uint32_t compile_shader_with_defines(int32_t shader_type, const char *defines,
+                                     const char *shader_source) {
 #ifdef GL_ES_VERSION_3_0
   char *version_line = "#version 310 es\n#define OPENGL_ES\n";
 #else
+  // Compute shaders are only used when the context supports GL 4.3, and
+  // tessellation shaders when it supports GL 4.0
   char *version_line = "#version 330 core\n";
+  if (shader_type == GL_COMPUTE_SHADER) {
+    version_line = "#version 430 core\n";
+  } else if (shader_type == GL_TESS_CONTROL_SHADER ||
+             shader_type == GL_TESS_EVALUATION_SHADER) {
+    version_line = "#version 400 core\n";
+  }
 #endif
 
-  const char *sources[] = {version_line, shader_source};
+  const char *sources[] = {version_line, defines, shader_source};
   uint32_t shader = glCreateShader(shader_type);
 
   glShaderSource(shader, sizeof(sources) / sizeof(sources[0]), sources, NULL);
@@ -49,14 +58,21 @@ uint32_t compile_shader(int32_t shader_type, const char *shader_source) {
   return shader;
 }
 
-uint32_t create_shader(const char *vertex_source, const char *fragment_source) {
-  uint32_t vertex_shader = compile_shader(GL_VERTEX_SHADER, vertex_source);
+uint32_t compile_shader(int32_t shader_type, const char *shader_source) {
+  return compile_shader_with_defines(shader_type, "", shader_source);
+}
+
+uint32_t create_shader_with_defines(const char *defines,
+                                    const char *vertex_source,
+                                    const char *fragment_source) {
+  uint32_t vertex_shader =
+      compile_shader_with_defines(GL_VERTEX_SHADER, defines, vertex_source);
   if (!vertex_shader) {
     return 0;
   }
 
   uint32_t fragment_shader =
-      compile_shader(GL_FRAGMENT_SHADER, fragment_source);
+      compile_shader_with_defines(GL_FRAGMENT_SHADER, defines, fragment_source);
   if (!fragment_shader) {
     return 0;
   }
@@ -75,3 +91,60 @@ uint32_t create_shader(const char *vertex_source, const char *fragment_source) {
 
   return shader_program;
 }
+
+uint32_t create_shader(const char *vertex_source, const char *fragment_source) {
+  return create_shader_with_defines("", vertex_source, fragment_source);
+}
+
+#ifndef GL_ES_VERSION_3_0
+uint32_t create_tessellation_shader(const char *defines,
+                                    const char *vertex_source,
+                                    const char *control_source,
+                                    const char *evaluation_source,
+                                    const char *fragment_source) {
+  const int32_t shader_types[] = {GL_VERTEX_SHADER, GL_TESS_CONTROL_SHADER,
+                                  GL_TESS_EVALUATION_SHADER,
+                                  GL_FRAGMENT_SHADER};
+  const char *sources[] = {vertex_source, control_source, evaluation_source,
+                           fragment_source};
+  const int32_t num_stages = sizeof(sources) / sizeof(sources[0]);
+
+  uint32_t shader_program = glCreateProgram();
+  for (int32_t i = 0; i < num_stages; ++i) {
+    uint32_t shader =
+        compile_shader_with_defines(shader_types[i], defines, sources[i]);
+    if (!shader) {
+      glDeleteProgram(shader_program);
+      return 0;
+    }
+    glAttachShader(shader_program, shader);
+    glDeleteShader(shader);
+  }
+  glLinkProgram(shader_program);
+
+  if (!check_program_link_errors(shader_program)) {
+    return 0;
+  }
+
+  return shader_program;
+}
+#endif
+
+uint32_t create_compute_shader(const char *compute_source) {
+  uint32_t compute_shader = compile_shader(GL_COMPUTE_SHADER, compute_source);
+  if (!compute_shader) {
+    return 0;
+  }
+
+  uint32_t shader_program = glCreateProgram();
+  glAttachShader(shader_program, compute_shader);
+  glLinkProgram(shader_program);
+
+  glDeleteShader(compute_shader);
+
+  if (!check_program_link_errors(shader_program)) {
+    return 0;
+  }
+
+  return shader_program;
+}
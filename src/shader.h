@@ -2,5 +2,15 @@
 #include "stdint.h"
 
 uint32_t compile_shader(int32_t shader_type, const char *shader_source);
+uint32_t compile_shader_with_defines(int32_t shader_type, const char *defines,
+                                     const char *shader_source);
 uint32_t create_shader(const char *vertex_source, const char *fragment_source);
-
+uint32_t create_shader_with_defines(const char *defines,
+                                    const char *vertex_source,
+                                    const char *fragment_source);
+uint32_t create_tessellation_shader(const char *defines,
+                                    const char *vertex_source,
+                                    const char *control_source,
+                                    const char *evaluation_source,
+                                    const char *fragment_source);
+uint32_t create_compute_shader(const char *compute_source);
@@ -0,0 +1,137 @@
+#ifdef OPENGL_ES
+  precision highp float;
+  precision highp int;
+  precision highp sampler2DArray;
+#endif
+
+#if defined(USE_INSTANCED_STEREO)
+  #if defined(USE_STEREO_VIEWPORT_INDEX)
+    #extension GL_ARB_shader_viewport_layer_array : require
+  #endif
+  // With instanced stereo every instance is drawn once per eye
+  #define VIEW_ID ((flags & INSTANCED_STEREO) != 0u ? gl_InstanceID % 2 : 0)
+#elif defined(GL_OVR_multiview2)
+  #extension GL_OVR_multiview2 : enable
+  layout(num_views = 2) in;
+  #define VIEW_ID gl_ViewID_OVR
+#else
+  #define VIEW_ID 0
+#endif
+
+// Vertex of the level's grid, from 0 to GRID_SIZE
+layout (location = 0) in vec2 aPos;
+
+out vec3 Position;
+out vec4 WorldPosition;
+out float CameraDistance;
+
+flat out vec4 BlendColor;
+flat out int ColorLayer;
+
+// Shared by the terrain and hand shaders, see struct FrameUniforms
+layout (std140) uniform FrameUniforms {
+  mat4 projectionViews[2];
+  vec4 fogColor;
+  vec3 cameraPosition;
+  float terrainScale;
+  // Distances in terrain units where fog starts and ends
+  vec2 fogDistances;
+  ivec2 heightMapSize;
+  uint flags;
+  // Distances in terrain units where vertices morph into the next LOD, LOD 0
+  // in xy and LOD 1 in zw
+  vec4 lodMorphRanges;
+};
+
+// Level texel of the grid's first vertex
+uniform ivec2 origin;
+// Terrain units between the level's vertices
+uniform float vertexSpacing;
+uniform int level;
+// Size of the height map in texels
+uniform ivec2 mapSize;
+// Heights of every level in a layer, addressed toroidally
+uniform sampler2DArray heights;
+// Layer of the map in the color map array
+uniform int colorLayer;
+
+// Must match CLIPMAP_GRID_SIZE, CLIPMAP_LEVEL_COUNT, CLIPMAP_TEXTURE_SIZE and
+// CLIPMAP_TRANSITION_WIDTH
+const int GRID_SIZE = 64;
+const int LEVEL_COUNT = 7;
+const int TEXTURE_SIZE = 128;
+const float TRANSITION_WIDTH = 8.0;
+
+const uint VISUALIZE_LOD = 2u;
+const uint INSTANCED_STEREO = 4u;
+
+#if defined(USE_INSTANCED_STEREO)
+// Moves the vertex into its eye's half of the side by side framebuffer
+void placeInEye() {
+  if ((flags & INSTANCED_STEREO) == 0u) {
+    return;
+  }
+#if defined(USE_STEREO_VIEWPORT_INDEX)
+  gl_ViewportIndex = VIEW_ID;
+#else
+  // Squeeze the eye into its half and clip it where the halves meet
+  float side = VIEW_ID == 0 ? -1.0 : 1.0;
+  gl_Position.x = 0.5 * (gl_Position.x + side * gl_Position.w);
+  gl_ClipDistance[0] = side * gl_Position.x;
+#endif
+}
+#endif
+
+float getHeight(ivec2 levelCoord, int heightLevel) {
+  ivec2 texel = levelCoord & (TEXTURE_SIZE - 1);
+  return texelFetch(heights, ivec3(texel, heightLevel), 0).r * 255.0;
+}
+
+// Height of the next coarser level's surface under the vertex. Vertices
+// between two of its vertices take the height halfway along its triangle
+// edge, which runs along the same diagonal as the map sections'.
+float getCoarseHeight(ivec2 levelCoord) {
+  ivec2 low = levelCoord >> 1;
+  ivec2 high = (levelCoord + 1) >> 1;
+  return 0.5 * (getHeight(ivec2(low.x, high.y), level + 1) +
+                getHeight(ivec2(high.x, low.y), level + 1));
+}
+
+void main() {
+  ivec2 gridCoord = ivec2(aPos);
+  ivec2 levelCoord = origin + gridCoord;
+  float height = getHeight(levelCoord, level);
+
+  // Blend into the coarser level towards the outside, so that the level's
+  // edge matches the vertices around the coarser level's hole
+  if (level < LEVEL_COUNT - 1) {
+    vec2 fromCenter = abs(aPos - vec2(GRID_SIZE / 2));
+    float outside = max(fromCenter.x, fromCenter.y) -
+                    (float(GRID_SIZE / 2) - TRANSITION_WIDTH - 1.0);
+    float alpha = clamp(outside / TRANSITION_WIDTH, 0.0, 1.0);
+    height = mix(height, getCoarseHeight(levelCoord), alpha);
+  }
+
+  vec2 terrainPosition = vec2(levelCoord) * vertexSpacing;
+  vec3 worldPosition =
+      vec3(terrainPosition.x, height, terrainPosition.y) * terrainScale;
+  gl_Position = projectionViews[VIEW_ID] * vec4(worldPosition, 1.0);
+
+  BlendColor = vec4(1.0);
+  ColorLayer = colorLayer;
+  if ((flags & VISUALIZE_LOD) != 0u) {
+    int color = level % 3;
+    BlendColor = vec4(color == 0 ? 1.0 : 0.0, color == 1 ? 1.0 : 0.0,
+                      color == 2 ? 1.0 : 0.0, 1.0);
+  }
+  WorldPosition = vec4(gl_Position);
+  CameraDistance = distance(cameraPosition, worldPosition);
+  // The color map covers one tile of the height map, which repeats
+  vec2 mapTexel = vec2(levelCoord * (1 << level));
+  Position =
+      vec3(mapTexel.x / float(mapSize.x) * float(heightMapSize.x), height,
+           mapTexel.y / float(mapSize.y) * float(heightMapSize.y));
+#if defined(USE_INSTANCED_STEREO)
+  placeInEye();
+#endif
+}
@@ -0,0 +1,28 @@
+#ifdef OPENGL_ES
+  precision highp float;
+  precision highp int;
+#endif
+
+out vec4 FragColor;
+
+in vec2 Uv;
+
+// Far field panorama, with its colors premultiplied by how much of them shows
+// through the fog
+uniform sampler2D panorama;
+
+layout (std140) uniform FrameUniforms {
+  mat4 projectionViews[2];
+  vec4 fogColor;
+  vec3 cameraPosition;
+  float terrainScale;
+  vec2 fogDistances;
+  ivec2 heightMapSize;
+  uint flags;
+  vec4 lodMorphRanges;
+};
+
+void main() {
+  vec4 color = texture(panorama, Uv);
+  FragColor = vec4(fogColor.rgb * (1.0 - color.a) + color.rgb, 1.0);
+}
@@ -1,9 +1,12 @@
 #ifdef OPENGL_ES
   precision highp float;
   precision highp int;
+  precision highp sampler2DArray;
+  precision highp usampler2DArray;
 #endif
 
 const uint ENABLE_FOG = 1u;
+const uint VIRTUAL_TEXTURE = 16u;
 
 out vec4 FragColor;
 
@@ -11,26 +14,89 @@ in vec3 Position;
 in vec4 WorldPosition;
 in float CameraDistance;
 
-uniform sampler2D colorMap;
-uniform ivec2 heightMapSize;
-uniform vec4 fogColor;
-uniform float terrainScale;
-uniform uint flags;
+// Every map's color map, see create_color_map_array
+uniform sampler2DArray colorMap;
 
-// Per instance uniforms
-uniform vec4 blendColor;
+// Tiles of every map's color map, see virtual_texture.c
+uniform sampler2D virtualAtlas;
+// Atlas tile and level sampled for each tile, with a layer per map
+uniform usampler2DArray virtualTable;
+// Size of the color maps, texels along a tile and number of levels
+uniform ivec4 virtualLayout;
 
+// Shared by the terrain and hand shaders, see struct FrameUniforms
+layout (std140) uniform FrameUniforms {
+  mat4 projectionViews[2];
+  vec4 fogColor;
+  vec3 cameraPosition;
+  float terrainScale;
+  // Distances in terrain units where fog starts and ends
+  vec2 fogDistances;
+  ivec2 heightMapSize;
+  uint flags;
+  // Distances in terrain units where vertices morph into the next LOD, LOD 0
+  // in xy and LOD 1 in zw
+  vec4 lodMorphRanges;
+};
 
-float DISTANCE_FOG_MIN = 1500.0f;
-float DISTANCE_FOG_MAX = 1850.0f;
+flat in vec4 BlendColor;
+flat in int ColorLayer;
+
+vec4 fetchVirtualTexel(ivec2 texel, int level) {
+  int tileSize = virtualLayout.z;
+  int row = 0;
+  for (int i = 0; i < level; ++i) {
+    row += (max(virtualLayout.y >> i, 1) + tileSize - 1) / tileSize;
+  }
+  ivec2 levelTexel = texel >> level;
+  uvec4 entry = texelFetch(
+      virtualTable, ivec3(levelTexel / tileSize + ivec2(0, row), ColorLayer),
+      0);
+  // The tile may be an ancestor, when the tile itself is not resident
+  ivec2 tileTexel = (texel >> int(entry.z)) % tileSize;
+  return texelFetch(virtualAtlas, ivec2(entry.xy) * tileSize + tileTexel, 0);
+}
+
+// Samples like GL_NEAREST_MIPMAP_LINEAR, from the tiles of the nearest two
+// levels
+vec4 getVirtualColor(vec2 uv) {
+  vec2 texel = uv * vec2(virtualLayout.xy);
+  vec2 dx = dFdx(texel);
+  vec2 dy = dFdy(texel);
+  float lod = max(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0);
+  if (ColorLayer < 0) {
+    // Not a map, like the frustum
+    return vec4(1.0);
+  }
+
+  // Repeats the map like the color map array's sampler, as the clipmap levels
+  // cover several tiles of it. The derivatives above are taken before
+  // wrapping, so that the level does not jump at the seams.
+  vec2 size = vec2(virtualLayout.xy);
+  ivec2 wrapped = min(ivec2(mod(floor(texel), size)), virtualLayout.xy - 1);
+  int maxLevel = virtualLayout.w - 1;
+  int level = min(int(lod), maxLevel);
+  vec4 color = fetchVirtualTexel(wrapped, level);
+  if (level < maxLevel) {
+    color = mix(color, fetchVirtualTexel(wrapped, level + 1), fract(lod));
+  }
+  return color;
+}
 
 void main()
 {
-  vec4 color = texture(colorMap, Position.xz / vec2(heightMapSize)) * vec4(blendColor);
+  vec2 mapUv = Position.xz / vec2(heightMapSize);
+  vec4 color;
+  if ((flags & VIRTUAL_TEXTURE) != 0u) {
+    color = getVirtualColor(mapUv);
+  } else {
+    color = texture(colorMap, vec3(mapUv, float(ColorLayer)));
+  }
+  color *= BlendColor;
 
   if ((flags & ENABLE_FOG) != 0u) {
-    float distanceMin = DISTANCE_FOG_MIN * terrainScale;
-    float distanceMax = DISTANCE_FOG_MAX * terrainScale;
+    float distanceMin = fogDistances.x * terrainScale;
+    float distanceMax = fogDistances.y * terrainScale;
     float fogFactor = (distanceMin - CameraDistance) / (distanceMin - distanceMax);
     fogFactor = clamp(fogFactor, 0.0, 1.0);
     FragColor = mix(color, fogColor, fogFactor);
@@ -1,6 +1,8 @@
 #ifdef OPENGL_ES
   precision highp float;
   precision highp int;
+  precision highp sampler2DArray;
+  precision highp usampler2DArray;
 #endif
 
 out vec4 FragColor;
@@ -8,8 +10,49 @@ out vec4 FragColor;
 in vec3 Position;
 in vec2 Uv;
 
-uniform sampler2D colorMap;
+uniform sampler2DArray colorMap;
+// Layer of the current map's color map
+uniform int colorLayer;
+
+// Sample the virtual texture instead of colorMap, see get_color.frag
+uniform bool useVirtualTexture;
+uniform sampler2D virtualAtlas;
+uniform usampler2DArray virtualTable;
+uniform ivec4 virtualLayout;
+
+vec4 fetchVirtualTexel(ivec2 texel, int level) {
+  int tileSize = virtualLayout.z;
+  int row = 0;
+  for (int i = 0; i < level; ++i) {
+    row += (max(virtualLayout.y >> i, 1) + tileSize - 1) / tileSize;
+  }
+  ivec2 levelTexel = texel >> level;
+  uvec4 entry = texelFetch(
+      virtualTable, ivec3(levelTexel / tileSize + ivec2(0, row), colorLayer),
+      0);
+  ivec2 tileTexel = (texel >> int(entry.z)) % tileSize;
+  return texelFetch(virtualAtlas, ivec2(entry.xy) * tileSize + tileTexel, 0);
+}
+
+vec4 getVirtualColor(vec2 uv) {
+  vec2 texel = uv * vec2(virtualLayout.xy);
+  vec2 dx = dFdx(texel);
+  vec2 dy = dFdy(texel);
+  float lod = max(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0);
+  ivec2 clamped = clamp(ivec2(texel), ivec2(0), virtualLayout.xy - 1);
+  int maxLevel = virtualLayout.w - 1;
+  int level = min(int(lod), maxLevel);
+  vec4 color = fetchVirtualTexel(clamped, level);
+  if (level < maxLevel) {
+    color = mix(color, fetchVirtualTexel(clamped, level + 1), fract(lod));
+  }
+  return color;
+}
 
 void main() {
-  FragColor = texture(colorMap, Uv);
+  if (useVirtualTexture) {
+    FragColor = getVirtualColor(Uv);
+  } else {
+    FragColor = texture(colorMap, vec3(Uv, float(colorLayer)));
+  }
 }
@@ -3,7 +3,13 @@
   precision highp int;
 #endif
 
-#if defined(GL_OVR_multiview2)
+#if defined(USE_INSTANCED_STEREO)
+  #if defined(USE_STEREO_VIEWPORT_INDEX)
+    #extension GL_ARB_shader_viewport_layer_array : require
+  #endif
+  // With instanced stereo every instance is drawn once per eye
+  #define VIEW_ID ((flags & INSTANCED_STEREO) != 0u ? gl_InstanceID % 2 : 0)
+#elif defined(GL_OVR_multiview2)
   #extension GL_OVR_multiview2 : enable
   layout(num_views = 2) in;
   #define VIEW_ID gl_ViewID_OVR
@@ -17,9 +23,46 @@ layout (location = 1) in vec2 aUv;
 out vec3 Position;
 out vec2 Uv;
 
-uniform mat4 mvp[2];
+uniform mat4 model;
+
+// Shared by the terrain and hand shaders, see struct FrameUniforms
+layout (std140) uniform FrameUniforms {
+  mat4 projectionViews[2];
+  vec4 fogColor;
+  vec3 cameraPosition;
+  float terrainScale;
+  // Distances in terrain units where fog starts and ends
+  vec2 fogDistances;
+  ivec2 heightMapSize;
+  uint flags;
+  // Distances in terrain units where vertices morph into the next LOD, LOD 0
+  // in xy and LOD 1 in zw
+  vec4 lodMorphRanges;
+};
+
+const uint INSTANCED_STEREO = 4u;
+
+#if defined(USE_INSTANCED_STEREO)
+// Moves the vertex into its eye's half of the side by side framebuffer
+void placeInEye() {
+  if ((flags & INSTANCED_STEREO) == 0u) {
+    return;
+  }
+#if defined(USE_STEREO_VIEWPORT_INDEX)
+  gl_ViewportIndex = VIEW_ID;
+#else
+  // Squeeze the eye into its half and clip it where the halves meet
+  float side = VIEW_ID == 0 ? -1.0 : 1.0;
+  gl_Position.x = 0.5 * (gl_Position.x + side * gl_Position.w);
+  gl_ClipDistance[0] = side * gl_Position.x;
+#endif
+}
+#endif
 
 void main() {
-  gl_Position = mvp[VIEW_ID] * vec4(aPos.x, aPos.y, aPos.z, 1.0);
+  gl_Position = projectionViews[VIEW_ID] * model * vec4(aPos, 1.0);
   Uv = aUv;
+#if defined(USE_INSTANCED_STEREO)
+  placeInEye();
+#endif
 }
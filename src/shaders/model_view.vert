@@ -3,7 +3,13 @@
   precision highp int;
 #endif
 
-#if defined(GL_OVR_multiview2)
+#if defined(USE_INSTANCED_STEREO)
+  #if defined(USE_STEREO_VIEWPORT_INDEX)
+    #extension GL_ARB_shader_viewport_layer_array : require
+  #endif
+  // With instanced stereo every instance is drawn once per eye
+  #define VIEW_ID ((flags & INSTANCED_STEREO) != 0u ? gl_InstanceID % 2 : 0)
+#elif defined(GL_OVR_multiview2)
   #extension GL_OVR_multiview2 : enable
   layout(num_views = 2) in;
   #define VIEW_ID gl_ViewID_OVR
@@ -12,21 +18,93 @@
 #endif
 
 layout (location = 0) in vec3 aPos;
+// Map offset in xy, LOD in z and color map layer in w, one per instance.
+// Written by cull_sections.comp or the CPU, see struct DrawInfo.
+layout (location = 1) in vec4 aDrawInfo;
+// Constant for the whole draw
+layout (location = 2) in vec4 aBlendColor;
+// Height to morph to and the last LOD using the vertex, see
+// create_morph_targets
+layout (location = 3) in vec2 aMorphTarget;
 
 out vec3 Position;
 out vec4 WorldPosition;
 out float CameraDistance;
 
-uniform vec3 cameraPosition;
+flat out vec4 BlendColor;
+flat out int ColorLayer;
 
-uniform mat4 projectionViews[2];
+// Shared by the terrain and hand shaders, see struct FrameUniforms
+layout (std140) uniform FrameUniforms {
+  mat4 projectionViews[2];
+  vec4 fogColor;
+  vec3 cameraPosition;
+  float terrainScale;
+  // Distances in terrain units where fog starts and ends
+  vec2 fogDistances;
+  ivec2 heightMapSize;
+  uint flags;
+  // Distances in terrain units where vertices morph into the next LOD, LOD 0
+  // in xy and LOD 1 in zw
+  vec4 lodMorphRanges;
+};
 
-// Per instance uniforms
-uniform mat4 model;
+const uint VISUALIZE_LOD = 2u;
+const uint INSTANCED_STEREO = 4u;
+const uint ADAPTIVE_MESHES = 8u;
+
+#if defined(USE_INSTANCED_STEREO)
+// Moves the vertex into its eye's half of the side by side framebuffer
+void placeInEye() {
+  if ((flags & INSTANCED_STEREO) == 0u) {
+    return;
+  }
+#if defined(USE_STEREO_VIEWPORT_INDEX)
+  gl_ViewportIndex = VIEW_ID;
+#else
+  // Squeeze the eye into its half and clip it where the halves meet
+  float side = VIEW_ID == 0 ? -1.0 : 1.0;
+  gl_Position.x = 0.5 * (gl_Position.x + side * gl_Position.w);
+  gl_ClipDistance[0] = side * gl_Position.x;
+#endif
+}
+#endif
+
+// Blends the vertex into the next LOD as it gets further from the camera, so
+// that it has reached the coarser mesh by the time the LOD switches
+vec3 morphPosition(vec3 terrainPosition, int lod) {
+  int morphLod = int(aMorphTarget.y);
+  // Adaptive meshes don't drop vertices on a grid, their LODs pop instead
+  if (lod < 0 || morphLod >= 2 || (flags & ADAPTIVE_MESHES) != 0u) {
+    return aPos;
+  }
+
+  vec2 range = morphLod == 0 ? lodMorphRanges.xy : lodMorphRanges.zw;
+  float cameraDistance =
+      distance(cameraPosition / terrainScale, terrainPosition);
+  float morph = clamp((cameraDistance - range.x) / (range.y - range.x), 0.0,
+                      1.0);
+  return vec3(aPos.x, mix(aPos.y, aMorphTarget.x, morph), aPos.z);
+}
 
 void main() {
-  gl_Position = projectionViews[VIEW_ID] * vec4(aPos.x, aPos.y, aPos.z, 1.0);
+  // Geometry that is not terrain has a negative LOD
+  int lod = int(aDrawInfo.z);
+  vec3 offset = vec3(aDrawInfo.x, 0.0, aDrawInfo.y);
+  vec3 worldPosition =
+      (morphPosition(aPos + offset, lod) + offset) * terrainScale;
+  gl_Position = projectionViews[VIEW_ID] * vec4(worldPosition, 1.0);
+
+  BlendColor = aBlendColor;
+  ColorLayer = int(aDrawInfo.w);
+  if ((flags & VISUALIZE_LOD) != 0u && lod >= 0) {
+    BlendColor = vec4(lod == 0 ? 1.0 : 0.0, lod == 1 ? 1.0 : 0.0,
+                      lod == 2 ? 1.0 : 0.0, 1.0);
+  }
   WorldPosition = vec4(gl_Position);
-  CameraDistance = distance(cameraPosition, vec3(model * vec4(aPos, 1.0)));
+  CameraDistance = distance(cameraPosition, worldPosition);
   Position = aPos;
+#if defined(USE_INSTANCED_STEREO)
+  placeInEye();
+#endif
 }
@@ -0,0 +1,41 @@
+#if defined(USE_INSTANCED_STEREO)
+  // With instanced stereo every instance is drawn once per eye
+  #define VIEW_ID ((flags & INSTANCED_STEREO) != 0u ? gl_InstanceID % 2 : 0)
+#else
+  #define VIEW_ID 0
+#endif
+
+// Patch corner in map vertices
+layout (location = 0) in vec2 aPos;
+// Map offset in xy, LOD in z and color map layer in w, one per instance, see
+// struct DrawInfo
+layout (location = 1) in vec4 aDrawInfo;
+
+out vec2 ControlMapPosition;
+flat out vec4 ControlDrawInfo;
+flat out int ControlViewId;
+
+// Shared by the terrain and hand shaders, see struct FrameUniforms
+layout (std140) uniform FrameUniforms {
+  mat4 projectionViews[2];
+  vec4 fogColor;
+  vec3 cameraPosition;
+  float terrainScale;
+  // Distances in terrain units where fog starts and ends
+  vec2 fogDistances;
+  ivec2 heightMapSize;
+  uint flags;
+  // Distances in terrain units where vertices morph into the next LOD, LOD 0
+  // in xy and LOD 1 in zw
+  vec4 lodMorphRanges;
+};
+
+const uint INSTANCED_STEREO = 4u;
+
+// Patches are placed and tessellated by the later stages, which have no
+// instance ID of their own
+void main() {
+  ControlMapPosition = aPos;
+  ControlDrawInfo = aDrawInfo;
+  ControlViewId = VIEW_ID;
+}
@@ -0,0 +1,255 @@
+#include "tessellation.h"
+#include "assert.h"
+#include "file.h"
+#include "gl_state.h"
+#include "image.h"
+#include "platform.h"
+#include "shader.h"
+#include "string.h"
+#include <stdlib.h>
+
+#ifdef INCLUDE_GLAD
+
+#define PATCH_VERTEX_COUNT 4
+
+int32_t create_tessellated_terrain(struct TessellatedTerrain *terrain,
+                                   const char *defines) {
+  terrain->map_index = -1;
+  terrain->section_vertex_count = 0;
+  terrain->is_query_pending = false;
+  terrain->num_triangles = 0;
+
+  char *vertex_source = read_file("src/shaders/tessellation.vert");
+  assert(vertex_source != NULL);
+  char *control_source = read_file("src/shaders/tessellation.tesc");
+  assert(control_source != NULL);
+  char *evaluation_source = read_file("src/shaders/tessellation.tese");
+  assert(evaluation_source != NULL);
+  char *fragment_source = read_file("src/shaders/get_color.frag");
+  assert(fragment_source != NULL);
+  terrain->shader =
+      create_tessellation_shader(defines, vertex_source, control_source,
+                                 evaluation_source, fragment_source);
+  free(vertex_source);
+  free(control_source);
+  free(evaluation_source);
+  free(fragment_source);
+  if (!terrain->shader) {
+    return GAME_ERROR;
+  }
+
+  GLuint shader = terrain->shader;
+  terrain->uniforms.vertex_spacing =
+      glGetUniformLocation(shader, "vertexSpacing");
+  terrain->uniforms.projection_scale =
+      glGetUniformLocation(shader, "projectionScale");
+  use_program(shader);
+  glUniform1i(glGetUniformLocation(shader, "colorMap"), 0);
+  glUniform1i(glGetUniformLocation(shader, "heights"), 1);
+
+  glGenVertexArrays(1, &terrain->vao);
+  bind_vertex_array(terrain->vao);
+  glGenBuffers(1, &terrain->patch_buffer);
+  bind_buffer(GL_ARRAY_BUFFER, terrain->patch_buffer);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), (void *)0);
+  glEnableVertexAttribArray(0);
+  bind_vertex_array(0);
+
+  glGenTextures(1, &terrain->height_texture);
+  bind_texture_for_update(1, GL_TEXTURE_2D, terrain->height_texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+  glGenQueries(1, &terrain->primitives_query);
+  return GAME_SUCCESS;
+}
+
+/*!
+ * Writes the corners of every section's patches, section after section in
+ * the order of Map's sections. Corners go around each patch from its first,
+ * along x first.
+ *
+ * @param[out] corners
+ * @param[in]  map
+ * @param[in]  patch_size       Map vertices along each side of a patch
+ * @param[in]  patches_per_side Of a section
+ */
+static void create_section_patches(vec2 *corners, struct Map *map,
+                                   int32_t patch_size,
+                                   int32_t patches_per_side) {
+  int32_t section_size = map->height_map.width / MAP_X_SEGMENTS;
+  int32_t num_corners = 0;
+  for (int32_t i_section = 0; i_section < MAP_SECTION_COUNT; ++i_section) {
+    int32_t section_x = (i_section % MAP_X_SEGMENTS) * section_size;
+    int32_t section_z = (i_section / MAP_Y_SEGMENTS) * section_size;
+    for (int32_t z = 0; z < patches_per_side; ++z) {
+      for (int32_t x = 0; x < patches_per_side; ++x) {
+        float x0 = (float)(section_x + x * patch_size);
+        float z0 = (float)(section_z + z * patch_size);
+        float x1 = x0 + patch_size;
+        float z1 = z0 + patch_size;
+        vec2 patch[PATCH_VERTEX_COUNT] = {
+            {x0, z0}, {x1, z0}, {x1, z1}, {x0, z1}};
+        memcpy(&corners[num_corners], patch, sizeof(patch));
+        num_corners += PATCH_VERTEX_COUNT;
+      }
+    }
+  }
+}
+
+/*!
+ * Creates the patches and uploads the heights of a map when it changes.
+ *
+ * @param[in]  terrain
+ * @param[in]  map
+ * @param[in]  map_index Of map
+ */
+void update_tessellated_terrain(struct TessellatedTerrain *terrain,
+                                struct Map *map, int32_t map_index) {
+  if (terrain->map_index == map_index) {
+    return;
+  }
+  terrain->map_index = map_index;
+
+  struct ImageBuffer *height_map = &map->height_map;
+  int32_t section_size = height_map->width / MAP_X_SEGMENTS;
+  int32_t patch_size = section_size < TESSELLATION_PATCH_SIZE
+                           ? section_size
+                           : TESSELLATION_PATCH_SIZE;
+  int32_t patches_per_side = section_size / patch_size;
+  terrain->section_vertex_count =
+      patches_per_side * patches_per_side * PATCH_VERTEX_COUNT;
+
+  int32_t num_corners = terrain->section_vertex_count * MAP_SECTION_COUNT;
+  vec2 *corners = malloc(sizeof(vec2) * num_corners);
+  create_section_patches(corners, map, patch_size, patches_per_side);
+  bind_buffer(GL_ARRAY_BUFFER, terrain->patch_buffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * num_corners, corners,
+               GL_STATIC_DRAW);
+  free(corners);
+
+  uint8_t *heights = malloc(height_map->width * height_map->height);
+  for (int32_t y = 0; y < height_map->height; ++y) {
+    for (int32_t x = 0; x < height_map->width; ++x) {
+      heights[y * height_map->width + x] = get_image_grey(height_map, x, y);
+    }
+  }
+  bind_texture_for_update(1, GL_TEXTURE_2D, terrain->height_texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, height_map->width, height_map->height,
+               0, GL_RED, GL_UNSIGNED_BYTE, heights);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  free(heights);
+}
+
+/*!
+ * Draws the patches of every section with a draw command. Each command's
+ * DrawInfo record is read through an instanced attribute, like the section
+ * LODs'.
+ *
+ * @param[in]  terrain
+ * @param[in]  map               The map last passed to
+ *                               update_tessellated_terrain
+ * @param[in]  color_map_array   Read at each command's DrawInfo layer
+ * @param[in]  commands
+ * @param[in]  num_commands
+ * @param[in]  draw_info_buffer  Holds a DrawInfo for each command
+ * @param[in]  draw_infos_offset Of the first command's DrawInfo
+ * @param[in]  projection_scale  Pixels covered by a unit long edge one unit
+ *                               in front of the camera
+ * @param[in]  view_count        Number of views each section is instanced for
+ */
+void draw_tessellated_terrain(struct TessellatedTerrain *terrain,
+                              struct Map *map, GLuint color_map_array,
+                              struct DrawCommand *commands,
+                              int32_t num_commands, GLuint draw_info_buffer,
+                              uintptr_t draw_infos_offset,
+                              float projection_scale, int32_t view_count) {
+  use_program(terrain->shader);
+  bind_vertex_array(terrain->vao);
+  bind_texture(0, GL_TEXTURE_2D_ARRAY, color_map_array);
+  bind_texture_2d(1, terrain->height_texture);
+
+  glUniform1f(terrain->uniforms.vertex_spacing, map->modifier);
+  glUniform1f(terrain->uniforms.projection_scale, projection_scale);
+  count_uniform_uploads(2);
+  glPatchParameteri(GL_PATCH_VERTICES, PATCH_VERTEX_COUNT);
+
+  bind_buffer(GL_ARRAY_BUFFER, draw_info_buffer);
+  glEnableVertexAttribArray(DRAW_INFO_ATTRIBUTE);
+  // Every eye's copy of an instance reads the same record
+  glVertexAttribDivisor(DRAW_INFO_ATTRIBUTE, view_count);
+
+  if (terrain->is_query_pending) {
+    GLuint is_available = GL_FALSE;
+    glGetQueryObjectuiv(terrain->primitives_query,
+                        GL_QUERY_RESULT_AVAILABLE, &is_available);
+    if (is_available) {
+      glGetQueryObjectuiv(terrain->primitives_query, GL_QUERY_RESULT,
+                          &terrain->num_triangles);
+      terrain->is_query_pending = false;
+    }
+  }
+
+  bool is_counting = !terrain->is_query_pending;
+  if (is_counting) {
+    glBeginQuery(GL_PRIMITIVES_GENERATED, terrain->primitives_query);
+  }
+
+  for (int32_t i = 0; i < num_commands; ++i) {
+    glVertexAttribPointer(
+        DRAW_INFO_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(struct DrawInfo),
+        (void *)(draw_infos_offset + i * sizeof(struct DrawInfo)));
+    glDrawArraysInstanced(
+        GL_PATCHES, commands[i].section_index * terrain->section_vertex_count,
+        terrain->section_vertex_count, view_count);
+  }
+  count_draws(num_commands);
+
+  if (is_counting) {
+    glEndQuery(GL_PRIMITIVES_GENERATED);
+    terrain->is_query_pending = true;
+  }
+
+  glVertexAttribDivisor(DRAW_INFO_ATTRIBUTE, 0);
+  glDisableVertexAttribArray(DRAW_INFO_ATTRIBUTE);
+}
+
+#else
+
+int32_t create_tessellated_terrain(struct TessellatedTerrain *terrain,
+                                   const char *defines) {
+  (void)defines;
+  terrain->shader = 0;
+  terrain->map_index = -1;
+  terrain->num_triangles = 0;
+  return GAME_ERROR;
+}
+
+void update_tessellated_terrain(struct TessellatedTerrain *terrain,
+                                struct Map *map, int32_t map_index) {
+  (void)terrain;
+  (void)map;
+  (void)map_index;
+}
+
+void draw_tessellated_terrain(struct TessellatedTerrain *terrain,
+                              struct Map *map, GLuint color_map_array,
+                              struct DrawCommand *commands,
+                              int32_t num_commands, GLuint draw_info_buffer,
+                              uintptr_t draw_infos_offset,
+                              float projection_scale, int32_t view_count) {
+  (void)terrain;
+  (void)map;
+  (void)color_map_array;
+  (void)commands;
+  (void)num_commands;
+  (void)draw_info_buffer;
+  (void)draw_infos_offset;
+  (void)projection_scale;
+  (void)view_count;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+#include "types.h"
+
+int32_t create_tessellated_terrain(struct TessellatedTerrain *terrain,
+                                   const char *defines);
+void update_tessellated_terrain(struct TessellatedTerrain *terrain,
+                                struct Map *map, int32_t map_index);
+void draw_tessellated_terrain(struct TessellatedTerrain *terrain,
+                              struct Map *map, GLuint color_map_array,
+                              struct DrawCommand *commands,
+                              int32_t num_commands, GLuint draw_info_buffer,
+                              uintptr_t draw_infos_offset,
+                              float projection_scale, int32_t view_count);
@@ -1,5 +1,7 @@
 #pragma once
 #include "game_gl.h"
+#include "pvs_format.h"
+#include "world_pages_format.h"
 #include "stdint.h"
 #include <cglm/cglm.h>
 
@@ -96,28 +98,281 @@ struct RenderingMatrices {
   mat4 projection_view_matrices[2];
 };
 
+// Per instance data of a terrain draw, read by model_view.vert. Matches the
+// drawInfos written by cull_sections.comp.
+struct DrawInfo {
+  // Offset of the instance's map in terrain units
+  float offset_x;
+  float offset_z;
+  float lod;
+  // Layer of the instance's map in the color map array
+  float color_layer;
+};
+
+// Vertex attributes of model_view.vert. Draw info is instanced, the blend color
+// is constant for a whole draw. The morph target is per vertex, see
+// create_morph_targets.
+#define DRAW_INFO_ATTRIBUTE 1
+#define BLEND_COLOR_ATTRIBUTE 2
+#define MORPH_TARGET_ATTRIBUTE 3
+
 struct DrawElementsIndirectCommand {
   uint32_t count;
   uint32_t instance_count;
   uint32_t first_index;
   uint32_t base_vertex;
-  uint32_t reserved_must_be_zero;
+  // Must be zero unless base instance is supported
+  uint32_t base_instance;
 };
 
-struct TerrainShaderUniforms {
-  GLint height_map_size;
-  GLint fog_color;
-  GLint terrain_scale;
-  GLint flags;
-  GLint camera_position;
-  GLint projection_views[2];
-  GLint model;
-  GLint blend_color;
+// Must match the flag constants in the terrain and hand shaders
+#define TERRAIN_FLAG_ENABLE_FOG 1u
+#define TERRAIN_FLAG_VISUALIZE_LOD 2u
+#define TERRAIN_FLAG_INSTANCED_STEREO 4u
+#define TERRAIN_FLAG_ADAPTIVE_MESHES 8u
+#define TERRAIN_FLAG_VIRTUAL_TEXTURE 16u
+
+// Uniform buffer binding of the FrameUniforms block
+#define FRAME_UNIFORMS_BINDING 0
+
+// State shared by every draw of a frame. Layout matches the std140
+// FrameUniforms block in the terrain and hand shaders.
+struct FrameUniforms {
+  mat4 projection_views[2];
+  vec4 fog_color;
+  vec3 camera_position;
+  float terrain_scale;
+  // Distances in terrain units where fog starts and ends
+  vec2 fog_distances;
+  int32_t height_map_size[2];
+  uint32_t flags;
+  uint32_t padding[3];
+  // Distances in terrain units where vertices start and finish morphing into
+  // the next LOD, LOD 0 in xy and LOD 1 in zw
+  vec4 lod_morph_ranges;
 };
 
 struct HandShaderUniforms {
   GLint color_map;
-  GLint mvp[2];
+  GLint color_layer;
+  GLint model;
+  GLint use_virtual_texture;
+};
+
+struct GLCapabilities {
+  // Compute shaders, shader storage buffers and memory barriers
+  bool compute_shader;
+  bool multi_draw_indirect;
+  bool base_instance;
+  // Draw count can be sourced from a buffer
+  bool indirect_parameters;
+  // Immutable buffers that can stay mapped while the GPU reads them
+  bool buffer_storage;
+  // Both eyes of a side by side framebuffer are drawn in one instanced pass
+  // instead of with multiview
+  bool instanced_stereo;
+  // Vertex shaders can select the viewport to draw to
+  bool viewport_layer_array;
+  // Tessellation control and evaluation shaders, desktop GL 4.0
+  bool tessellation_shader;
+};
+
+// GL calls made during a frame, see gl_state.c
+struct GLCallCounters {
+  // Binds of programs, vertex arrays, buffers and textures sent to GL
+  uint32_t binds;
+  // Binds and enables skipped because the state was already set
+  uint32_t skipped_calls;
+  uint32_t capability_changes;
+  uint32_t uniform_uploads;
+  // Draws and compute dispatches
+  uint32_t draws;
+  uint32_t buffer_maps;
+};
+
+// Number of frames the GPU may still be reading from a RingBuffer
+#define RING_BUFFER_FRAME_COUNT 3
+
+// Buffer for data written by the CPU every frame, split into one region per
+// frame in flight. See ring_buffer.c.
+struct RingBuffer {
+  GLuint buffer;
+  bool persistent;
+  // The whole buffer when persistent, otherwise the current frame's region
+  // while it is being written
+  uint8_t *mapped;
+  int32_t frame_size;
+  int32_t frame_index;
+  // Bytes of the current frame's region already allocated
+  int32_t frame_offset;
+  GLsync fences[RING_BUFFER_FRAME_COUNT];
+};
+
+// Sections are split into this many bands of rows, each with its own range of
+// vertices so that they can be drawn with 16 bit indices and a base vertex. A
+// whole section has (256 + 1)^2 vertices, too many for 16 bits.
+#define SECTION_VERTEX_BLOCKS 2
+
+// Layout matches the std430 Section struct in cull_sections.comp
+struct GpuSection {
+  // xyz is the center in terrain units, w is the bounding sphere radius
+  vec4 center_radius;
+  // Offset of the section's map in the world, w is the map's color map layer
+  vec4 translate;
+  // Bounding box in terrain units, w is unused
+  vec4 bounds_min;
+  vec4 bounds_max;
+  // Index ranges of each LOD, per vertex block
+  uint32_t lod_offsets[SECTION_VERTEX_BLOCKS][4];
+  uint32_t lod_counts[SECTION_VERTEX_BLOCKS][4];
+  // First vertex of each block, from x
+  uint32_t base_vertices[4];
+};
+
+struct GpuCullingUniforms {
+  GLint frustum_planes;
+  GLint camera_position;
+  GLint terrain_scale;
+  GLint lod_distances;
+  GLint fog_distance;
+  GLint section_count;
+  GLint command_capacity;
+  GLint clear_commands;
+  GLint use_base_instance;
+  GLint view_count;
+};
+
+struct GpuCulling {
+  GLuint cull_shader;
+  struct GpuCullingUniforms uniforms;
+  GLuint section_buffer;
+  GLuint command_buffer;
+  GLuint draw_info_buffer;
+  GLuint draw_count_buffer;
+  int32_t num_sections;
+  int32_t capacity;
+  // Every section writes a command per vertex block
+  int32_t command_capacity;
+  // Map that section_buffer was filled from, -1 when empty
+  int32_t map_index;
+  // Whether section_buffer holds the sections' adaptive meshes
+  bool adaptive_meshes;
+};
+
+struct Mesh {
+  int32_t offset;
+  int32_t num_indices;
+  // Added to every index, see SECTION_VERTEX_BLOCKS
+  int32_t base_vertex;
+};
+
+// Quads along each side of a clipmap level. Each level is twice as coarse as
+// the one inside it and leaves a hole of half its size for it.
+#define CLIPMAP_GRID_SIZE 64
+#define CLIPMAP_LEVEL_COUNT 7
+// Side of each level's toroidal height texture, a power of two that holds the
+// level's CLIPMAP_GRID_SIZE + 1 vertices
+#define CLIPMAP_TEXTURE_SIZE 128
+// Vertices at the outside of a level over which its heights blend into the
+// next coarser level's, so that the levels meet without cracks
+#define CLIPMAP_TRANSITION_WIDTH 8
+
+struct ClipmapUniforms {
+  GLint origin;
+  GLint vertex_spacing;
+  GLint level;
+  GLint map_size;
+  GLint color_layer;
+};
+
+struct ClipmapLevel {
+  // Texel coordinates of the level's first vertex, where a texel of level n
+  // is 2^n texels of the height map
+  int32_t origin_x;
+  int32_t origin_z;
+  // Whether the height texture holds the texels from origin onwards
+  bool is_loaded;
+};
+
+// Terrain drawn as nested grids centered on the camera instead of map
+// sections, see clipmap.c
+struct Clipmap {
+  GLuint shader;
+  struct ClipmapUniforms uniforms;
+  GLuint vao;
+  GLuint vertex_buffer;
+  GLuint index_buffer;
+  // The full grid of the finest level
+  struct Mesh full_grid;
+  // The grid around the hole of a coarser level, for each offset of the hole
+  // in x and z, indexed by x + 2 * z
+  struct Mesh rings[4];
+  // Heights of every level in a layer, addressed toroidally
+  GLuint height_texture;
+  // Repeats the color map, which clipmap vertices sample past the map edge
+  GLuint color_sampler;
+  struct ClipmapLevel levels[CLIPMAP_LEVEL_COUNT];
+  // Map the heights were loaded from, -1 when none are
+  int32_t map_index;
+  // Texels of a height texture region waiting to be uploaded
+  uint8_t *upload_buffer;
+};
+
+// Map vertices along each side of a tessellation patch. Patch edges are
+// subdivided at most this many times, so they are never finer than the map.
+#define TESSELLATION_PATCH_SIZE 16
+
+struct TessellationUniforms {
+  GLint vertex_spacing;
+  GLint projection_scale;
+};
+
+// Terrain drawn as coarse patches per map section that are tessellated on the
+// GPU instead of the section LODs, see tessellation.c
+struct TessellatedTerrain {
+  GLuint shader;
+  struct TessellationUniforms uniforms;
+  GLuint vao;
+  // Corners of every section's patches, section after section
+  GLuint patch_buffer;
+  int32_t section_vertex_count;
+  // The height map, sampled with linear filtering
+  GLuint height_texture;
+  // Map the patches and heights were created for, -1 when none are
+  int32_t map_index;
+  // Counts the triangles tessellated, read back once the GPU is done with
+  // them so that drawing never waits
+  GLuint primitives_query;
+  bool is_query_pending;
+  uint32_t num_triangles;
+};
+
+// Layout matches the std430 Cluster struct in generate_mesh.comp
+struct GpuMeshCluster {
+  // Bounding sphere in map space
+  vec4 center_radius;
+  // xyz is the axis of the normal cone, w its cutoff
+  vec4 cone_axis_cutoff;
+  // First index of the cluster, and the number of indices the GPU wrote
+  uint32_t offset;
+  uint32_t num_indices;
+  uint32_t padding[2];
+};
+
+struct MeshGeneratorUniforms {
+  GLint grid_size;
+  GLint section_size;
+  GLint vertex_spacing;
+  GLint vertex_count;
+  GLint cluster_count;
+  GLint generate_indices;
+};
+
+// Generates the vertices and regular LOD meshes of maps with a compute
+// shader, see mesh_generation.c
+struct MeshGenerator {
+  GLuint shader;
+  struct MeshGeneratorUniforms uniforms;
 };
 
 struct CubeBuffer {
@@ -131,7 +386,6 @@ struct CubeBuffer {
 struct OpenGLData {
   GLuint frame_buffer;
   GLuint terrain_shader;
-  struct TerrainShaderUniforms terrain_shader_uniforms;
   GLuint hand_shader;
   struct HandShaderUniforms hand_shader_uniforms;
   GLuint shader_program;
@@ -142,8 +396,17 @@ struct OpenGLData {
   struct CubeBuffer cube_buffer;
   GLuint frustum_vis_vao;
   GLuint frustum_vis_vbo;
+  // Single white layer, for geometry drawn with the terrain shader that is not
+  // terrain
   GLuint white_tex_id;
-  GLuint draw_command_vbo;
+  // Color map of every map, one layer per map index
+  GLuint color_map_array;
+  // Indirect draw commands and draw data written every frame
+  struct RingBuffer frame_ring;
+  struct GLCapabilities caps;
+  struct GpuCulling gpu_culling;
+  struct Clipmap clipmap;
+  struct TessellatedTerrain tessellation;
 };
 
 struct GameOptions {
@@ -153,6 +416,27 @@ struct GameOptions {
   bool do_raycasting;
   bool render_stereo;
   bool visualize_frustum;
+  bool occlusion_culling;
+  bool gpu_culling;
+  bool use_pvs;
+  bool cluster_culling;
+  bool pipelined_frames;
+  bool late_latching;
+  // Draw the terrain with clipmaps instead of map sections
+  bool clipmap_terrain;
+  // Draw sections with their adaptive meshes instead of regular grids
+  bool adaptive_meshes;
+  // Draw sections as hardware tessellated patches instead of LOD meshes
+  bool tessellated_terrain;
+  // Tile the world with different maps instead of repeating the current one
+  bool mixed_world;
+  // Draw the pages of the streamed world instead of the maps
+  bool streamed_world;
+  // Sample the maps' colors from the virtual texture instead of an array
+  // holding every color map whole
+  bool virtual_texture;
+  // Draw the terrain past the meshes from the far field's panorama
+  bool far_field;
 };
 
 // NOTE: Represent states of all keys for ASCII codes 32-127
@@ -196,22 +480,72 @@ struct MapEntry {
   char *height;
 };
 
-struct Mesh {
-  int32_t offset;
-  int32_t num_indices;
+struct DrawCommand {
+  // Offset of the section's map in terrain units
+  vec2 tile_offset;
+  uint16_t section_index;
+  uint16_t lod;
+  uint16_t map_index;
 };
 
-struct DrawCommand {
-  mat4 model_matrix;
+// Visible index range of a DrawCommand's section
+struct DrawRange {
   struct Mesh mesh;
-  int32_t lod;
+  // Index of the DrawCommand in RenderState
+  int32_t command;
+  // Map whose buffers the range indexes, the same as its DrawCommand's
+  int32_t map_index;
 };
 
 #define LOD_COUNT 3
+// Distances, in terrain units, from the camera to the nearest point of a
+// section where each coarser LOD starts. Vertices are fully morphed into the
+// coarser LOD by then, so the switch doesn't pop.
+#define LOD1_DISTANCE 64.0f
+#define LOD2_DISTANCE 192.0f
+// Part of each LOD's distance range, at its far end, over which vertices
+// morph into the next LOD
+#define LOD_MORPH_FRACTION 0.5f
+// Camera distances, in terrain units, where fog starts and where terrain is
+// fully fogged. Nothing past DISTANCE_FOG_MAX is drawn.
+#define DISTANCE_FOG_MIN 1500.0f
+#define DISTANCE_FOG_MAX 1850.0f
+// Number of occluder cells along each side of a map section
+#define SECTION_OCCLUDER_CELLS 8
+// Number of clusters along each side of a section, for every LOD
+#define SECTION_CLUSTERS_PER_SIDE 8
+#define SECTION_CLUSTER_COUNT                                                  \
+  (SECTION_CLUSTERS_PER_SIDE * SECTION_CLUSTERS_PER_SIDE)
+
+// Part of a section LOD that is culled on its own
+struct MeshCluster {
+  // Bounding sphere in map space
+  vec3 center;
+  float radius;
+  // Normals of all the cluster's triangles are within the cone around this
+  // axis. See is_cone_backfacing.
+  vec3 cone_axis;
+  float cone_cutoff;
+  struct Mesh mesh;
+};
+
 struct MapSection {
   vec3 center;
   float bounding_sphere_radius;
-  struct Mesh lods[LOD_COUNT];
+  // Axis aligned bounds in map space, y holds the min and max terrain height
+  vec3 bounds_min;
+  vec3 bounds_max;
+  // Lowest terrain height within each occluder cell, row major
+  uint8_t occluder_heights[SECTION_OCCLUDER_CELLS * SECTION_OCCLUDER_CELLS];
+  // Each LOD's clusters in every vertex block
+  struct Mesh lods[LOD_COUNT][SECTION_VERTEX_BLOCKS];
+  // SECTION_CLUSTER_COUNT clusters per LOD, row major, in index order. Points
+  // into Map's clusters.
+  struct MeshCluster *clusters;
+  // Error bounded meshes of each LOD and their clusters, see
+  // create_adaptive_meshes
+  struct Mesh adaptive_lods[LOD_COUNT][SECTION_VERTEX_BLOCKS];
+  struct MeshCluster *adaptive_clusters;
 };
 
 #define MAP_X_SEGMENTS 4
@@ -220,6 +554,13 @@ struct MapSection {
 
 #define MAX_MIP_LEVELS 16
 
+// Potentially visible set baked by pvs_baker, rows points into data
+struct Pvs {
+  struct PvsFileHeader header;
+  uint8_t *rows;
+  uint8_t *data;
+};
+
 struct Map {
 #ifdef VR_VOX_USE_ASTC
   struct AstcImageBuffer color_map[MAX_MIP_LEVELS];
@@ -231,30 +572,331 @@ struct Map {
   // multiply by this value to get 1024
   float modifier;
   GLuint map_vbo;
+  GLuint map_vbo_morph_targets;
   GLuint map_vbo_indices;
   GLuint map_vao;
-  GLuint color_map_tex_id;
   struct MapSection sections[MAP_SECTION_COUNT];
+  struct MeshCluster *clusters;
+  struct Pvs pvs;
+};
+
+// CPU side of a map's meshes, see create_map_meshes
+struct MapMeshData {
+  // NULL when the GPU generates the vertices
+  V3 *block_vertices;
+  vec2 *block_morph_targets;
+  uint16_t *packed_indices;
+  int32_t num_block_vertices;
+  int32_t num_indices;
+  int32_t num_packed_indices;
+};
+
+// Pages are kept in this many slots, enough for every page within
+// WORLD_PAGE_LOAD_DISTANCE of the camera, which bounds the memory a streamed
+// world takes however large it is
+#define WORLD_PAGE_SLOT_COUNT 36
+// Pages are loaded while their nearest point is within this distance of the
+// camera, in terrain units, so that they are ready before they come out of
+// the fog
+#define WORLD_PAGE_LOAD_DISTANCE (DISTANCE_FOG_MAX + 256.0f)
+
+// A page loaded and meshed on the streaming thread, waiting to be uploaded
+struct WorldPageBuild {
+  int32_t page_x;
+  int32_t page_y;
+  int32_t slot;
+  int32_t result;
+  // Has no GL objects of its own, they belong to the slot
+  struct Map map;
+  struct MapMeshData mesh;
+  // RGB texels of every mip level of the page's color map
+  uint8_t *color_mips[MAX_MIP_LEVELS];
+  int32_t num_mip_levels;
+};
+
+enum WorldPageState {
+  WORLD_PAGE_EMPTY,
+  WORLD_PAGE_LOADING,
+  WORLD_PAGE_RESIDENT,
+  // The page could not be loaded, it is not retried while it stays in a slot
+  WORLD_PAGE_MISSING,
+};
+
+struct WorldPageSlot {
+  int32_t page_x;
+  int32_t page_y;
+  enum WorldPageState state;
+};
+
+struct WorldStreaming;
+
+typedef void (*WorldPageLoadFunction)(void *data,
+                                      struct WorldStreaming *streaming,
+                                      struct WorldPageBuild *build);
+typedef void (*WorldPageUploadFunction)(void *data,
+                                        struct WorldStreaming *streaming,
+                                        struct WorldPageBuild *build);
+
+// Pages of a world too large to keep resident, each drawn on a tile like a
+// map. The camera stays within its tile, camera_page is the page shown there.
+// See world_streaming.c.
+struct WorldStreaming {
+  struct WorldPagesFileHeader header;
+  const char *directory;
+  bool is_available;
+  int32_t camera_page[2];
+  struct WorldPageSlot slots[WORLD_PAGE_SLOT_COUNT];
+  // Map of every slot's page, indexed like slots
+  struct Map maps[WORLD_PAGE_SLOT_COUNT];
+  // Color map of every slot's page, one layer per slot
+  GLuint color_array;
+  // Loads one page at a time, handing build back and forth like FramePipeline
+  struct PlatformThread *thread;
+  struct PlatformSemaphore *work_ready;
+  struct PlatformSemaphore *work_done;
+  WorldPageLoadFunction load;
+  WorldPageUploadFunction upload;
+  void *data;
+  struct WorldPageBuild build;
+  bool busy;
+  bool quit;
 };
 
 struct WorldSection {
   uint32_t section_index;
   int32_t map_x;
   int32_t map_y;
+  // Map drawn on the section's tile this frame, see get_tile_map_index
+  int32_t map_index;
   float camera_distance;
 };
 
+// Number of azimuth bins the horizon around the camera is divided into, must
+// be a power of two
+#define HORIZON_BIN_COUNT 1024
+struct HorizonBuffer {
+  vec3 eye;
+  // Elevation slope (rise over run) of the horizon in each bin, and the
+  // farthest distance at which the terrain that formed it can lie
+  float slopes[HORIZON_BIN_COUNT];
+  float distances[HORIZON_BIN_COUNT];
+};
+
+// Everything the draw commands of a frame are built from, copied so that they
+// can be built on another thread while the game keeps updating
+struct FrameSnapshot {
+  struct Camera camera;
+  struct GameOptions options;
+  int32_t map_index;
+  // Slot of the page on each tile of a streamed world, -1 when it is not
+  // resident. Indexed by (map_x + PVS_TILE_RADIUS) * PVS_TILES_PER_SIDE +
+  // map_y + PVS_TILE_RADIUS.
+  int8_t tile_slots[PVS_TILES_PER_SIDE * PVS_TILES_PER_SIDE];
+  struct RenderingMatrices matrices;
+};
+
+// Visible index ranges allocated per world section. Sections that would not
+// fit are drawn whole instead of by cluster.
+#define DRAW_RANGES_PER_SECTION 16
+
+// Arrays are sized from the number of world sections when the game starts.
+// See create_render_state.
 struct RenderState {
-  struct DrawCommand commands[1024];
   int32_t num_commands;
-  int32_t capacity;
-  struct WorldSection sections_by_distance[1024];
+  int32_t command_capacity;
+  int32_t num_cluster_ranges;
+  int32_t cluster_range_capacity;
   int32_t num_sections;
+  int32_t num_occluded_sections;
+  struct DrawCommand *commands;
+  // Sorted by index range once the commands are built, so that copies of the
+  // same range in different map tiles can be drawn as instances of one draw
+  struct DrawRange *cluster_ranges;
+  struct WorldSection *sections_by_distance;
+  struct HorizonBuffer *horizon;
+  // The snapshot the draw commands were built from
+  struct FrameSnapshot frame;
+};
+
+struct PlatformThread;
+struct PlatformSemaphore;
+
+typedef void (*FramePipelineBuildFunction)(void *data,
+                                           struct FrameSnapshot *frame,
+                                           struct RenderState *render_state);
+
+// Builds a frame's RenderState on a worker thread. See frame_pipeline.c.
+struct FramePipeline {
+  struct PlatformThread *thread;
+  struct PlatformSemaphore *work_ready;
+  struct PlatformSemaphore *work_done;
+  FramePipelineBuildFunction build;
+  void *data;
+  struct FrameSnapshot snapshot;
+  struct RenderState *render_state;
+  bool busy;
+  bool quit;
 };
 
 #define LEFT_CONTROLLER_INDEX 0
 #define RIGHT_CONTROLLER_INDEX 1
 #define MAP_COUNT 30
+
+// Texels along each side of a virtual texture tile. ASTC tiles are made of
+// whole 6x6 blocks.
+#ifdef VR_VOX_USE_ASTC
+#define VIRTUAL_TILE_SIZE 48
+#else
+#define VIRTUAL_TILE_SIZE 64
+#endif
+// Most tiles uploaded into the atlas in a frame
+#define VIRTUAL_TILE_UPLOADS_PER_FRAME 32
+#define VIRTUAL_TEXTURE_ATLAS_UNIT 2
+#define VIRTUAL_TEXTURE_TABLE_UNIT 3
+
+struct VirtualTileSlot {
+  // Index of the tile held by the slot, -1 when it is empty
+  int32_t tile;
+  uint32_t last_used;
+  // The single tile of a map's coarsest level is never evicted, so every
+  // texel has a tile to fall back on
+  bool is_pinned;
+};
+
+struct VirtualTileRequest {
+  int32_t tile;
+  int32_t level;
+  float distance;
+};
+
+// The color maps of every map, split into tiles of each mip level and kept
+// in an atlas sized for the screen instead of the number of maps. See
+// virtual_texture.c.
+struct VirtualTexture {
+  GLuint atlas;
+  // One layer per map, pointing each tile at the atlas slot of the tile or
+  // its nearest resident ancestor
+  GLuint table;
+  // Of every color map at mip 0
+  int32_t width;
+  int32_t height;
+  int32_t num_levels;
+  int32_t level_tiles[MAX_MIP_LEVELS][2];
+  // Index of each level's first tile among a map's tiles
+  int32_t level_first_tile[MAX_MIP_LEVELS];
+  // Row of the table each level starts at
+  int32_t level_first_row[MAX_MIP_LEVELS];
+  int32_t tiles_per_map;
+  int32_t table_rows;
+  int32_t atlas_tiles_per_side;
+  int32_t num_slots;
+  struct VirtualTileSlot *slots;
+  // Slot of every tile of every map, -1 when it is not resident
+  int32_t *tile_slots;
+  // Frame each tile was last requested in
+  uint32_t *tile_requests;
+  struct VirtualTileRequest *requests;
+  int32_t num_requests;
+  int32_t request_capacity;
+  bool dirty_tables[MAP_COUNT];
+  bool is_map_valid[MAP_COUNT];
+  uint16_t (*table_entries)[4];
+  struct Map *maps;
+#ifndef VR_VOX_USE_ASTC
+  // RGB texels of each map's levels, level 0 points into the map's color map
+  uint8_t *level_texels[MAP_COUNT][MAX_MIP_LEVELS];
+#endif
+  uint32_t frame;
+  int32_t num_uploads;
+};
+
+// Columns of the far field panorama, all the way around the camera
+#define FAR_FIELD_COLUMNS 4096
+#define FAR_FIELD_ROWS 256
+// The far field holds the terrain from DISTANCE_FOG_MAX out to this distance,
+// in terrain units
+#define FAR_FIELD_DISTANCE (DISTANCE_FOG_MAX * 4.0f)
+// Where fog starts with the far field, in the same proportion to
+// FAR_FIELD_DISTANCE as DISTANCE_FOG_MIN is to DISTANCE_FOG_MAX
+#define FAR_FIELD_FOG_MIN (FAR_FIELD_DISTANCE * 0.8f)
+// A new panorama is rendered once the camera is this far from the eye of the
+// last one, in terrain units
+#define FAR_FIELD_REFRESH_DISTANCE 32.0f
+#define FAR_FIELD_CYLINDER_SEGMENTS 128
+
+// Cylindrical panorama rendered by render_panorama. Distances are in terrain
+// units.
+struct PanoramaCamera {
+  vec3 eye;
+  float near;
+  float far;
+  // Tangents of the elevation at the top and the bottom of the panorama
+  float tan_top;
+  float tan_bottom;
+  float fog_min;
+  float fog_max;
+  // Distance at which the map repeats
+  float tile_size;
+};
+
+// Threads raycasting a frame, counting the one that hands out the work
+#define RAYCAST_MAX_THREADS 16
+
+// Raycasts render or, when panorama isn't NULL, render_panorama
+struct RaycastJob {
+  struct FrameBuffer *frame;
+  struct ImageBuffer *color_map;
+  struct ImageBuffer *height_map;
+  struct Camera *camera;
+  struct PanoramaCamera *panorama;
+};
+
+struct RaycastPool;
+
+struct RaycastWorker {
+  struct RaycastPool *pool;
+  int32_t band;
+  struct PlatformThread *thread;
+  struct PlatformSemaphore *work_ready;
+};
+
+// Splits the columns of a RaycastJob into a band per thread. The thread
+// calling raycast_in_bands takes the first band, and a worker each other one.
+struct RaycastPool {
+  int32_t thread_count;
+  struct RaycastWorker workers[RAYCAST_MAX_THREADS - 1];
+  struct PlatformSemaphore *work_done;
+  struct RaycastJob job;
+  bool quit;
+};
+
+// Terrain past the meshes, raycast into a panorama on a worker thread while
+// the previous one is drawn behind the meshes. See far_field.c.
+struct FarField {
+  bool is_available;
+  GLuint shader;
+  GLint model_uniform;
+  GLuint texture;
+  GLuint vao;
+  GLuint vbo;
+  // The panorama in texture
+  struct PanoramaCamera shown;
+  int32_t shown_map_index;
+  bool has_panorama;
+  // The panorama being rendered, handed back and forth like FramePipeline
+  struct PanoramaCamera job;
+  struct ImageBuffer *job_color_map;
+  struct ImageBuffer *job_height_map;
+  int32_t job_map_index;
+  struct FrameBuffer frame;
+  struct RaycastPool pool;
+  struct PlatformThread *thread;
+  struct PlatformSemaphore *work_ready;
+  struct PlatformSemaphore *work_done;
+  bool busy;
+  bool quit;
+};
+
 struct Game {
   struct GameOptions options;
   struct Camera camera;
@@ -267,5 +909,11 @@ struct Game {
   struct ControllerState prev_controller[2];
   struct ControllerState controller[2];
   bool trigger_set[2];
-  struct RenderState render_state;
+  // Double buffered so one can be built while the other is drawn
+  struct RenderState render_states[2];
+  struct RenderState *render_state;
+  struct FramePipeline pipeline;
+  struct WorldStreaming streaming;
+  struct VirtualTexture virtual_texture;
+  struct FarField far_field;
 };
@@ -0,0 +1,7 @@
+#pragma once
+#include "types.h"
+
+int32_t count_vertex_cache_misses(const int32_t *indices, int32_t num_indices,
+                                  int32_t *vertex_slots);
+void optimize_vertex_cache(int32_t *indices, int32_t num_indices,
+                           int32_t *vertex_slots);
@@ -0,0 +1,621 @@
+#include "virtual_texture.h"
+#include "assert.h"
+#include "culling.h"
+#include "gl_state.h"
+#include "image.h"
+#include "math.h"
+#include "platform.h"
+#include "string.h"
+#include <stdlib.h>
+
+// Each map's color map is cut into square tiles at every mip level, down to
+// the first level that fits in a single tile. Tiles are uploaded into slots
+// of a fixed size atlas when the terrain needs them, and the table maps every
+// tile to its slot, or to the slot of its nearest resident ancestor. Which
+// tiles are needed is estimated on the CPU from the distance to each drawn
+// section, the same way the GPU picks a mip level for a pixel.
+
+#ifdef VR_VOX_USE_ASTC
+#define ASTC_BLOCK_SIZE 6
+#define ASTC_BLOCK_BYTES 16
+#define TILE_BLOCKS (VIRTUAL_TILE_SIZE / ASTC_BLOCK_SIZE)
+#endif
+
+static int32_t get_color_map_width(struct Map *map) {
+#ifdef VR_VOX_USE_ASTC
+  return map->color_map[0].width;
+#else
+  return map->color_map.width;
+#endif
+}
+
+static int32_t get_color_map_height(struct Map *map) {
+#ifdef VR_VOX_USE_ASTC
+  return map->color_map[0].height;
+#else
+  return map->color_map.height;
+#endif
+}
+
+static int32_t get_level_size(int32_t size, int32_t level) {
+  return size >> level > 0 ? size >> level : 1;
+}
+
+static int32_t get_tile_index(struct VirtualTexture *virtual_texture,
+                              int32_t map_index, int32_t level, int32_t x,
+                              int32_t y) {
+  return map_index * virtual_texture->tiles_per_map +
+         virtual_texture->level_first_tile[level] +
+         y * virtual_texture->level_tiles[level][0] + x;
+}
+
+static void get_tile_coordinates(struct VirtualTexture *virtual_texture,
+                                 int32_t tile, int32_t level,
+                                 int32_t *map_index, int32_t *x, int32_t *y) {
+  *map_index = tile / virtual_texture->tiles_per_map;
+  int32_t level_tile = tile % virtual_texture->tiles_per_map -
+                       virtual_texture->level_first_tile[level];
+  *x = level_tile % virtual_texture->level_tiles[level][0];
+  *y = level_tile / virtual_texture->level_tiles[level][0];
+}
+
+/*!
+ * Terrain units covered by a texel of the finest level, along the axis where
+ * texels are smallest.
+ */
+static float get_texel_size(struct VirtualTexture *virtual_texture) {
+  int32_t size = virtual_texture->width > virtual_texture->height
+                     ? virtual_texture->width
+                     : virtual_texture->height;
+  return (float)BASE_MAP_SIZE / size;
+}
+
+/*!
+ * The finest level sampled at a distance, where a pixel covers at least a
+ * texel of the level.
+ *
+ * @param[in]  virtual_texture
+ * @param[in]  distance         In terrain units
+ * @param[in]  projection_scale Pixels covered by a unit long edge one unit in
+ *                              front of the camera
+ */
+static int32_t get_distance_level(struct VirtualTexture *virtual_texture,
+                                  float distance, float projection_scale) {
+  float texels_per_pixel =
+      distance / (projection_scale * get_texel_size(virtual_texture));
+  if (texels_per_pixel < 2.0f) {
+    return 0;
+  }
+  int32_t level = (int32_t)floorf(log2f(texels_per_pixel));
+  return level < virtual_texture->num_levels - 1
+             ? level
+             : virtual_texture->num_levels - 1;
+}
+
+/*!
+ * Estimates how many tiles can be needed at once, from the area of the ring
+ * of distances each level is sampled at out to the fog.
+ */
+static int32_t estimate_slot_count(struct VirtualTexture *virtual_texture,
+                                   float projection_scale) {
+  float texel_size = get_texel_size(virtual_texture);
+  float num_tiles = 0.0f;
+  float inner = 0.0f;
+  for (int32_t level = 0;
+       level < virtual_texture->num_levels && inner < DISTANCE_FOG_MAX;
+       ++level) {
+    float outer = DISTANCE_FOG_MAX;
+    if (level < virtual_texture->num_levels - 1) {
+      outer = fminf(texel_size * (float)(2 << level) * projection_scale,
+                    DISTANCE_FOG_MAX);
+    }
+    float tile_size = texel_size * VIRTUAL_TILE_SIZE * (float)(1 << level);
+    num_tiles += (float)M_PI * (outer * outer - inner * inner) /
+                 (tile_size * tile_size);
+    inner = outer;
+  }
+
+  // Tiles straddle the edges of the rings and bring their ancestors with
+  // them, so leave room for twice as many, plus every map's pinned tile
+  return (int32_t)ceilf(num_tiles * 2.0f) + MAP_COUNT;
+}
+
+static bool is_map_compatible(struct VirtualTexture *virtual_texture,
+                              struct Map *map) {
+  if (get_color_map_width(map) != virtual_texture->width ||
+      get_color_map_height(map) != virtual_texture->height) {
+    return false;
+  }
+#ifdef VR_VOX_USE_ASTC
+  return map->num_mip_levels >= (uint32_t)virtual_texture->num_levels;
+#else
+  return map->color_map.pixels != NULL && map->color_map.num_channels == 3;
+#endif
+}
+
+static void upload_tile(struct VirtualTexture *virtual_texture, int32_t tile,
+                        int32_t level, int32_t slot) {
+  int32_t map_index, x, y;
+  get_tile_coordinates(virtual_texture, tile, level, &map_index, &x, &y);
+  int32_t atlas_x =
+      (slot % virtual_texture->atlas_tiles_per_side) * VIRTUAL_TILE_SIZE;
+  int32_t atlas_y =
+      (slot / virtual_texture->atlas_tiles_per_side) * VIRTUAL_TILE_SIZE;
+  bind_texture_for_update(VIRTUAL_TEXTURE_ATLAS_UNIT, GL_TEXTURE_2D,
+                          virtual_texture->atlas);
+
+#ifdef VR_VOX_USE_ASTC
+  // Blocks past the edge of the level are left zero, they are never sampled
+  struct AstcImageBuffer *image =
+      &virtual_texture->maps[map_index].color_map[level];
+  uint8_t blocks[TILE_BLOCKS * TILE_BLOCKS * ASTC_BLOCK_BYTES] = {0};
+  for (int32_t row = 0; row < TILE_BLOCKS; ++row) {
+    int32_t block_y = y * TILE_BLOCKS + row;
+    if (block_y >= (int32_t)image->num_blocks_y) {
+      break;
+    }
+    for (int32_t column = 0; column < TILE_BLOCKS; ++column) {
+      int32_t block_x = x * TILE_BLOCKS + column;
+      if (block_x >= (int32_t)image->num_blocks_x) {
+        break;
+      }
+      memcpy(&blocks[(row * TILE_BLOCKS + column) * ASTC_BLOCK_BYTES],
+             &image->image_data[(block_y * image->num_blocks_x + block_x) *
+                                ASTC_BLOCK_BYTES],
+             ASTC_BLOCK_BYTES);
+    }
+  }
+  glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, atlas_x, atlas_y,
+                            VIRTUAL_TILE_SIZE, VIRTUAL_TILE_SIZE,
+                            GL_COMPRESSED_RGBA_ASTC_6x6_KHR, sizeof(blocks),
+                            blocks);
+#else
+  int32_t level_width = get_level_size(virtual_texture->width, level);
+  int32_t level_height = get_level_size(virtual_texture->height, level);
+  int32_t tile_x = x * VIRTUAL_TILE_SIZE;
+  int32_t tile_y = y * VIRTUAL_TILE_SIZE;
+  int32_t width = level_width - tile_x < VIRTUAL_TILE_SIZE
+                      ? level_width - tile_x
+                      : VIRTUAL_TILE_SIZE;
+  int32_t height = level_height - tile_y < VIRTUAL_TILE_SIZE
+                       ? level_height - tile_y
+                       : VIRTUAL_TILE_SIZE;
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, level_width);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, tile_x);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, tile_y);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, atlas_x, atlas_y, width, height, GL_RGB,
+                  GL_UNSIGNED_BYTE,
+                  virtual_texture->level_texels[map_index][level]);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+#endif
+}
+
+/*!
+ * Points every tile of a map at its slot, or its parent's when it has none.
+ * Levels are visited coarsest first, so a parent's entry is always written
+ * before its children read it.
+ */
+static void update_table(struct VirtualTexture *virtual_texture,
+                         int32_t map_index) {
+  int32_t table_width = virtual_texture->level_tiles[0][0];
+  uint16_t(*entries)[4] = virtual_texture->table_entries;
+  if (!virtual_texture->is_map_valid[map_index]) {
+    memset(entries, 0,
+           sizeof(entries[0]) * table_width * virtual_texture->table_rows);
+  }
+
+  for (int32_t level = virtual_texture->num_levels - 1;
+       level >= 0 && virtual_texture->is_map_valid[map_index]; --level) {
+    int32_t first_row = virtual_texture->level_first_row[level];
+    for (int32_t y = 0; y < virtual_texture->level_tiles[level][1]; ++y) {
+      for (int32_t x = 0; x < virtual_texture->level_tiles[level][0]; ++x) {
+        uint16_t *entry = entries[(first_row + y) * table_width + x];
+        int32_t slot = virtual_texture->tile_slots[get_tile_index(
+            virtual_texture, map_index, level, x, y)];
+        if (slot >= 0) {
+          entry[0] = (uint16_t)(slot % virtual_texture->atlas_tiles_per_side);
+          entry[1] = (uint16_t)(slot / virtual_texture->atlas_tiles_per_side);
+          entry[2] = (uint16_t)level;
+          entry[3] = 0;
+        } else {
+          assert(level < virtual_texture->num_levels - 1);
+          int32_t parent_row =
+              virtual_texture->level_first_row[level + 1] + y / 2;
+          memcpy(entry, entries[parent_row * table_width + x / 2],
+                 sizeof(entries[0]));
+        }
+      }
+    }
+  }
+
+  bind_texture_for_update(VIRTUAL_TEXTURE_TABLE_UNIT, GL_TEXTURE_2D_ARRAY,
+                          virtual_texture->table);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+  glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, map_index, table_width,
+                  virtual_texture->table_rows, 1, GL_RGBA_INTEGER,
+                  GL_UNSIGNED_SHORT, entries);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  virtual_texture->dirty_tables[map_index] = false;
+}
+
+static void place_tile(struct VirtualTexture *virtual_texture, int32_t tile,
+                       int32_t level, int32_t slot) {
+  struct VirtualTileSlot *tile_slot = &virtual_texture->slots[slot];
+  if (tile_slot->tile >= 0) {
+    virtual_texture->tile_slots[tile_slot->tile] = -1;
+    virtual_texture
+        ->dirty_tables[tile_slot->tile / virtual_texture->tiles_per_map] = true;
+  }
+
+  upload_tile(virtual_texture, tile, level, slot);
+  tile_slot->tile = tile;
+  tile_slot->last_used = virtual_texture->frame;
+  virtual_texture->tile_slots[tile] = slot;
+  virtual_texture->dirty_tables[tile / virtual_texture->tiles_per_map] = true;
+}
+
+/*!
+ * Creates the atlas and the table, and uploads the coarsest tile of every
+ * map. The atlas holds the tiles a framebuffer with projection_scale can
+ * sample at once, up to the largest texture the GL supports.
+ *
+ * @param[out] virtual_texture
+ * @param[in]  maps             Kept by virtual_texture. Every map's color map
+ *                              must be the size of the first map's, other
+ *                              maps are drawn with garbage colors.
+ * @param[in]  projection_scale Pixels covered by a unit long edge one unit in
+ *                              front of the camera
+ * @return GAME_ERROR when the first map has no color map to tile
+ */
+int32_t create_virtual_texture(struct VirtualTexture *virtual_texture,
+                               struct Map maps[MAP_COUNT],
+                               float projection_scale) {
+  memset(virtual_texture, 0, sizeof(*virtual_texture));
+  virtual_texture->maps = maps;
+  virtual_texture->width = get_color_map_width(&maps[0]);
+  virtual_texture->height = get_color_map_height(&maps[0]);
+  if (virtual_texture->width <= 0 || virtual_texture->height <= 0) {
+    return GAME_ERROR;
+  }
+
+  for (int32_t level = 0; level < MAX_MIP_LEVELS; ++level) {
+    int32_t tiles_x =
+        (get_level_size(virtual_texture->width, level) + VIRTUAL_TILE_SIZE -
+         1) /
+        VIRTUAL_TILE_SIZE;
+    int32_t tiles_y =
+        (get_level_size(virtual_texture->height, level) + VIRTUAL_TILE_SIZE -
+         1) /
+        VIRTUAL_TILE_SIZE;
+    virtual_texture->level_tiles[level][0] = tiles_x;
+    virtual_texture->level_tiles[level][1] = tiles_y;
+    virtual_texture->level_first_tile[level] = virtual_texture->tiles_per_map;
+    virtual_texture->level_first_row[level] = virtual_texture->table_rows;
+    virtual_texture->tiles_per_map += tiles_x * tiles_y;
+    virtual_texture->table_rows += tiles_y;
+    virtual_texture->num_levels = level + 1;
+    if (tiles_x == 1 && tiles_y == 1) {
+      break;
+    }
+  }
+
+  for (int32_t i = 0; i < MAP_COUNT; ++i) {
+    virtual_texture->is_map_valid[i] =
+        is_map_compatible(virtual_texture, &maps[i]);
+    if (!virtual_texture->is_map_valid[i]) {
+      error("Color map of map %d can not be virtually textured\n", i);
+    }
+  }
+  if (!virtual_texture->is_map_valid[0]) {
+    return GAME_ERROR;
+  }
+
+#ifndef VR_VOX_USE_ASTC
+  for (int32_t i = 0; i < MAP_COUNT; ++i) {
+    if (!virtual_texture->is_map_valid[i]) {
+      continue;
+    }
+    uint8_t **level_texels = virtual_texture->level_texels[i];
+    level_texels[0] = maps[i].color_map.pixels;
+    for (int32_t level = 1; level < virtual_texture->num_levels; ++level) {
+      level_texels[level] = downsample_color(
+          level_texels[level - 1],
+          get_level_size(virtual_texture->width, level - 1),
+          get_level_size(virtual_texture->height, level - 1));
+    }
+  }
+#endif
+
+  GLint max_texture_size;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  int32_t num_slots = estimate_slot_count(virtual_texture, projection_scale);
+  int32_t tiles_per_side = (int32_t)ceilf(sqrtf((float)num_slots));
+  if (tiles_per_side > max_texture_size / VIRTUAL_TILE_SIZE) {
+    tiles_per_side = max_texture_size / VIRTUAL_TILE_SIZE;
+  }
+  virtual_texture->atlas_tiles_per_side = tiles_per_side;
+  virtual_texture->num_slots = tiles_per_side * tiles_per_side;
+  int32_t atlas_size = tiles_per_side * VIRTUAL_TILE_SIZE;
+  info("Virtual texture atlas holds %d tiles, %dx%d texels\n",
+       virtual_texture->num_slots, atlas_size, atlas_size);
+
+  glGenTextures(1, &virtual_texture->atlas);
+  bind_texture_for_update(VIRTUAL_TEXTURE_ATLAS_UNIT, GL_TEXTURE_2D,
+                          virtual_texture->atlas);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+#ifdef VR_VOX_USE_ASTC
+  glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_ASTC_6x6_KHR,
+                         atlas_size, atlas_size, 0,
+                         (atlas_size / ASTC_BLOCK_SIZE) *
+                             (atlas_size / ASTC_BLOCK_SIZE) * ASTC_BLOCK_BYTES,
+                         NULL);
+#else
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, atlas_size, atlas_size, 0, GL_RGB,
+               GL_UNSIGNED_BYTE, NULL);
+#endif
+
+  glGenTextures(1, &virtual_texture->table);
+  bind_texture_for_update(VIRTUAL_TEXTURE_TABLE_UNIT, GL_TEXTURE_2D_ARRAY,
+                          virtual_texture->table);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16UI,
+               virtual_texture->level_tiles[0][0], virtual_texture->table_rows,
+               MAP_COUNT, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, NULL);
+
+  int32_t num_tiles = virtual_texture->tiles_per_map * MAP_COUNT;
+  virtual_texture->slots =
+      malloc(sizeof(struct VirtualTileSlot) * virtual_texture->num_slots);
+  for (int32_t i = 0; i < virtual_texture->num_slots; ++i) {
+    virtual_texture->slots[i] =
+        (struct VirtualTileSlot){.tile = -1, .last_used = 0};
+  }
+  virtual_texture->tile_slots = malloc(sizeof(int32_t) * num_tiles);
+  for (int32_t i = 0; i < num_tiles; ++i) {
+    virtual_texture->tile_slots[i] = -1;
+  }
+  virtual_texture->tile_requests = calloc(num_tiles, sizeof(uint32_t));
+  virtual_texture->request_capacity = virtual_texture->num_slots;
+  virtual_texture->requests = malloc(sizeof(struct VirtualTileRequest) *
+                                     virtual_texture->request_capacity);
+  virtual_texture->table_entries =
+      malloc(sizeof(virtual_texture->table_entries[0]) *
+             virtual_texture->level_tiles[0][0] * virtual_texture->table_rows);
+  virtual_texture->frame = 1;
+
+  int32_t root_level = virtual_texture->num_levels - 1;
+  int32_t num_pinned = 0;
+  for (int32_t i = 0; i < MAP_COUNT && num_pinned < virtual_texture->num_slots;
+       ++i) {
+    if (virtual_texture->is_map_valid[i]) {
+      place_tile(virtual_texture,
+                 get_tile_index(virtual_texture, i, root_level, 0, 0),
+                 root_level, num_pinned);
+      virtual_texture->slots[num_pinned].is_pinned = true;
+      ++num_pinned;
+    }
+    virtual_texture->dirty_tables[i] = true;
+  }
+  for (int32_t i = 0; i < MAP_COUNT; ++i) {
+    update_table(virtual_texture, i);
+  }
+
+  return GAME_SUCCESS;
+}
+
+void free_virtual_texture(struct VirtualTexture *virtual_texture) {
+#ifndef VR_VOX_USE_ASTC
+  for (int32_t i = 0; i < MAP_COUNT; ++i) {
+    // Level 0 belongs to the map
+    for (int32_t level = 1; level < MAX_MIP_LEVELS; ++level) {
+      if (virtual_texture->level_texels[i][level] != NULL) {
+        free(virtual_texture->level_texels[i][level]);
+        virtual_texture->level_texels[i][level] = NULL;
+      }
+    }
+  }
+#endif
+  free(virtual_texture->slots);
+  virtual_texture->slots = NULL;
+  free(virtual_texture->tile_slots);
+  virtual_texture->tile_slots = NULL;
+  free(virtual_texture->tile_requests);
+  virtual_texture->tile_requests = NULL;
+  free(virtual_texture->requests);
+  virtual_texture->requests = NULL;
+  free(virtual_texture->table_entries);
+  virtual_texture->table_entries = NULL;
+}
+
+/*!
+ * Marks a tile and its ancestors as used this frame, and queues the ones that
+ * are not resident. A tile requested earlier in the frame already had its
+ * ancestors requested.
+ */
+static void request_tile(struct VirtualTexture *virtual_texture,
+                         int32_t map_index, int32_t level, int32_t x,
+                         int32_t y, float distance) {
+  for (; level < virtual_texture->num_levels; ++level, x /= 2, y /= 2) {
+    int32_t tile = get_tile_index(virtual_texture, map_index, level, x, y);
+    if (virtual_texture->tile_requests[tile] == virtual_texture->frame) {
+      return;
+    }
+    virtual_texture->tile_requests[tile] = virtual_texture->frame;
+
+    int32_t slot = virtual_texture->tile_slots[tile];
+    if (slot >= 0) {
+      virtual_texture->slots[slot].last_used = virtual_texture->frame;
+    } else if (virtual_texture->num_requests <
+               virtual_texture->request_capacity) {
+      virtual_texture->requests[virtual_texture->num_requests++] =
+          (struct VirtualTileRequest){
+              .tile = tile, .level = level, .distance = distance};
+    }
+  }
+}
+
+/*!
+ * Requests the tiles of a map that a box on it samples this frame. Each tile
+ * the box overlaps is requested at the level its own distance needs.
+ *
+ * @param[in]  virtual_texture
+ * @param[in]  map_index
+ * @param[in]  box_min          In the map's space, in terrain units
+ * @param[in]  box_max
+ * @param[in]  camera_position  In the map's space, in terrain units
+ * @param[in]  projection_scale Pixels covered by a unit long edge one unit in
+ *                              front of the camera
+ */
+void request_virtual_tiles(struct VirtualTexture *virtual_texture,
+                           int32_t map_index, vec3 box_min, vec3 box_max,
+                           vec3 camera_position, float projection_scale) {
+  if (!virtual_texture->is_map_valid[map_index]) {
+    return;
+  }
+
+  int32_t level = get_distance_level(
+      virtual_texture,
+      get_box_distance(camera_position, box_min, box_max), projection_scale);
+  int32_t tiles_x = virtual_texture->level_tiles[level][0];
+  int32_t tiles_y = virtual_texture->level_tiles[level][1];
+  // A texel of the level covers 2^level texels of the finest one
+  float tile_width = (float)BASE_MAP_SIZE * VIRTUAL_TILE_SIZE * (1 << level) /
+                     virtual_texture->width;
+  float tile_height = (float)BASE_MAP_SIZE * VIRTUAL_TILE_SIZE *
+                      (1 << level) / virtual_texture->height;
+  int32_t x0 = clamp_i((int32_t)floorf(box_min[0] / tile_width), 0,
+                       tiles_x - 1);
+  int32_t x1 = clamp_i((int32_t)floorf(box_max[0] / tile_width), 0,
+                       tiles_x - 1);
+  int32_t y0 = clamp_i((int32_t)floorf(box_min[2] / tile_height), 0,
+                       tiles_y - 1);
+  int32_t y1 = clamp_i((int32_t)floorf(box_max[2] / tile_height), 0,
+                       tiles_y - 1);
+
+  for (int32_t y = y0; y <= y1; ++y) {
+    for (int32_t x = x0; x <= x1; ++x) {
+      vec3 tile_min = {x * tile_width, box_min[1], y * tile_height};
+      vec3 tile_max = {(x + 1) * tile_width, box_max[1],
+                       (y + 1) * tile_height};
+      float distance = get_box_distance(camera_position, tile_min, tile_max);
+      int32_t tile_level =
+          get_distance_level(virtual_texture, distance, projection_scale);
+      if (tile_level < level) {
+        tile_level = level;
+      }
+      request_tile(virtual_texture, map_index, tile_level,
+                   x >> (tile_level - level), y >> (tile_level - level),
+                   distance);
+    }
+  }
+}
+
+// Coarser tiles first, so that every tile sampled soon has some parent, then
+// nearer tiles first
+static int compare_tile_requests(const void *a, const void *b) {
+  const struct VirtualTileRequest *request_a = a;
+  const struct VirtualTileRequest *request_b = b;
+  if (request_a->level != request_b->level) {
+    return request_b->level - request_a->level;
+  }
+  if (request_a->distance != request_b->distance) {
+    return request_a->distance < request_b->distance ? -1 : 1;
+  }
+  return request_a->tile - request_b->tile;
+}
+
+/*!
+ * @return an empty slot, or else the least recently used slot that was not
+ *         used this frame, or -1 when every slot is in use
+ */
+static int32_t find_free_slot(struct VirtualTexture *virtual_texture) {
+  int32_t oldest = -1;
+  for (int32_t i = 0; i < virtual_texture->num_slots; ++i) {
+    struct VirtualTileSlot *slot = &virtual_texture->slots[i];
+    if (slot->tile < 0) {
+      return i;
+    }
+    if (slot->is_pinned || slot->last_used == virtual_texture->frame) {
+      continue;
+    }
+    if (oldest < 0 ||
+        slot->last_used < virtual_texture->slots[oldest].last_used) {
+      oldest = i;
+    }
+  }
+  return oldest;
+}
+
+/*!
+ * Uploads the tiles requested this frame, up to
+ * VIRTUAL_TILE_UPLOADS_PER_FRAME of them, evicting the least recently used
+ * ones to make room, and updates the tables of the maps that changed. Until a
+ * tile is uploaded its texels are sampled from its nearest resident ancestor.
+ */
+void update_virtual_texture(struct VirtualTexture *virtual_texture) {
+  qsort(virtual_texture->requests, virtual_texture->num_requests,
+        sizeof(virtual_texture->requests[0]), compare_tile_requests);
+
+  virtual_texture->num_uploads = 0;
+  for (int32_t i = 0; i < virtual_texture->num_requests &&
+                      virtual_texture->num_uploads <
+                          VIRTUAL_TILE_UPLOADS_PER_FRAME;
+       ++i) {
+    int32_t slot = find_free_slot(virtual_texture);
+    if (slot < 0) {
+      break;
+    }
+    struct VirtualTileRequest *request = &virtual_texture->requests[i];
+    place_tile(virtual_texture, request->tile, request->level, slot);
+    ++virtual_texture->num_uploads;
+  }
+  virtual_texture->num_requests = 0;
+
+  for (int32_t i = 0; i < MAP_COUNT; ++i) {
+    if (virtual_texture->dirty_tables[i]) {
+      update_table(virtual_texture, i);
+    }
+  }
+  ++virtual_texture->frame;
+}
+
+/*!
+ * Points a program's virtual texture samplers at their units. Every program
+ * declaring them needs this even when it samples the color map array, since
+ * samplers of different types must not share a unit.
+ */
+void set_virtual_texture_units(GLuint program) {
+  use_program(program);
+  glUniform1i(glGetUniformLocation(program, "virtualAtlas"),
+              VIRTUAL_TEXTURE_ATLAS_UNIT);
+  glUniform1i(glGetUniformLocation(program, "virtualTable"),
+              VIRTUAL_TEXTURE_TABLE_UNIT);
+}
+
+/*!
+ * Sets the layout of the virtual texture in a program that samples it.
+ * Programs without the uniform are left alone.
+ */
+void set_virtual_texture_layout(struct VirtualTexture *virtual_texture,
+                                GLuint program) {
+  if (!program) {
+    return;
+  }
+  use_program(program);
+  glUniform4i(glGetUniformLocation(program, "virtualLayout"),
+              virtual_texture->width, virtual_texture->height,
+              VIRTUAL_TILE_SIZE, virtual_texture->num_levels);
+  count_uniform_uploads(1);
+}
+
+void bind_virtual_texture(struct VirtualTexture *virtual_texture) {
+  bind_texture(VIRTUAL_TEXTURE_ATLAS_UNIT, GL_TEXTURE_2D,
+               virtual_texture->atlas);
+  bind_texture(VIRTUAL_TEXTURE_TABLE_UNIT, GL_TEXTURE_2D_ARRAY,
+               virtual_texture->table);
+}
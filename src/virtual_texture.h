@@ -0,0 +1,15 @@
+#pragma once
+#include "types.h"
+
+int32_t create_virtual_texture(struct VirtualTexture *virtual_texture,
+                               struct Map maps[MAP_COUNT],
+                               float projection_scale);
+void free_virtual_texture(struct VirtualTexture *virtual_texture);
+void request_virtual_tiles(struct VirtualTexture *virtual_texture,
+                           int32_t map_index, vec3 box_min, vec3 box_max,
+                           vec3 camera_position, float projection_scale);
+void update_virtual_texture(struct VirtualTexture *virtual_texture);
+void set_virtual_texture_units(GLuint program);
+void set_virtual_texture_layout(struct VirtualTexture *virtual_texture,
+                                GLuint program);
+void bind_virtual_texture(struct VirtualTexture *virtual_texture);
@@ -0,0 +1,26 @@
+#pragma once
+#include "stdint.h"
+
+// A world too large to keep resident, split offline by page_baker into map
+// sized pages that are streamed in around the camera. Kept free of GL and
+// cglm so the baker can include it.
+
+#define WORLD_PAGES_MAGIC 0x31504757 // "WGP1"
+
+// Stored as world.pages in the world's directory, next to a <x>_<y>.page file
+// for every page, where x counts pages along the world's width
+struct WorldPagesFileHeader {
+  uint32_t magic;
+  uint32_t pages_x;
+  uint32_t pages_y;
+  // Height and color texels along each side of a page
+  uint32_t page_size;
+};
+
+// Each page file holds (page_size + 1)^2 heights, row major, whose last row
+// and column are the first ones of the next pages so that pages meet without
+// seams, followed by page_size^2 RGB color texels, row major
+#define WORLD_PAGE_GRID_SIZE(page_size) ((page_size) + 1)
+#define WORLD_PAGE_FILE_SIZE(page_size)                                        \
+  (WORLD_PAGE_GRID_SIZE(page_size) * WORLD_PAGE_GRID_SIZE(page_size) +         \
+   (page_size) * (page_size) * 3)
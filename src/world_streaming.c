@@ -0,0 +1,387 @@
+#include "world_streaming.h"
+#include "assert.h"
+#include "file.h"
+#include "float.h"
+#include "math.h"
+#include "platform.h"
+#include "stdio.h"
+#include "string.h"
+#include <stdlib.h>
+
+// Pages are loaded on a worker thread one at a time, and handed back to the
+// render thread to upload into a slot. Only the render thread touches the
+// slots, and only while the frame pipeline is idle, since its worker reads the
+// maps of resident pages.
+
+static int run_world_streaming(void *data) {
+  struct WorldStreaming *streaming = data;
+  for (;;) {
+    wait_semaphore(streaming->work_ready);
+    if (streaming->quit) {
+      break;
+    }
+
+    streaming->load(streaming->data, streaming, &streaming->build);
+    post_semaphore(streaming->work_done);
+  }
+
+  return 0;
+}
+
+static bool read_world_header(struct WorldStreaming *streaming) {
+  char filename[256];
+  snprintf(filename, sizeof(filename), "%s/world.pages", streaming->directory);
+  if (!file_exists(filename)) {
+    return false;
+  }
+
+  uint8_t *data = NULL;
+  uint32_t size = read_binary_file(filename, &data);
+  bool is_valid = size == sizeof(streaming->header);
+  if (is_valid) {
+    memcpy(&streaming->header, data, sizeof(streaming->header));
+    struct WorldPagesFileHeader *header = &streaming->header;
+    // Pages are meshed like maps, whose sizes are powers of two no larger
+    // than BASE_MAP_SIZE
+    uint32_t page_size = header->page_size;
+    is_valid = header->magic == WORLD_PAGES_MAGIC && header->pages_x > 0 &&
+               header->pages_y > 0 && page_size >= 256 &&
+               page_size <= BASE_MAP_SIZE && (page_size & (page_size - 1)) == 0;
+  }
+  free(data);
+
+  if (!is_valid) {
+    error("%s is not a valid world\n", filename);
+  }
+  return is_valid;
+}
+
+/*!
+ * Starts a worker thread that loads pages of the world in directory. The world
+ * is unavailable, without an error, when directory has no world.pages.
+ *
+ * @param[out] streaming
+ * @param[in]  directory Must outlive streaming
+ * @param[in]  load      Called on the worker for every requested page
+ * @param[in]  upload    Called on the render thread for every loaded page,
+ *                       with the page's slot in build
+ * @param[in]  data      Passed to load and upload
+ */
+int32_t create_world_streaming(struct WorldStreaming *streaming,
+                               const char *directory,
+                               WorldPageLoadFunction load,
+                               WorldPageUploadFunction upload, void *data) {
+  memset(streaming, 0, sizeof(*streaming));
+  streaming->directory = directory;
+  streaming->load = load;
+  streaming->upload = upload;
+  streaming->data = data;
+  if (!read_world_header(streaming)) {
+    return GAME_SUCCESS;
+  }
+
+  streaming->work_ready = create_semaphore(0);
+  streaming->work_done = create_semaphore(0);
+  if (streaming->work_ready == NULL || streaming->work_done == NULL) {
+    error("Could not create world streaming semaphores\n");
+    return GAME_ERROR;
+  }
+
+  streaming->thread =
+      create_thread(run_world_streaming, "world_streaming", streaming);
+  if (streaming->thread == NULL) {
+    return GAME_ERROR;
+  }
+
+  streaming->is_available = true;
+  info("Streaming a world of %ux%u pages of %u texels from %s\n",
+       streaming->header.pages_x, streaming->header.pages_y,
+       streaming->header.page_size, directory);
+  return GAME_SUCCESS;
+}
+
+static void release_page_map(struct Map *map) {
+  free(map->height_map.pixels);
+  map->height_map.pixels = NULL;
+  free(map->clusters);
+  map->clusters = NULL;
+}
+
+static void release_page_build(struct WorldPageBuild *build) {
+  free(build->mesh.block_vertices);
+  free(build->mesh.block_morph_targets);
+  free(build->mesh.packed_indices);
+  memset(&build->mesh, 0, sizeof(build->mesh));
+  for (int32_t i = 0; i < build->num_mip_levels; ++i) {
+    free(build->color_mips[i]);
+    build->color_mips[i] = NULL;
+  }
+  build->num_mip_levels = 0;
+}
+
+/*!
+ * Stops the worker and frees the CPU side of every page. The slots' GL objects
+ * are left to the context.
+ */
+void free_world_streaming(struct WorldStreaming *streaming) {
+  if (streaming->thread != NULL) {
+    if (streaming->busy) {
+      wait_semaphore(streaming->work_done);
+      streaming->busy = false;
+      release_page_map(&streaming->build.map);
+      release_page_build(&streaming->build);
+    }
+    streaming->quit = true;
+    post_semaphore(streaming->work_ready);
+    join_thread(streaming->thread);
+    streaming->thread = NULL;
+  }
+
+  if (streaming->work_ready != NULL) {
+    destroy_semaphore(streaming->work_ready);
+    streaming->work_ready = NULL;
+  }
+
+  if (streaming->work_done != NULL) {
+    destroy_semaphore(streaming->work_done);
+    streaming->work_done = NULL;
+  }
+
+  for (int32_t i = 0; i < WORLD_PAGE_SLOT_COUNT; ++i) {
+    release_page_map(&streaming->maps[i]);
+    streaming->slots[i].state = WORLD_PAGE_EMPTY;
+  }
+  streaming->is_available = false;
+}
+
+/*!
+ * Reads a page file, checking it has the size the header's page size needs.
+ * Safe to call from the worker.
+ *
+ * @return the page's heights followed by its color texels, to be freed by the
+ *         caller, or NULL when it could not be read
+ */
+uint8_t *read_world_page(struct WorldStreaming *streaming, int32_t page_x,
+                         int32_t page_y) {
+  char filename[256];
+  snprintf(filename, sizeof(filename), "%s/%d_%d.page", streaming->directory,
+           page_x, page_y);
+  uint8_t *data = NULL;
+  uint32_t size = read_binary_file(filename, &data);
+  if (data == NULL) {
+    return NULL;
+  }
+
+  if (size != WORLD_PAGE_FILE_SIZE(streaming->header.page_size)) {
+    error("World page %s has %u bytes instead of %u\n", filename, size,
+          WORLD_PAGE_FILE_SIZE(streaming->header.page_size));
+    free(data);
+    return NULL;
+  }
+  return data;
+}
+
+static int32_t wrap_page(int32_t page, uint32_t count) {
+  return (page % (int32_t)count + (int32_t)count) % (int32_t)count;
+}
+
+/*!
+ * Moves the camera to the next page when it wraps around its tile. The world
+ * wraps around at its edges like a single map does.
+ *
+ * @param[in]  streaming
+ * @param[in]  x         Pages the camera moved along x
+ * @param[in]  y         Pages the camera moved along z
+ */
+void move_world_camera_page(struct WorldStreaming *streaming, int32_t x,
+                            int32_t y) {
+  if (!streaming->is_available) {
+    return;
+  }
+  streaming->camera_page[0] =
+      wrap_page(streaming->camera_page[0] + x, streaming->header.pages_x);
+  streaming->camera_page[1] =
+      wrap_page(streaming->camera_page[1] + y, streaming->header.pages_y);
+}
+
+/*!
+ * Uploads the page the worker finished, if any, and makes it resident in its
+ * slot, which takes over its height map and clusters.
+ */
+static void finish_world_page(struct WorldStreaming *streaming) {
+  if (!streaming->busy || !try_wait_semaphore(streaming->work_done)) {
+    return;
+  }
+  streaming->busy = false;
+
+  struct WorldPageBuild *build = &streaming->build;
+  struct WorldPageSlot *slot = &streaming->slots[build->slot];
+  assert(slot->state == WORLD_PAGE_LOADING);
+  if (build->result == GAME_ERROR) {
+    slot->state = WORLD_PAGE_MISSING;
+    release_page_map(&build->map);
+  } else {
+    streaming->upload(streaming->data, streaming, build);
+    struct Map *map = &streaming->maps[build->slot];
+    map->height_map = build->map.height_map;
+    map->modifier = build->map.modifier;
+    memcpy(map->sections, build->map.sections, sizeof(map->sections));
+    map->clusters = build->map.clusters;
+    slot->state = WORLD_PAGE_RESIDENT;
+  }
+  release_page_build(build);
+}
+
+// Finds the page drawn on the world tile at map_x, map_y
+static void get_tile_page(struct WorldStreaming *streaming, int32_t map_x,
+                          int32_t map_y, int32_t page[2]) {
+  page[0] = wrap_page(streaming->camera_page[0] + map_x,
+                      streaming->header.pages_x);
+  page[1] = wrap_page(streaming->camera_page[1] + map_y,
+                      streaming->header.pages_y);
+}
+
+static int32_t find_page_slot(struct WorldStreaming *streaming,
+                              int32_t page[2]) {
+  for (int32_t i = 0; i < WORLD_PAGE_SLOT_COUNT; ++i) {
+    struct WorldPageSlot *slot = &streaming->slots[i];
+    if (slot->state != WORLD_PAGE_EMPTY && slot->page_x == page[0] &&
+        slot->page_y == page[1]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*!
+ * @return the distance from the camera to the nearest point of a tile, in
+ *         terrain units
+ */
+static float get_tile_distance(int32_t map_x, int32_t map_y,
+                               vec3 camera_position) {
+  float tile_min[2] = {map_x * (float)BASE_MAP_SIZE,
+                       map_y * (float)BASE_MAP_SIZE};
+  float camera[2] = {camera_position[0], camera_position[2]};
+  float distance_squared = 0.0f;
+  for (int32_t i = 0; i < 2; ++i) {
+    float outside = 0.0f;
+    if (camera[i] < tile_min[i]) {
+      outside = tile_min[i] - camera[i];
+    } else if (camera[i] > tile_min[i] + BASE_MAP_SIZE) {
+      outside = camera[i] - (tile_min[i] + BASE_MAP_SIZE);
+    }
+    distance_squared += outside * outside;
+  }
+  return sqrtf(distance_squared);
+}
+
+// Offset of a page from the camera's page the short way around the world
+static int32_t get_page_offset(int32_t page, int32_t camera_page,
+                               uint32_t count) {
+  int32_t offset = wrap_page(page - camera_page, count);
+  return offset > (int32_t)count / 2 ? offset - (int32_t)count : offset;
+}
+
+// FLT_MAX when the page is on no tile around the camera
+static float get_page_distance(struct WorldStreaming *streaming,
+                               struct WorldPageSlot *slot,
+                               vec3 camera_position) {
+  int32_t map_x = get_page_offset(slot->page_x, streaming->camera_page[0],
+                                  streaming->header.pages_x);
+  int32_t map_y = get_page_offset(slot->page_y, streaming->camera_page[1],
+                                  streaming->header.pages_y);
+  if (abs(map_x) > PVS_TILE_RADIUS || abs(map_y) > PVS_TILE_RADIUS) {
+    return FLT_MAX;
+  }
+  return get_tile_distance(map_x, map_y, camera_position);
+}
+
+/*!
+ * Finishes the page being loaded, then starts loading the nearest page within
+ * WORLD_PAGE_LOAD_DISTANCE of the camera that is not in a slot yet. It goes to
+ * an empty slot, or replaces the page farthest out of reach. Pages within
+ * reach are never replaced, so a page drawn by a frame still in flight keeps
+ * its slot. Must only be called while the frame pipeline is idle.
+ *
+ * @param[in]  streaming
+ * @param[in]  camera_position In terrain units, within the camera's tile
+ */
+void update_world_streaming(struct WorldStreaming *streaming,
+                            vec3 camera_position) {
+  if (!streaming->is_available) {
+    return;
+  }
+  finish_world_page(streaming);
+  if (streaming->busy) {
+    return;
+  }
+
+  float nearest = WORLD_PAGE_LOAD_DISTANCE;
+  int32_t page[2] = {-1, -1};
+  for (int32_t map_x = -PVS_TILE_RADIUS; map_x <= PVS_TILE_RADIUS; ++map_x) {
+    for (int32_t map_y = -PVS_TILE_RADIUS; map_y <= PVS_TILE_RADIUS;
+         ++map_y) {
+      float distance = get_tile_distance(map_x, map_y, camera_position);
+      int32_t tile_page[2];
+      get_tile_page(streaming, map_x, map_y, tile_page);
+      if (distance < nearest && find_page_slot(streaming, tile_page) < 0) {
+        nearest = distance;
+        page[0] = tile_page[0];
+        page[1] = tile_page[1];
+      }
+    }
+  }
+  if (page[0] < 0) {
+    return;
+  }
+
+  int32_t i_slot = -1;
+  float farthest = WORLD_PAGE_LOAD_DISTANCE;
+  for (int32_t i = 0; i < WORLD_PAGE_SLOT_COUNT; ++i) {
+    struct WorldPageSlot *slot = &streaming->slots[i];
+    if (slot->state == WORLD_PAGE_EMPTY) {
+      i_slot = i;
+      break;
+    }
+
+    float distance = get_page_distance(streaming, slot, camera_position);
+    if (distance > farthest) {
+      farthest = distance;
+      i_slot = i;
+    }
+  }
+  if (i_slot < 0) {
+    // Every slot holds a page within reach
+    return;
+  }
+
+  release_page_map(&streaming->maps[i_slot]);
+  streaming->slots[i_slot] = (struct WorldPageSlot){
+      .page_x = page[0],
+      .page_y = page[1],
+      .state = WORLD_PAGE_LOADING,
+  };
+
+  struct WorldPageBuild *build = &streaming->build;
+  memset(build, 0, sizeof(*build));
+  build->page_x = page[0];
+  build->page_y = page[1];
+  build->slot = i_slot;
+  streaming->busy = true;
+  post_semaphore(streaming->work_ready);
+}
+
+/*!
+ * @return the slot of the page on the world tile at map_x, map_y, or -1 when
+ *         it is not resident
+ */
+int32_t get_world_tile_slot(struct WorldStreaming *streaming, int32_t map_x,
+                            int32_t map_y) {
+  int32_t page[2];
+  get_tile_page(streaming, map_x, map_y, page);
+  int32_t i_slot = find_page_slot(streaming, page);
+  if (i_slot < 0 || streaming->slots[i_slot].state != WORLD_PAGE_RESIDENT) {
+    return -1;
+  }
+  return i_slot;
+}
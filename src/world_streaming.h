@@ -0,0 +1,16 @@
+#pragma once
+#include "types.h"
+
+int32_t create_world_streaming(struct WorldStreaming *streaming,
+                               const char *directory,
+                               WorldPageLoadFunction load,
+                               WorldPageUploadFunction upload, void *data);
+void free_world_streaming(struct WorldStreaming *streaming);
+uint8_t *read_world_page(struct WorldStreaming *streaming, int32_t page_x,
+                         int32_t page_y);
+void move_world_camera_page(struct WorldStreaming *streaming, int32_t x,
+                            int32_t y);
+void update_world_streaming(struct WorldStreaming *streaming,
+                            vec3 camera_position);
+int32_t get_world_tile_slot(struct WorldStreaming *streaming, int32_t map_x,
+                            int32_t map_y);